@@ -24,29 +24,104 @@ struct AllocatorMarker {
     size_t offset;
 };
 
+/**
+ * How an arena allocator backs its reserved range with pages.
+ */
+struct ArenaOptions {
+    /**
+     * Asks for transparent huge pages, so that fewer TLB entries cover the arena.
+     * The range is aligned to the huge page size and committed in huge pages.
+     */
+    bool use_huge_pages = false;
+    /**
+     * Faults the pages in when they are committed, instead of on their first write.
+     */
+    bool prefault = false;
+    /**
+     * Returns the committed pages past the offset to the OS when memory is reclaimed,
+     * so that a rewound arena doesn't keep its peak memory.
+     */
+    bool decommit_on_reset = false;
+};
+
+/**
+ * The size of the steps in which an arena commits its memory, unless it uses huge pages.
+ */
+size_t constexpr ARENA_COMMIT_GRANULARITY = 64 * 1024;
+size_t constexpr ARENA_HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+/**
+ * A bump allocator over a reserved range of virtual memory.
+ *
+ * Only the address range is reserved upfront, and its pages are committed as the
+ * offset advances past them, so an arena can be reserved far larger than it's ever
+ * used. The range never moves, so pointers into the arena stay valid, and nothing is
+ * zeroed or copied upfront. Fresh pages read as zero.
+ */
 struct ArenaAllocator {
     byte *data;
+    /**
+     * The size of the reserved range.
+     */
     size_t length;
     size_t offset;
+    /**
+     * The size of the committed memory at the beginning of the range.
+     */
+    size_t committed;
+    ArenaOptions options;
 
-    ArenaAllocator(size_t size);
+    ArenaAllocator(size_t size, ArenaOptions options = {});
 };
 
+/**
+ * Commits the pages of the arena up to the given offset. Called when an allocation
+ * reaches past the committed memory.
+ */
+extern auto commit_allocator_memory(ArenaAllocator *allocator, size_t end) -> void;
+
+/**
+ * Returns the committed pages past the offset to the OS, which read as zero once they
+ * are committed again.
+ */
+extern auto decommit_allocator_memory(ArenaAllocator *allocator) -> void;
+
+/**
+ * Makes sure that the memory of the arena up to the given offset is committed.
+ */
+inline auto ensure_allocator_committed(ArenaAllocator *allocator, size_t end) -> void {
+    if (end > allocator->committed) {
+        commit_allocator_memory(allocator, end);
+    }
+}
+
 inline auto allocator_marker_from_current_offset(ArenaAllocator *allocator) -> AllocatorMarker {
     return AllocatorMarker { allocator->offset };
 }
 
 /**
- * Allocates an array of the given length from the arena allocator.
+ * Moves the allocator offset forward to the next multiple of the given alignment,
+ * which must be a power of two.
+ */
+inline auto align_allocator_offset(ArenaAllocator *allocator, size_t alignment) -> void {
+    assert((alignment & (alignment - 1)) == 0 && "Alignment must be a power of two");
+    allocator->offset = (allocator->offset + alignment - 1) & ~(alignment - 1);
+}
+
+/**
+ * Allocates an array of the given length from the arena allocator, aligned for its element type.
  */
 template<typename ElementType>
 auto allocate_array(ArenaAllocator *allocator, size_t length) -> AllocatedArrayBlock<ElementType> {
+    size_t constexpr alignment = alignof(ElementType);
+    size_t allocation_offset = (allocator->offset + alignment - 1) & ~(alignment - 1);
     size_t required_size = length * sizeof(ElementType);
-    assert(allocator->offset + required_size <= allocator->length &&
+    assert(allocation_offset + required_size <= allocator->length &&
         "Failed to allocate object array from ArenaAllocator");
-    ElementType* array = reinterpret_cast<ElementType*>(allocator->data + allocator->offset);
-    allocator->offset += required_size;
-    return { array, length };
+    ensure_allocator_committed(allocator, allocation_offset + required_size);
+    ElementType* array = reinterpret_cast<ElementType*>(allocator->data + allocation_offset);
+    allocator->offset = allocation_offset + required_size;
+    return { array, length, allocation_offset };
 }
 
 /**
@@ -125,7 +200,8 @@ inline auto get_debug_printable_bytes(Array<byte> *array) -> Array<DebugByte> {
 }
 
 /**
- * Reclaims memory in the allocator between two markers by zeroing it out.
+ * Reclaims memory in the allocator between two markers. The memory isn't zeroed,
+ * but it's decommitted if the arena decommits on reset.
  * The old marker offset must be greater than or equal to the new marker offset.
  */
 extern auto reclaim_memory_by_markers(
@@ -139,6 +215,55 @@ inline auto reclaim_to_marker(ArenaAllocator *allocator, AllocatorMarker *marker
     return reclaim_memory_by_markers(allocator, &old_marker, marker);
 }
 
+/**
+ * Rewinds an arena to its offset at the beginning of the scope when the scope ends,
+ * which releases everything allocated from it in the scope at once. Rewinding is a
+ * single store that doesn't zero the memory, unless the arena decommits on reset.
+ */
+struct ArenaScope {
+    ArenaAllocator *allocator;
+    size_t offset;
+
+    explicit ArenaScope(ArenaAllocator *allocator) : allocator(allocator), offset(allocator->offset) {}
+    ~ArenaScope() {
+        allocator->offset = offset;
+        if (allocator->options.decommit_on_reset) {
+            decommit_allocator_memory(allocator);
+        }
+    }
+    ArenaScope(ArenaScope const&) = delete;
+    auto operator=(ArenaScope const&) -> ArenaScope& = delete;
+};
+
+/**
+ * The size of the range that each scratch arena reserves.
+ */
+size_t constexpr SCRATCH_ARENA_SIZE = size_t(64) * 1024 * 1024 * 1024;
+
+/**
+ * Returns a scratch arena of the calling thread for temporary allocations.
+ *
+ * Every thread has two scratch arenas, which are reserved on first use. A function
+ * that allocates its result from an arena passes it as the conflicting arena, so it
+ * gets the other scratch arena if its caller allocates the result from a scratch
+ * arena too. Temporaries are then never rewound from under the result.
+ */
+extern auto scratch_arena(ArenaAllocator const *conflict = nullptr) -> ArenaAllocator*;
+
+/**
+ * Sets the options of the scratch arenas that are reserved after the call, i.e. of
+ * the threads that haven't used their scratch arenas yet.
+ */
+extern auto set_scratch_arena_options(ArenaOptions options) -> void;
+
+/**
+ * A scope of temporary allocations from a scratch arena of the calling thread,
+ * which are released when the scope ends.
+ */
+struct ScratchScope : ArenaScope {
+    explicit ScratchScope(ArenaAllocator const *conflict = nullptr) : ArenaScope(scratch_arena(conflict)) {}
+};
+
 extern auto to_array(ArenaAllocator *allocator) -> Array<byte>;
 
 #endif // __BLOOM_H_ALLOCATION__
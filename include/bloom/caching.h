@@ -0,0 +1,120 @@
+/**
+ * Contains the binary AST cache, which stores parsed ASTs on disk keyed by the
+ * content hash of their source, so that unchanged sources aren't tokenized and
+ * parsed again.
+ *
+ * A cache file is a header followed by sections, which are the source, the names
+ * of the interned symbols and every array of the AST. Each section is stored
+ * contiguously at an offset relative to the start of the file, so a mapped cache
+ * file is used in place: the arrays of the loaded AST are views of the mapping.
+ */
+#ifndef __BLOOM_H_CACHING__
+#define __BLOOM_H_CACHING__
+#include <cstddef>
+#include <cstdint>
+#include <bloom/interning.h>
+#include <bloom/parsing.h>
+
+uint32_t constexpr AST_CACHE_MAGIC = 0x414D4C42; // "BLMA" in little-endian
+/**
+ * Must be bumped whenever the layout of the header or of any AST array changes,
+ * so that stale cache files are parsed again instead of being misread.
+ */
+uint32_t constexpr AST_CACHE_VERSION = 6;
+
+/**
+ * The default cache directory, relative to the current working directory.
+ * It's overridden by the BLOOMC_CACHE_DIR environment variable.
+ */
+char const *const AST_CACHE_DIRECTORY_NAME = ".bloomc-cache";
+
+struct ASTCacheSection {
+    /**
+     * The offset of the section from the start of the file.
+     */
+    uint64_t offset;
+    /**
+     * The number of elements in the section.
+     */
+    uint64_t length;
+};
+
+struct ASTCacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t source_hash;
+    /**
+     * The hash of the file after this field, i.e. of the section table and the sections.
+     * The indices in the AST arrays aren't validated one by one, so a damaged file must not be mapped.
+     */
+    uint64_t content_hash;
+    ASTCacheSection source;
+    /**
+     * The name of every non-builtin symbol as a span of the source, in symbol ID order.
+     */
+    ASTCacheSection symbol_names;
+
+    ASTCacheSection kinds;
+    ASTCacheSection parents;
+    ASTCacheSection subtree_sizes;
+    ASTCacheSection payloads;
+    ASTCacheSection expressions;
+    ASTCacheSection proc_defs;
+    ASTCacheSection variable_definitions;
+    ASTCacheSection expression_ops;
+    ASTCacheSection expression_op_offsets;
+    ASTCacheSection proc_params;
+    ASTCacheSection types;
+};
+
+/**
+ * An AST that is loaded from a mapped cache file. The mapping must outlive the AST.
+ */
+struct MappedAST {
+    /**
+     * The mapped cache file, or null if the AST couldn't be loaded from the cache.
+     */
+    byte *mapping;
+    size_t mapping_length;
+    AST ast;
+};
+
+/**
+ * Hashes the source as the key of its cache file.
+ */
+extern auto hash_source(String const *source) -> uint64_t;
+
+/**
+ * Writes the AST and the names of its symbols to the cache file at the given path.
+ *
+ * The file is written under a temporary name and renamed into place, so that
+ * a concurrent build never maps a partially written file.
+ * @return true on success, false on failure.
+ */
+extern auto write_ast_cache(
+    char const *path,
+    uint64_t source_hash,
+    AST const *ast,
+    SymbolTable const *symbols
+) -> bool;
+
+/**
+ * Maps the cache file at the given path and loads the AST of the source from it.
+ *
+ * The symbol names of the file are interned into the symbol table, which must only
+ * contain the builtin symbols, so that the symbol IDs of the AST stay valid.
+ * The array views of the AST are allocated from the given allocator.
+ * @return The loaded AST, whose mapping is null if the file doesn't exist, is
+ *         of another version, doesn't match the source or is damaged.
+ */
+extern auto map_ast_cache(
+    char const *path,
+    String const *source,
+    uint64_t source_hash,
+    SymbolTable *symbols,
+    ArenaAllocator *allocator
+) -> MappedAST;
+
+extern auto unmap_ast_cache(MappedAST *mapped_ast) -> void;
+
+#endif // __BLOOM_H_CACHING__
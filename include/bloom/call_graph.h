@@ -0,0 +1,75 @@
+/**
+ * Contains the call graph of the top-level procedures of a resolved AST, which
+ * tells the procedures that are reachable from the entry points of the program.
+ *
+ * The graph is stored in compressed sparse row form: the callees of every
+ * procedure are a contiguous range of one callee array, so walking it only
+ * follows array indices.
+ */
+#ifndef __BLOOM_H_CALL_GRAPH__
+#define __BLOOM_H_CALL_GRAPH__
+#include <cstddef>
+#include <cstdint>
+#include <bloom/allocation.h>
+#include <bloom/array.h>
+#include <bloom/interning.h>
+#include <bloom/parsing.h>
+#include <bloom/resolution.h>
+
+/**
+ * The name of the procedure that a program starts from.
+ */
+char const *const ENTRY_PROC_NAME = "main";
+
+struct CallGraph {
+    /**
+     * The definition node of every top-level procedure, in source order.
+     * A procedure is referred to by its index in this array.
+     */
+    Array<NodeId> procs;
+    /**
+     * The callees of procedure i are at [callee_offsets[i], callee_offsets[i + 1])
+     * of the callee array, so there's one more offset than procedures.
+     */
+    Array<uint32_t> callee_offsets;
+    Array<uint32_t> callees;
+    /**
+     * Whether each procedure is the entry procedure or an exported one, whose
+     * name has to stay callable from outside the program.
+     */
+    Array<bool> is_root;
+    /**
+     * Whether each procedure is reachable from the root procedures.
+     */
+    Array<bool> is_reachable;
+    size_t reachable_count;
+    /**
+     * The number of root symbols that name no top-level procedure.
+     */
+    size_t error_count;
+};
+
+/**
+ * Builds the call graph of the top-level procedures and marks the procedures
+ * that are reachable from the procedures with the given root symbols.
+ *
+ * Any use of a procedure name counts as an edge, not only calls, so a procedure
+ * is kept whenever its name is referred to from a reachable procedure.
+ * A root symbol that names no top-level procedure is reported as an error.
+ * The graph is allocated from the given allocator.
+ */
+extern auto build_call_graph(
+    AST *ast,
+    NameResolution *resolution,
+    SymbolTable *symbols,
+    Array<SymbolId> root_symbols,
+    ArenaAllocator *allocator
+) -> CallGraph;
+
+/**
+ * Returns the index of the procedure with the given definition node, or
+ * UINT32_MAX if the node isn't a top-level procedure.
+ */
+extern auto call_graph_proc(CallGraph *graph, NodeId node) -> uint32_t;
+
+#endif // __BLOOM_H_CALL_GRAPH__
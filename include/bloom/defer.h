@@ -1,12 +1,19 @@
 #ifndef __BLOOM_H_DEFER__
 #define __BLOOM_H_DEFER__
-#include <functional>
+#include <utility>
 
+/**
+ * Calls a function when it goes out of scope. The function is stored by value,
+ * so deferring doesn't allocate and the call can be inlined.
+ */
+template<typename Function>
 class Defer {
-    std::function<void()> func;
+    Function func;
 public:
-    Defer(std::function<void()> &&func) : func(std::move(func)) {}
+    Defer(Function &&func) : func(std::move(func)) {}
     ~Defer() { func(); }
+    Defer(Defer const&) = delete;
+    auto operator=(Defer const&) -> Defer& = delete;
 };
 
 #define _BLOOM_DEFER_CONCAT_INNER(a, b) a##b
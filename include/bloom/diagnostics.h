@@ -0,0 +1,66 @@
+/**
+ * Contains the source position lookup and source excerpts used by diagnostics.
+ *
+ * Tokens only store their byte offset into the source. Lines and columns are
+ * computed on demand from a line index, which is only built once something
+ * needs to be reported.
+ */
+#ifndef __BLOOM_H_DIAGNOSTICS__
+#define __BLOOM_H_DIAGNOSTICS__
+#include <cstdint>
+#include <cstdio>
+#include <bloom/allocation.h>
+#include <bloom/array.h>
+#include <bloom/string.h>
+#include <bloom/tokenization.h>
+
+/**
+ * Holds the offset of the first byte of every line of a source.
+ */
+struct LineIndex {
+    String source;
+    /**
+     * Sorted line begin offsets. The first line always begins at offset 0.
+     */
+    Array<uint32_t> line_begins;
+};
+
+/**
+ * Builds the line index of the given source with a single vectorized newline pass.
+ */
+extern auto build_line_index(String const *source, ArenaAllocator *allocator) -> LineIndex;
+
+/**
+ * Returns the 0-based index of the line that contains the given source offset.
+ */
+extern auto line_index_line_of(LineIndex const *index, uint32_t offset) -> size_t;
+
+/**
+ * Computes the line and column of the given source offset with a binary search.
+ */
+extern auto line_index_position(LineIndex const *index, uint32_t offset) -> Token::Position;
+
+/**
+ * Returns the content of the line that contains the given source offset,
+ * without the trailing newline.
+ */
+extern auto line_index_line_content(LineIndex const *index, uint32_t offset) -> String;
+
+/**
+ * Prints the source line that contains the given offset, followed by
+ * a caret pointing at the offset, e.g.
+ *
+ *     3 |     printf("Sum: %", x +)
+ *       |                         ^
+ */
+extern auto print_source_excerpt(FILE *file, LineIndex const *index, uint32_t offset) -> void;
+
+/**
+ * Prints an error message to standard error output, along with the position
+ * and the source line of the given offset.
+ *
+ * The line index is built on the spot, so this is meant for fatal errors only.
+ */
+extern auto print_source_error(String const *source, uint32_t offset, char const *message) -> void;
+
+#endif // __BLOOM_H_DIAGNOSTICS__
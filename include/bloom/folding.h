@@ -0,0 +1,52 @@
+/**
+ * Contains identical procedure folding, which finds the reachable procedures
+ * whose definitions are structurally identical, so that only one C definition
+ * is emitted for each group of them.
+ *
+ * Procedures are compared with their names normalized away: a parameter is
+ * identified by its position, a local variable by the position of its
+ * definition in the procedure, and a recursive call by being one. Candidates
+ * are grouped by a structural hash and then compared in full, so hash
+ * collisions never fold different procedures.
+ */
+#ifndef __BLOOM_H_FOLDING__
+#define __BLOOM_H_FOLDING__
+#include <cstddef>
+#include <cstdint>
+#include <bloom/allocation.h>
+#include <bloom/array.h>
+#include <bloom/call_graph.h>
+#include <bloom/parsing.h>
+#include <bloom/resolution.h>
+#include <bloom/type_checking.h>
+
+struct ProcFolding {
+    /**
+     * The procedure that each procedure is folded into, indexed like the procedures
+     * of the call graph. It's the procedure itself if it isn't folded, and otherwise
+     * the first identical procedure in source order.
+     */
+    Array<uint32_t> representatives;
+    size_t folded_count;
+};
+
+/**
+ * Folds the identical reachable procedures of a type-checked AST.
+ * The folding is allocated from the given allocator.
+ */
+extern auto fold_identical_procs(
+    AST *ast,
+    NameResolution *resolution,
+    TypeCheck *type_check,
+    CallGraph *call_graph,
+    ArenaAllocator *allocator
+) -> ProcFolding;
+
+/**
+ * Returns whether the procedure is folded into another one, so its body isn't emitted.
+ */
+inline auto is_folded(ProcFolding *folding, uint32_t proc) -> bool {
+    return folding->representatives[proc] != proc;
+}
+
+#endif // __BLOOM_H_FOLDING__
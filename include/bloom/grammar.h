@@ -0,0 +1,187 @@
+/**
+ * Contains the grammar of the language as a declarative list of rules, which
+ * the parse table is generated from at compile time.
+ *
+ * The parser is in one of a few states, and in each state, the type of the next
+ * token alone selects the action that parses it. The parse table maps every
+ * (state, token type) pair to its rule, so the parser dispatches on a token with
+ * a single table lookup, and new syntax is added by adding a rule here.
+ */
+#ifndef __BLOOM_H_GRAMMAR__
+#define __BLOOM_H_GRAMMAR__
+#include <cstddef>
+#include <cstdint>
+#include <bloom/parsing.h>
+#include <bloom/tokenization.h>
+
+enum class ParserState : uint8_t {
+    /**
+     * At the beginning of a top-level line, where definitions are looked for.
+     */
+    TOP_LEVEL,
+    /**
+     * At the beginning of a statement in a procedure body.
+     */
+    STATEMENT,
+    /**
+     * At the value of a definition, which is a procedure or an expression.
+     */
+    VALUE,
+    /**
+     * At the beginning of an operand of an expression.
+     */
+    OPERAND,
+    /**
+     * After an operand of an expression, where an operator may continue it.
+     */
+    OPERATOR,
+};
+size_t constexpr PARSER_STATE_COUNT = static_cast<size_t>(ParserState::OPERATOR) + 1;
+
+enum class ParseAction : uint8_t {
+    // Top level
+    DEFINITION,
+    END,
+    SKIP,
+
+    // Statements and values
+    EXPRESSION,
+    IDENTIFIER_STATEMENT,
+    PROC_DEFINITION,
+
+    // Operands
+    GROUP,
+    IDENTIFIER,
+    INTEGER_LITERAL,
+    NEGATE,
+    STRING_LITERAL,
+    UNEXPECTED_OPERAND,
+
+    // Operators
+    BINARY_OPERATOR,
+    CALL,
+    NO_OPERATOR,
+};
+
+/**
+ * The lowest binding power of the binary operators, which a whole expression is parsed with.
+ * Operators with a higher binding power bind tighter, and operators of the same binding
+ * power are left-associative.
+ */
+uint8_t constexpr LOWEST_PRECEDENCE = 1;
+/**
+ * Prefix operators bind tighter than any binary operator.
+ */
+uint8_t constexpr PREFIX_PRECEDENCE = 5;
+/**
+ * Calls bind tighter than any other operator.
+ */
+uint8_t constexpr CALL_PRECEDENCE = 6;
+
+struct GrammarRule {
+    ParserState state;
+    TokenType token_type;
+    ParseAction action;
+    /**
+     * The binding power of an operator. It's 0 for other rules, which ends an expression.
+     */
+    uint8_t precedence;
+    /**
+     * The op that a binary operator appends.
+     */
+    ExpressionOpKind op_kind;
+};
+
+/**
+ * The action of the tokens that no rule of the state matches.
+ */
+struct DefaultGrammarRule {
+    ParserState state;
+    ParseAction action;
+};
+
+constexpr DefaultGrammarRule DEFAULT_GRAMMAR_RULES[] = {
+    { ParserState::TOP_LEVEL, ParseAction::SKIP },
+    { ParserState::STATEMENT, ParseAction::EXPRESSION },
+    { ParserState::VALUE,     ParseAction::EXPRESSION },
+    { ParserState::OPERAND,   ParseAction::UNEXPECTED_OPERAND },
+    { ParserState::OPERATOR,  ParseAction::NO_OPERATOR },
+};
+
+/**
+ * All rules of the grammar. The parse table is generated from this list, so adding
+ * syntax only requires adding its rules here and a handler for any new action.
+ */
+constexpr GrammarRule GRAMMAR_RULES[] = {
+    { ParserState::TOP_LEVEL, TokenType::END,        ParseAction::END },
+    { ParserState::TOP_LEVEL, TokenType::IDENTIFIER, ParseAction::DEFINITION },
+
+    { ParserState::STATEMENT, TokenType::IDENTIFIER, ParseAction::IDENTIFIER_STATEMENT },
+
+    { ParserState::VALUE, TokenType::KEYWORD_PROC, ParseAction::PROC_DEFINITION },
+
+    { ParserState::OPERAND, TokenType::IDENTIFIER,       ParseAction::IDENTIFIER },
+    { ParserState::OPERAND, TokenType::INTEGER_LITERAL,  ParseAction::INTEGER_LITERAL },
+    { ParserState::OPERAND, TokenType::PARENTHESIS_OPEN, ParseAction::GROUP },
+    { ParserState::OPERAND, TokenType::STRING_LITERAL,   ParseAction::STRING_LITERAL },
+    { ParserState::OPERAND, TokenType::SUBTRACT,         ParseAction::NEGATE },
+
+    { ParserState::OPERATOR, TokenType::EQUAL,            ParseAction::BINARY_OPERATOR, 1, ExpressionOpKind::EQUAL },
+    { ParserState::OPERATOR, TokenType::NOT_EQUAL,        ParseAction::BINARY_OPERATOR, 1, ExpressionOpKind::NOT_EQUAL },
+    { ParserState::OPERATOR, TokenType::LESS_THAN,        ParseAction::BINARY_OPERATOR, 2, ExpressionOpKind::LESS_THAN },
+    { ParserState::OPERATOR, TokenType::LESS_EQUAL,       ParseAction::BINARY_OPERATOR, 2, ExpressionOpKind::LESS_EQUAL },
+    { ParserState::OPERATOR, TokenType::GREATER_THAN,     ParseAction::BINARY_OPERATOR, 2, ExpressionOpKind::GREATER_THAN },
+    { ParserState::OPERATOR, TokenType::GREATER_EQUAL,    ParseAction::BINARY_OPERATOR, 2, ExpressionOpKind::GREATER_EQUAL },
+    { ParserState::OPERATOR, TokenType::ADD,              ParseAction::BINARY_OPERATOR, 3, ExpressionOpKind::ADD },
+    { ParserState::OPERATOR, TokenType::SUBTRACT,         ParseAction::BINARY_OPERATOR, 3, ExpressionOpKind::SUBTRACT },
+    { ParserState::OPERATOR, TokenType::MULTIPLY,         ParseAction::BINARY_OPERATOR, 4, ExpressionOpKind::MULTIPLY },
+    { ParserState::OPERATOR, TokenType::DIVIDE,           ParseAction::BINARY_OPERATOR, 4, ExpressionOpKind::DIVIDE },
+    { ParserState::OPERATOR, TokenType::MODULO,           ParseAction::BINARY_OPERATOR, 4, ExpressionOpKind::MODULO },
+    { ParserState::OPERATOR, TokenType::PARENTHESIS_OPEN, ParseAction::CALL, CALL_PRECEDENCE, ExpressionOpKind::CALL },
+};
+
+/**
+ * The rule of every (state, token type) pair, built at compile time from the grammar.
+ */
+struct ParseTable {
+    GrammarRule rules[PARSER_STATE_COUNT][TOKEN_TYPE_COUNT];
+    /**
+     * Set if a state has no default rule, or if two rules match the same token in a state.
+     */
+    bool has_conflicts;
+
+    constexpr ParseTable() : rules(), has_conflicts(false) {
+        bool is_set[PARSER_STATE_COUNT][TOKEN_TYPE_COUNT] = {};
+        bool has_default[PARSER_STATE_COUNT] = {};
+        for (auto const &default_rule : DEFAULT_GRAMMAR_RULES) {
+            auto state = static_cast<size_t>(default_rule.state);
+            has_conflicts = has_conflicts || has_default[state];
+            has_default[state] = true;
+            for (size_t type = 0; type < TOKEN_TYPE_COUNT; type++) {
+                rules[state][type] = GrammarRule {
+                    .state = default_rule.state,
+                    .token_type = static_cast<TokenType>(type),
+                    .action = default_rule.action,
+                    .precedence = 0,
+                    .op_kind = ExpressionOpKind::UNKNOWN,
+                };
+            }
+        }
+        for (auto const &rule : GRAMMAR_RULES) {
+            auto state = static_cast<size_t>(rule.state);
+            auto type = static_cast<size_t>(rule.token_type);
+            has_conflicts = has_conflicts || is_set[state][type];
+            is_set[state][type] = true;
+            rules[state][type] = rule;
+        }
+        for (size_t state = 0; state < PARSER_STATE_COUNT; state++) {
+            has_conflicts = has_conflicts || !has_default[state];
+        }
+    }
+};
+
+constexpr ParseTable PARSE_TABLE = ParseTable();
+static_assert(!PARSE_TABLE.has_conflicts,
+    "Every parser state needs exactly one default rule and at most one rule per token type");
+
+#endif // __BLOOM_H_GRAMMAR__
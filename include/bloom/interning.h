@@ -0,0 +1,124 @@
+/**
+ * Contains the identifier interning table, which maps every distinct identifier
+ * to a dense 32-bit symbol ID. Identifiers can then be compared and hashed as
+ * integers instead of byte spans.
+ *
+ * The table is split into shards, each of which is an open-addressing hash table
+ * guarded by its own mutex, so that parallel lexers can intern into the same table.
+ */
+#ifndef __BLOOM_H_INTERNING__
+#define __BLOOM_H_INTERNING__
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <bloom/allocation.h>
+#include <bloom/string.h>
+
+using SymbolId = uint32_t;
+
+/**
+ * Marks an empty hash table slot. It's never handed out as a symbol ID.
+ */
+SymbolId constexpr SYMBOL_NONE = UINT32_MAX;
+
+/**
+ * Names that are interned when the table is created, in this order,
+ * so that their symbol IDs are known at compile time.
+ */
+enum BuiltinSymbol : SymbolId {
+    SYMBOL_INT = 0,
+    SYMBOL_PRINTF,
+    SYMBOL_BOOL,
+    SYMBOL_I8,
+    SYMBOL_I16,
+    SYMBOL_I32,
+    SYMBOL_I64,
+    SYMBOL_U8,
+    SYMBOL_U16,
+    SYMBOL_U32,
+    SYMBOL_U64,
+    BUILTIN_SYMBOL_COUNT,
+};
+
+char const *const BUILTIN_SYMBOL_NAMES[BUILTIN_SYMBOL_COUNT] = {
+    /* SYMBOL_INT */    "Int",
+    /* SYMBOL_PRINTF */ "printf",
+    /* SYMBOL_BOOL */   "Bool",
+    /* SYMBOL_I8 */     "I8",
+    /* SYMBOL_I16 */    "I16",
+    /* SYMBOL_I32 */    "I32",
+    /* SYMBOL_I64 */    "I64",
+    /* SYMBOL_U8 */     "U8",
+    /* SYMBOL_U16 */    "U16",
+    /* SYMBOL_U32 */    "U32",
+    /* SYMBOL_U64 */    "U64",
+};
+
+size_t constexpr SYMBOL_TABLE_SHARD_BITS = 4;
+size_t constexpr SYMBOL_TABLE_SHARD_COUNT = 1 << SYMBOL_TABLE_SHARD_BITS;
+/**
+ * The initial number of slots of each shard (a power of two).
+ */
+size_t constexpr SYMBOL_TABLE_SHARD_MIN_CAPACITY = 16;
+
+struct SymbolTableSlot {
+    /**
+     * The low bits of the name hash, which are compared before the name itself.
+     */
+    uint32_t hash;
+    SymbolId symbol;
+    String name;
+};
+
+struct SymbolTableShard {
+    std::mutex mutex;
+    SymbolTableSlot *slots;
+    /**
+     * The number of slots, which is always a power of two.
+     */
+    size_t capacity;
+    size_t count;
+};
+
+struct SymbolTable {
+    SymbolTableShard shards[SYMBOL_TABLE_SHARD_COUNT];
+    /**
+     * Guards the allocator, the names and the symbol count. It's only taken
+     * when a new name is interned, always after the lock of a shard.
+     */
+    std::mutex allocation_mutex;
+    ArenaAllocator *allocator;
+    /**
+     * The name of every symbol, indexed by its symbol ID.
+     */
+    String *names;
+    size_t names_capacity;
+    uint32_t symbol_count;
+};
+
+/**
+ * Creates a symbol table in the given arena allocator, which must not be used
+ * by anything else, as the table keeps allocating from it as it grows.
+ */
+extern auto symbol_table_from_allocator(ArenaAllocator *allocator) -> SymbolTable*;
+
+/**
+ * Returns the symbol ID of the given name, and assigns the next free ID to
+ * the name if it hasn't been interned before.
+ *
+ * The name must stay valid for as long as the table is used.
+ * This is safe to call from multiple threads at once.
+ */
+extern auto intern_symbol(SymbolTable *table, String const *name) -> SymbolId;
+
+/**
+ * Returns the name of the given symbol.
+ *
+ * This must not be called while other threads are interning into the table.
+ */
+inline auto symbol_name(SymbolTable const *table, SymbolId symbol) -> String {
+    assert(symbol < table->symbol_count && "Symbol ID out of bounds");
+    return table->names[symbol];
+}
+
+#endif // __BLOOM_H_INTERNING__
@@ -0,0 +1,76 @@
+/**
+ * Contains the conversion of numeric literals into values.
+ */
+#ifndef __BLOOM_H_NUMBERS__
+#define __BLOOM_H_NUMBERS__
+#include <cstddef>
+#include <cstdint>
+
+enum class IntegerLiteralStatus : uint8_t {
+    OK = 0,
+    INVALID_DIGIT,
+    MISPLACED_SEPARATOR,
+    MISSING_DIGITS,
+    OVERFLOW,
+};
+
+constexpr auto to_string(IntegerLiteralStatus status) -> char const* {
+    switch (status) {
+        case IntegerLiteralStatus::OK:                  return "Valid integer literal";
+        case IntegerLiteralStatus::INVALID_DIGIT:       return "Invalid digit in integer literal";
+        case IntegerLiteralStatus::MISPLACED_SEPARATOR: return "Digit separators must be placed between digits";
+        case IntegerLiteralStatus::MISSING_DIGITS:      return "Integer literal has no digits";
+        case IntegerLiteralStatus::OVERFLOW:            return "Integer literal doesn't fit in 64 bits";
+    }
+    return "Unknown integer literal status";
+}
+
+/**
+ * Converts an integer literal into its value. Decimal (`1_000`), hexadecimal
+ * (`0xFF`) and binary (`0b1010`) literals are supported, and `_` can be used
+ * to separate digits.
+ *
+ * Exactly `length` bytes are read, so the literal doesn't have to be null-terminated.
+ * The value is only written if the literal is valid.
+ *
+ * @example
+ * #include <bloom/numbers.h>
+ * #include <cstdio>
+ * #include <cstring>
+ * >>> auto parse = [](char const *literal, uint64_t *value) { return parse_integer_literal(literal, strlen(literal), value); };
+ * >>> uint64_t value = 0;
+ * >>> assert(parse("42", &value) == IntegerLiteralStatus::OK && value == 42);
+ * >>> assert(parse("1_000_000", &value) == IntegerLiteralStatus::OK && value == 1000000);
+ * >>> assert(parse("1234567_89", &value) == IntegerLiteralStatus::OK && value == 123456789);
+ * >>> assert(parse("0xF_f", &value) == IntegerLiteralStatus::OK && value == 255);
+ * >>> assert(parse("0b1010", &value) == IntegerLiteralStatus::OK && value == 10);
+ * >>> assert(parse("00000000000000000000000000000001", &value) == IntegerLiteralStatus::OK && value == 1);
+ * >>> assert(parse("18446744073709551615", &value) == IntegerLiteralStatus::OK && value == UINT64_MAX);
+ * >>> assert(parse("0xFFFF_FFFF_FFFF_FFFF", &value) == IntegerLiteralStatus::OK && value == UINT64_MAX);
+ * >>> value = 7;
+ * >>> assert(parse("18446744073709551616", &value) == IntegerLiteralStatus::OVERFLOW && value == 7);
+ * >>> assert(parse("99999999999999999999", &value) == IntegerLiteralStatus::OVERFLOW);
+ * >>> assert(parse("0x1_0000_0000_0000_0000", &value) == IntegerLiteralStatus::OVERFLOW);
+ * >>> assert(parse("0b10000000000000000000000000000000000000000000000000000000000000000", &value) == IntegerLiteralStatus::OVERFLOW);
+ * >>> assert(parse("_1", &value) == IntegerLiteralStatus::MISPLACED_SEPARATOR);
+ * >>> assert(parse("1_", &value) == IntegerLiteralStatus::MISPLACED_SEPARATOR);
+ * >>> assert(parse("1__0", &value) == IntegerLiteralStatus::MISPLACED_SEPARATOR);
+ * >>> assert(parse("0x_FF", &value) == IntegerLiteralStatus::MISPLACED_SEPARATOR);
+ * >>> assert(parse("", &value) == IntegerLiteralStatus::MISSING_DIGITS);
+ * >>> assert(parse("0x", &value) == IntegerLiteralStatus::MISSING_DIGITS);
+ * >>> assert(parse("12a", &value) == IntegerLiteralStatus::INVALID_DIGIT);
+ * >>> assert(parse("0b102", &value) == IntegerLiteralStatus::INVALID_DIGIT);
+ * >>> assert(value == 7);
+ * >>> // Round trip pseudo-random values of every magnitude through the decimal and hexadecimal paths
+ * >>> char buffer[32];
+ * >>> uint64_t state = 1;
+ * >>> for (int i = 0; i < 100000; i++) {
+ * >>> state = state * 6364136223846793005ull + 1442695040888963407ull;
+ * >>> uint64_t expected = state >> (state % 64);
+ * >>> int length = snprintf(buffer, sizeof(buffer), i % 2 == 0 ? "%llu" : "0x%llX", static_cast<unsigned long long>(expected));
+ * >>> assert(parse_integer_literal(buffer, length, &value) == IntegerLiteralStatus::OK && value == expected);
+ * >>> }
+ */
+extern auto parse_integer_literal(char const *data, size_t length, uint64_t *value) -> IntegerLiteralStatus;
+
+#endif // __BLOOM_H_NUMBERS__
@@ -1,92 +1,390 @@
 #ifndef __BLOOM_H_PARSING__
 #define __BLOOM_H_PARSING__
 #include <bloom/array.h>
+#include <bloom/segmented_array.h>
 #include <bloom/string.h>
 #include <bloom/tokenization.h>
 
 enum class ASTNodeType : uint8_t {
     UNKNOWN = 0,
-    BINARY_ADD,
-    IDENTIFIER,
-    INTEGER_LITERAL,
+    EXPRESSION,
     PASS,
-    PROC_CALL,
     PROC_DEF,
     RETURN,
-    STRING_LITERAL,
     VARIABLE_DEFINITION,
 };
 
-enum class BinaryOperatorType : uint8_t {
-    ADD = '+',
-};
+/**
+ * Refers to a node of an AST by its index. Nodes refer to each other by their
+ * IDs instead of pointers, so the AST can be copied or persisted as it is.
+ */
+using NodeId = uint32_t;
+NodeId constexpr NODE_NONE = UINT32_MAX;
 
-struct IntegerLiteralASTNode {
-    union {
-        int64_t value;
-        uint64_t uvalue;
-    };
+/**
+ * Refers to a type of an AST by its index.
+ */
+using TypeId = uint32_t;
+TypeId constexpr TYPE_NONE = UINT32_MAX;
+
+/**
+ * A range of the source code, e.g. a name. It replaces a String
+ * in the AST, so that the AST doesn't contain pointers.
+ */
+struct SourceSpan {
+    uint32_t offset;
+    uint32_t length;
 };
 
 struct ProcParameterASTNode {
-    String name;
+    SourceSpan name;
+    SymbolId symbol;
+    TypeId type;
 };
 
 struct TypeASTNode {
-    String name;
+    SourceSpan name;
+    SymbolId symbol;
+};
+
+/**
+ * The body statements are the children of the node.
+ */
+struct ProcDefASTNode {
+    SourceSpan name;
+    SymbolId symbol;
+    /**
+     * The index of the first parameter in the parameter array of the AST.
+     */
+    uint32_t first_parameter;
+    uint32_t parameter_count;
+    TypeId return_type;
+};
+
+enum class ExpressionOpKind : uint8_t {
+    UNKNOWN = 0,
+
+    // Operands
+    IDENTIFIER,
+    INTEGER_LITERAL,
+    STRING_LITERAL,
+
+    // Binary operators, whose left operand comes before the right one
+    ADD,
+    SUBTRACT,
+    MULTIPLY,
+    DIVIDE,
+    MODULO,
+    EQUAL,
+    NOT_EQUAL,
+    LESS_THAN,
+    LESS_EQUAL,
+    GREATER_THAN,
+    GREATER_EQUAL,
+
+    // Prefix operators
+    NEGATE,
+
+    /**
+     * Calls the callee with its arguments. The callee comes first,
+     * followed by as many arguments as the argument count.
+     */
+    CALL,
 };
 
-struct ASTNode {
-    ASTNodeType type;
-    ASTNode *parent;
+/**
+ * An operand or operator of an expression. The ops of an expression are stored
+ * contiguously in postfix order, i.e. every operator comes right after its operands,
+ * so an expression can be walked linearly, e.g. evaluated with a stack.
+ */
+struct ExpressionOp {
+    ExpressionOpKind kind;
+    /**
+     * Set if an integer literal is too large for a signed 64-bit integer.
+     */
+    bool is_unsigned;
+    /**
+     * Set if a string literal contains escape sequences.
+     */
+    bool has_escapes;
+    /**
+     * The number of ops in the subexpression that ends at this op, including this op.
+     * The last operand of an operator ends right before it, and every other operand ends
+     * right before the subexpression of the operand after it.
+     */
+    uint32_t size;
     union {
-        struct {
-            BinaryOperatorType oprt;
-            String identifier_left;
-            String identifier_right;
-        } binary_operation;
-        String identifier;
-        struct {
-            IntegerLiteralASTNode value;
-        } integer_literal;
-        struct {
-            Array<ASTNode> arguments;
-            String caller_identifier;
-        } proc_call;
-        struct {
-            String name;
-            Array<ProcParameterASTNode> parameters;
-            TypeASTNode *return_type;
-            Array<ASTNode> body;
-        } proc_def;
-        ASTNode *return_value;
-        struct {
-            String value;
-        } string_literal;
-        struct {
-            String name;
-            IntegerLiteralASTNode value;
-        } variable_definition;
+        /**
+         * The name of an identifier, or the content of a string literal as it's
+         * written in the source, with escape sequences.
+         */
+        SourceSpan span;
+        uint64_t integer_value;
+        uint32_t argument_count;
     };
 };
+static_assert(sizeof(ExpressionOp) == 16, "ExpressionOp size is not 16 bytes");
 
-extern auto parse(Array<Token> *tokens, ArenaAllocator *allocator) -> Array<ASTNode>;
+inline auto is_binary_operator(ExpressionOpKind kind) -> bool {
+    return kind >= ExpressionOpKind::ADD && kind <= ExpressionOpKind::GREATER_EQUAL;
+}
+
+struct ExpressionASTNode {
+    /**
+     * The index of the first op in the op array of the AST.
+     * The last op of the expression is its root.
+     */
+    uint32_t first_op;
+    uint32_t op_count;
+};
+
+/**
+ * The value is an EXPRESSION node.
+ */
+struct VariableDefinitionASTNode {
+    SourceSpan name;
+    SymbolId symbol;
+    NodeId value;
+};
+
+/**
+ * Holds the nodes of an AST as separate arrays.
+ *
+ * The nodes are laid out in pre-order, i.e. every node is followed by its
+ * descendants, and each node knows the size of its subtree. Together these
+ * allow skipping over a subtree in O(1), so the children of a node can be
+ * iterated without visiting any grandchildren.
+ *
+ * Every node has a kind and a parent. Its payload is stored in the array of its kind,
+ * at the index given by the payload array, so each node only takes the space its
+ * kind needs. Nodes without a payload (e.g. PASS) don't take any space there. For
+ * RETURN nodes, the payload is the ID of the returned value node instead.
+ */
+struct AST {
+    String source;
+    /**
+     * The number of parse errors. The failed parts of the source are missing from an AST with errors.
+     */
+    size_t error_count;
+    SegmentedArray<ASTNodeType> *kinds;
+    SegmentedArray<NodeId> *parents;
+    /**
+     * The number of nodes in the subtree of each node, including the node itself.
+     */
+    SegmentedArray<uint32_t> *subtree_sizes;
+    SegmentedArray<uint32_t> *payloads;
+
+    SegmentedArray<ExpressionASTNode> *expressions;
+    SegmentedArray<ProcDefASTNode> *proc_defs;
+    SegmentedArray<VariableDefinitionASTNode> *variable_definitions;
+
+    SegmentedArray<ExpressionOp> *expression_ops;
+    /**
+     * The source offset of the token that created each expression op, kept apart
+     * from the ops so that they stay small. Only the error reporting reads them.
+     */
+    SegmentedArray<uint32_t> *expression_op_offsets;
+    SegmentedArray<ProcParameterASTNode> *proc_params;
+    SegmentedArray<TypeASTNode> *types;
+};
+
+inline auto ast_node_count(AST const *ast) -> size_t {
+    return ast->kinds->length;
+}
+
+inline auto ast_kind(AST const *ast, NodeId node) -> ASTNodeType {
+    return *segmented_array_at(ast->kinds, node);
+}
+
+inline auto ast_parent(AST const *ast, NodeId node) -> NodeId {
+    return *segmented_array_at(ast->parents, node);
+}
+
+inline auto ast_subtree_size(AST const *ast, NodeId node) -> uint32_t {
+    return *segmented_array_at(ast->subtree_sizes, node);
+}
+
+/**
+ * Returns the node after the subtree of the given node, i.e. its next sibling
+ * if it has one. This may be one past the last node of the AST.
+ */
+inline auto ast_subtree_end(AST const *ast, NodeId node) -> NodeId {
+    return node + ast_subtree_size(ast, node);
+}
+
+/**
+ * Calls the visitor for every direct child of the node in order.
+ * The subtree of each child is skipped over without visiting it.
+ */
+template<typename Visitor>
+inline auto ast_for_each_child(AST const *ast, NodeId node, Visitor &&visit) -> void {
+    NodeId end = ast_subtree_end(ast, node);
+    for (NodeId child = node + 1; child < end; child = ast_subtree_end(ast, child)) {
+        visit(child);
+    }
+}
+
+inline auto ast_child_count(AST const *ast, NodeId node) -> size_t {
+    size_t count = 0;
+    ast_for_each_child(ast, node, [&](NodeId) { count++; });
+    return count;
+}
+
+/**
+ * Calls the visitor for every root node, i.e. every node without a parent, in order.
+ */
+template<typename Visitor>
+inline auto ast_for_each_root(AST const *ast, Visitor &&visit) -> void {
+    for (NodeId root = 0; root < ast_node_count(ast); root = ast_subtree_end(ast, root)) {
+        visit(root);
+    }
+}
+
+/**
+ * Visits every node of the AST in pre-order. The visitor returns whether the
+ * children of the node should be visited too. If not, its subtree is skipped in O(1).
+ */
+template<typename Visitor>
+inline auto ast_visit(AST const *ast, Visitor &&visit) -> void {
+    NodeId end = static_cast<NodeId>(ast_node_count(ast));
+    for (NodeId node = 0; node < end;) {
+        node = visit(node) ? node + 1 : ast_subtree_end(ast, node);
+    }
+}
+
+/**
+ * Returns the payload of a node from the array of its kind.
+ */
+template<typename PayloadType>
+inline auto ast_payload(
+    AST const *ast,
+    SegmentedArray<PayloadType> *kind_payloads,
+    ASTNodeType kind,
+    NodeId node
+) -> PayloadType* {
+    assert(ast_kind(ast, node) == kind && "Node is not of the expected kind");
+    (void)kind;
+    return segmented_array_at(kind_payloads, *segmented_array_at(ast->payloads, node));
+}
+
+inline auto ast_expression(AST const *ast, NodeId node) -> ExpressionASTNode* {
+    return ast_payload(ast, ast->expressions, ASTNodeType::EXPRESSION, node);
+}
+
+inline auto ast_proc_def(AST const *ast, NodeId node) -> ProcDefASTNode* {
+    return ast_payload(ast, ast->proc_defs, ASTNodeType::PROC_DEF, node);
+}
+
+inline auto ast_variable_definition(AST const *ast, NodeId node) -> VariableDefinitionASTNode* {
+    return ast_payload(ast, ast->variable_definitions, ASTNodeType::VARIABLE_DEFINITION, node);
+}
+
+inline auto ast_return_value(AST const *ast, NodeId node) -> NodeId {
+    assert(ast_kind(ast, node) == ASTNodeType::RETURN && "Node is not a return node");
+    return *segmented_array_at(ast->payloads, node);
+}
+
+/**
+ * Returns the ops of the expression in postfix order.
+ */
+inline auto ast_expression_ops(AST const *ast, ExpressionASTNode const *expression) -> SegmentedSlice<ExpressionOp> {
+    return segmented_slice_by_offset(
+        ast->expression_ops,
+        expression->first_op,
+        expression->first_op + expression->op_count
+    );
+}
+
+/**
+ * Returns the index of the op that ends the operand before the subexpression that ends
+ * at the given op, e.g. the left operand of a binary operator given its right operand.
+ */
+inline auto expression_previous_operand(SegmentedSlice<ExpressionOp> ops, uint32_t op) -> uint32_t {
+    assert(ops[op].size <= op && "Subexpression has no operand before it");
+    return op - ops[op].size;
+}
+
+inline auto ast_proc_param(AST const *ast, ProcDefASTNode const *proc_def, size_t index) -> ProcParameterASTNode* {
+    assert(index < proc_def->parameter_count && "Procedure parameter index out of bounds");
+    return segmented_array_at(ast->proc_params, proc_def->first_parameter + index);
+}
+
+inline auto ast_type(AST const *ast, TypeId type) -> TypeASTNode* {
+    return segmented_array_at(ast->types, type);
+}
+
+/**
+ * Returns the source code that the span refers to.
+ */
+inline auto ast_string(AST const *ast, SourceSpan span) -> String {
+    return String::from_data_and_length(ast->source.data + span.offset, span.length);
+}
+
+/**
+ * Token stores with at least twice this many tokens are split into chunks of
+ * top-level definitions, which are parsed in parallel.
+ */
+size_t constexpr PARSING_MIN_CHUNK_TOKEN_COUNT = 64 * 1024;
+
+/**
+ * Parses the tokens pulled from the given token stream into an AST.
+ *
+ * The nodes are appended to segmented arrays in the allocator as they are parsed,
+ * so the allocator must outlive the AST. Large token stores are parsed in parallel
+ * chunks, which are merged in source order.
+ */
+extern auto parse(TokenStream *tokens, ArenaAllocator *allocator) -> AST;
+
+/**
+ * Parses only the top-level definitions that are reachable from the definitions
+ * with the given root symbols, e.g. the entry procedure.
+ *
+ * A pre-parser first records the name and the token range of every top-level
+ * definition, and follows the identifiers of the reached definitions through the
+ * token store to find the rest of the reachable ones, without parsing anything.
+ * Only the reachable definitions are then parsed. Parse errors in the skipped
+ * definitions aren't reported. The stream must read a whole token store.
+ */
+extern auto parse_reachable(TokenStream *tokens, Array<SymbolId> root_symbols, ArenaAllocator *allocator) -> AST;
 
 constexpr auto to_string(ASTNodeType type) -> String {
     #define STR(x) String::from_null_terminated_str(x)
     switch (type) {
-        case ASTNodeType::BINARY_ADD:          return STR("binary_add");
-        case ASTNodeType::IDENTIFIER:          return STR("identifier");
-        case ASTNodeType::INTEGER_LITERAL:     return STR("integer_literal");
+        case ASTNodeType::EXPRESSION:          return STR("expression");
         case ASTNodeType::PASS:                return STR("pass");
-        case ASTNodeType::PROC_CALL:           return STR("procedure call");
         case ASTNodeType::PROC_DEF:            return STR("procedure definition");
         case ASTNodeType::RETURN:              return STR("return");
-        case ASTNodeType::STRING_LITERAL:      return STR("string_literal");
         case ASTNodeType::VARIABLE_DEFINITION: return STR("variable_definition");
         default:                               return STR("undefined");
     }
     #undef STR
 }
 
+/**
+ * Returns the operator of an op as it's written in the source, or the kind of an operand.
+ */
+constexpr auto to_string(ExpressionOpKind kind) -> String {
+    #define STR(x) String::from_null_terminated_str(x)
+    switch (kind) {
+        case ExpressionOpKind::ADD:             return STR("+");
+        case ExpressionOpKind::CALL:            return STR("call");
+        case ExpressionOpKind::DIVIDE:          return STR("/");
+        case ExpressionOpKind::EQUAL:           return STR("==");
+        case ExpressionOpKind::GREATER_EQUAL:   return STR(">=");
+        case ExpressionOpKind::GREATER_THAN:    return STR(">");
+        case ExpressionOpKind::IDENTIFIER:      return STR("identifier");
+        case ExpressionOpKind::INTEGER_LITERAL: return STR("integer_literal");
+        case ExpressionOpKind::LESS_EQUAL:      return STR("<=");
+        case ExpressionOpKind::LESS_THAN:       return STR("<");
+        case ExpressionOpKind::MODULO:          return STR("%");
+        case ExpressionOpKind::MULTIPLY:        return STR("*");
+        case ExpressionOpKind::NEGATE:          return STR("-");
+        case ExpressionOpKind::NOT_EQUAL:       return STR("!=");
+        case ExpressionOpKind::STRING_LITERAL:  return STR("string_literal");
+        case ExpressionOpKind::SUBTRACT:        return STR("-");
+        default:                                return STR("undefined");
+    }
+    #undef STR
+}
+
 #endif // __BLOOM_H_PARSING__
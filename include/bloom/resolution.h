@@ -0,0 +1,66 @@
+/**
+ * Contains the name resolution pass, which binds every identifier use of an AST
+ * to the definition of its name.
+ *
+ * Names are looked up by symbol ID in nested scopes: the procedures and builtins
+ * are global, and each procedure has a scope of its parameters and a scope of its
+ * local variables inside it. Later passes look up the definition of an identifier
+ * by the index of its op instead of searching for its name.
+ */
+#ifndef __BLOOM_H_RESOLUTION__
+#define __BLOOM_H_RESOLUTION__
+#include <cstddef>
+#include <cstdint>
+#include <bloom/allocation.h>
+#include <bloom/array.h>
+#include <bloom/interning.h>
+#include <bloom/parsing.h>
+
+enum class BindingKind : uint8_t {
+    /**
+     * The op isn't an identifier, or its name is undefined.
+     */
+    NONE = 0,
+    BUILTIN,
+    PARAMETER,
+    PROC,
+    VARIABLE,
+};
+
+/**
+ * The definition that a name refers to.
+ */
+struct Binding {
+    BindingKind kind;
+    /**
+     * The builtin symbol of a builtin, the parameter index in the parameter array
+     * of the AST of a parameter, or the definition node of a procedure or a variable.
+     */
+    uint32_t index;
+};
+
+struct NameResolution {
+    /**
+     * The binding of every expression op, indexed like the op array of the AST.
+     * Only identifier ops are bound.
+     */
+    Array<Binding> bindings;
+    size_t error_count;
+};
+
+/**
+ * Resolves the names of the AST and prints the errors of undefined and duplicate names.
+ *
+ * The bindings are allocated from the given allocator. The scopes are only needed
+ * during the pass, so their memory is reclaimed before returning.
+ */
+extern auto resolve_names(AST *ast, SymbolTable *symbols, ArenaAllocator *allocator) -> NameResolution;
+
+/**
+ * Returns the binding of the identifier op at the given index of the op array of the AST.
+ */
+inline auto resolution_binding(NameResolution *resolution, uint32_t op) -> Binding {
+    return resolution->bindings[op];
+}
+
+#endif // __BLOOM_H_RESOLUTION__
@@ -0,0 +1,203 @@
+/**
+ * Contains the character classification and byte scanning core used by the lexer.
+ *
+ * Each byte maps to a set of class bits. The bits are chosen so that the class of
+ * a byte is always `CHAR_CLASS_LOW_NIBBLE[c & 0xF] & CHAR_CLASS_HIGH_NIBBLE[c >> 4]`,
+ * which lets the vectorized paths classify 16 or 32 bytes at a time with two
+ * table shuffles and an AND.
+ */
+#ifndef __BLOOM_H_SCANNING__
+#define __BLOOM_H_SCANNING__
+#include <cstddef>
+#include <cstdint>
+#include <bloom/string.h>
+
+enum CharClass : uint8_t {
+    CHAR_CLASS_NONE       = 0,
+    CHAR_CLASS_NEWLINE    = 1 << 0, // '\n'
+    CHAR_CLASS_SPACE      = 1 << 1, // ' '
+    CHAR_CLASS_DIGIT      = 1 << 2, // '0'-'9'
+    CHAR_CLASS_ALPHA_1_F  = 1 << 3, // 'A'-'O', 'a'-'o'
+    CHAR_CLASS_ALPHA_0_A  = 1 << 4, // 'P'-'Z', 'p'-'z'
+    CHAR_CLASS_UNDERSCORE = 1 << 5, // '_'
+    CHAR_CLASS_NON_ASCII  = 1 << 6, // 0x80-0xFF, i.e. any byte of a multi-byte UTF-8 sequence
+};
+
+// Composite classes
+uint8_t constexpr CHAR_CLASS_ALPHA =
+    CHAR_CLASS_ALPHA_1_F | CHAR_CLASS_ALPHA_0_A;
+// Identifiers can contain any non-ASCII character. The input is validated
+// as UTF-8 upfront, so non-ASCII bytes always form whole characters.
+uint8_t constexpr CHAR_CLASS_IDENTIFIER_BEGIN =
+    CHAR_CLASS_ALPHA | CHAR_CLASS_UNDERSCORE | CHAR_CLASS_NON_ASCII;
+uint8_t constexpr CHAR_CLASS_IDENTIFIER =
+    CHAR_CLASS_IDENTIFIER_BEGIN | CHAR_CLASS_DIGIT;
+
+uint8_t constexpr CHAR_CLASS_LOW_NIBBLE[16] = {
+    /* 0x0 */ CHAR_CLASS_SPACE | CHAR_CLASS_DIGIT | CHAR_CLASS_ALPHA_0_A | CHAR_CLASS_NON_ASCII,
+    /* 0x1 */ CHAR_CLASS_DIGIT | CHAR_CLASS_ALPHA | CHAR_CLASS_NON_ASCII,
+    /* 0x2 */ CHAR_CLASS_DIGIT | CHAR_CLASS_ALPHA | CHAR_CLASS_NON_ASCII,
+    /* 0x3 */ CHAR_CLASS_DIGIT | CHAR_CLASS_ALPHA | CHAR_CLASS_NON_ASCII,
+    /* 0x4 */ CHAR_CLASS_DIGIT | CHAR_CLASS_ALPHA | CHAR_CLASS_NON_ASCII,
+    /* 0x5 */ CHAR_CLASS_DIGIT | CHAR_CLASS_ALPHA | CHAR_CLASS_NON_ASCII,
+    /* 0x6 */ CHAR_CLASS_DIGIT | CHAR_CLASS_ALPHA | CHAR_CLASS_NON_ASCII,
+    /* 0x7 */ CHAR_CLASS_DIGIT | CHAR_CLASS_ALPHA | CHAR_CLASS_NON_ASCII,
+    /* 0x8 */ CHAR_CLASS_DIGIT | CHAR_CLASS_ALPHA | CHAR_CLASS_NON_ASCII,
+    /* 0x9 */ CHAR_CLASS_DIGIT | CHAR_CLASS_ALPHA | CHAR_CLASS_NON_ASCII,
+    /* 0xA */ CHAR_CLASS_NEWLINE | CHAR_CLASS_ALPHA | CHAR_CLASS_NON_ASCII,
+    /* 0xB */ CHAR_CLASS_ALPHA_1_F | CHAR_CLASS_NON_ASCII,
+    /* 0xC */ CHAR_CLASS_ALPHA_1_F | CHAR_CLASS_NON_ASCII,
+    /* 0xD */ CHAR_CLASS_ALPHA_1_F | CHAR_CLASS_NON_ASCII,
+    /* 0xE */ CHAR_CLASS_ALPHA_1_F | CHAR_CLASS_NON_ASCII,
+    /* 0xF */ CHAR_CLASS_ALPHA_1_F | CHAR_CLASS_UNDERSCORE | CHAR_CLASS_NON_ASCII,
+};
+
+uint8_t constexpr CHAR_CLASS_HIGH_NIBBLE[16] = {
+    /* 0x0 */ CHAR_CLASS_NEWLINE,
+    /* 0x1 */ CHAR_CLASS_NONE,
+    /* 0x2 */ CHAR_CLASS_SPACE,
+    /* 0x3 */ CHAR_CLASS_DIGIT,
+    /* 0x4 */ CHAR_CLASS_ALPHA_1_F,
+    /* 0x5 */ CHAR_CLASS_ALPHA_0_A | CHAR_CLASS_UNDERSCORE,
+    /* 0x6 */ CHAR_CLASS_ALPHA_1_F,
+    /* 0x7 */ CHAR_CLASS_ALPHA_0_A,
+    /* 0x8 */ CHAR_CLASS_NON_ASCII,
+    /* 0x9 */ CHAR_CLASS_NON_ASCII,
+    /* 0xA */ CHAR_CLASS_NON_ASCII,
+    /* 0xB */ CHAR_CLASS_NON_ASCII,
+    /* 0xC */ CHAR_CLASS_NON_ASCII,
+    /* 0xD */ CHAR_CLASS_NON_ASCII,
+    /* 0xE */ CHAR_CLASS_NON_ASCII,
+    /* 0xF */ CHAR_CLASS_NON_ASCII,
+};
+
+struct CharClassTable {
+    uint8_t classes[256];
+
+    constexpr CharClassTable() : classes() {
+        for (size_t c = 0; c < 256; c++) {
+            classes[c] = CHAR_CLASS_LOW_NIBBLE[c & 0xF] & CHAR_CLASS_HIGH_NIBBLE[c >> 4];
+        }
+    }
+};
+
+CharClassTable constexpr CHAR_CLASS_TABLE = CharClassTable();
+
+static_assert(CHAR_CLASS_TABLE.classes['\n'] == CHAR_CLASS_NEWLINE, "Invalid class for newline");
+static_assert(CHAR_CLASS_TABLE.classes[' '] == CHAR_CLASS_SPACE, "Invalid class for space");
+static_assert(CHAR_CLASS_TABLE.classes['_'] == CHAR_CLASS_UNDERSCORE, "Invalid class for underscore");
+static_assert(CHAR_CLASS_TABLE.classes['9'] == CHAR_CLASS_DIGIT, "Invalid class for digits");
+static_assert(CHAR_CLASS_TABLE.classes[':'] == CHAR_CLASS_NONE, "Invalid class for ':'");
+static_assert(CHAR_CLASS_TABLE.classes['@'] == CHAR_CLASS_NONE, "Invalid class for '@'");
+static_assert(CHAR_CLASS_TABLE.classes['['] == CHAR_CLASS_NONE, "Invalid class for '['");
+static_assert(CHAR_CLASS_TABLE.classes['`'] == CHAR_CLASS_NONE, "Invalid class for '`'");
+static_assert(CHAR_CLASS_TABLE.classes['{'] == CHAR_CLASS_NONE, "Invalid class for '{'");
+static_assert((CHAR_CLASS_TABLE.classes['Z'] & CHAR_CLASS_ALPHA) != 0, "Invalid class for 'Z'");
+static_assert((CHAR_CLASS_TABLE.classes['o'] & CHAR_CLASS_ALPHA) != 0, "Invalid class for 'o'");
+static_assert(CHAR_CLASS_TABLE.classes[0x7F] == CHAR_CLASS_NONE, "Invalid class for DEL");
+static_assert(CHAR_CLASS_TABLE.classes[0x80] == CHAR_CLASS_NON_ASCII, "Invalid class for 0x80");
+static_assert(CHAR_CLASS_TABLE.classes[0xFF] == CHAR_CLASS_NON_ASCII, "Invalid class for 0xFF");
+
+inline auto char_class(char c) -> uint8_t {
+    return CHAR_CLASS_TABLE.classes[static_cast<uint8_t>(c)];
+}
+
+inline auto is_char_class(char c, uint8_t class_mask) -> bool {
+    return (char_class(c) & class_mask) != 0;
+}
+
+/**
+ * Returns the index of the first byte at or after `begin` whose class is not in `class_mask`.
+ * If every remaining byte is in the class, the input length is returned.
+ */
+extern auto scan_while_class(String const *input, size_t begin, uint8_t class_mask) -> size_t;
+
+/**
+ * Returns the index of the first byte at or after `begin` whose class is in `class_mask`.
+ * If no such byte exists, the input length is returned.
+ */
+extern auto scan_until_class(String const *input, size_t begin, uint8_t class_mask) -> size_t;
+
+/**
+ * Returns the index of the first quote, backslash or newline at or after `begin`,
+ * i.e. the first byte that ends the plain content of a string literal.
+ * If no such byte exists, the input length is returned.
+ */
+extern auto scan_until_string_delimiter(String const *input, size_t begin) -> size_t;
+
+/**
+ * Counts the bytes at or after `begin` whose class is in `class_mask`.
+ */
+extern auto count_class(String const *input, size_t begin, uint8_t class_mask) -> size_t;
+
+/**
+ * Writes the offset of every byte at or after `begin` whose class is in `class_mask`
+ * into `offsets`, which must have room for count_class() offsets.
+ * @return The number of offsets written.
+ */
+extern auto collect_class_offsets(
+    String const *input,
+    size_t begin,
+    uint8_t class_mask,
+    uint32_t *offsets
+) -> size_t;
+
+/**
+ * Validates that the input is UTF-8 from `begin` on, which must be at the
+ * beginning of a character.
+ * @return The index of the first byte of the first invalid sequence,
+ *         or the input length if the input is valid.
+ *
+ * @example
+ * #include <bloom/scanning.h>
+ * #include <string>
+ * >>> auto validate = [](std::string const &bytes) { auto input = String::from_data_and_length(bytes.data(), bytes.size()); return validate_utf8(&input, 0); };
+ * >>> assert(validate("plain ascii") == 11);
+ * >>> assert(validate("\xC3\xA4\xE2\x82\xAC\xF0\x9F\x98\x80") == 9);
+ * >>> assert(validate("\x80") == 0);
+ * >>> assert(validate("a\xC0\x80") == 1);
+ * >>> assert(validate("a\xED\xA0\x80") == 1);
+ * >>> assert(validate("a\xF4\x90\x80\x80") == 1);
+ * >>> assert(validate("ab\xE2\x82") == 2);
+ * >>> // Sequences that cross the boundary of a 32-byte block
+ * >>> assert(validate(std::string(31, 'a') + "\xE2\x82\xAC" + std::string(40, 'b')) == 74);
+ * >>> assert(validate(std::string(31, 'a') + "\xE2\x82" + std::string(40, 'b')) == 31);
+ * >>> assert(validate(std::string(63, 'a') + "\xF0\x9F\x98\x80" + std::string(30, 'c')) == 97);
+ * >>> assert(validate(std::string(64, 'a') + "\xE2\x82") == 64);
+ * >>> // Compare random mixes of valid and invalid sequences with a scalar reference
+ * >>> auto reference = [](std::string const &bytes) -> size_t {
+ * >>> uint32_t const min_code_points[] = { 0, 0, 0x80, 0x800, 0x10000 };
+ * >>> for (size_t i = 0; i < bytes.size();) {
+ * >>> auto c = static_cast<unsigned char>(bytes[i]);
+ * >>> size_t size = c < 0x80 ? 1 : c >= 0xC2 && c <= 0xDF ? 2 : c >= 0xE0 && c <= 0xEF ? 3 : c >= 0xF0 && c <= 0xF4 ? 4 : 0;
+ * >>> if (size == 0 || i + size > bytes.size()) return i;
+ * >>> uint32_t code_point = size == 1 ? c : c & (0x7F >> size);
+ * >>> for (size_t j = 1; j < size; j++) {
+ * >>> if ((bytes[i + j] & 0xC0) != 0x80) return i;
+ * >>> code_point = code_point << 6 | (bytes[i + j] & 0x3F);
+ * >>> }
+ * >>> if (code_point < min_code_points[size] || code_point > 0x10FFFF || (code_point >= 0xD800 && code_point <= 0xDFFF)) return i;
+ * >>> i += size;
+ * >>> }
+ * >>> return bytes.size();
+ * >>> };
+ * >>> char const *const pieces[] = { "a", "\t", "\xC3\xA4", "\xE2\x82\xAC", "\xED\x9F\xBF", "\xF0\x9F\x98\x80", "\xF4\x8F\xBF\xBF" };
+ * >>> uint64_t state = 1;
+ * >>> for (int i = 0; i < 50000; i++) {
+ * >>> std::string bytes;
+ * >>> while (bytes.size() < 100) {
+ * >>> state = state * 6364136223846793005ull + 1442695040888963407ull;
+ * >>> if (state >> 60 == 0) bytes += static_cast<char>(state >> 32);
+ * >>> else bytes += pieces[(state >> 32) % 7];
+ * >>> }
+ * >>> assert(validate(bytes) == reference(bytes));
+ * >>> }
+ */
+extern auto validate_utf8(String const *input, size_t begin) -> size_t;
+
+/**
+ * Returns the name of the scanning implementation selected for the current CPU.
+ */
+extern auto scan_implementation_name() -> char const*;
+
+#endif // __BLOOM_H_SCANNING__
@@ -0,0 +1,248 @@
+/**
+ * Contains a growable array that is stored in arena allocated segments.
+ *
+ * Each segment is twice as large as the one before it, so an index maps to its
+ * segment with a single bit scan. Elements never move once appended, which keeps
+ * pointers to them valid while the array grows, and the array never has to be
+ * reserved for its worst-case length upfront.
+ */
+#ifndef __BLOOM_H_SEGMENTED_ARRAY__
+#define __BLOOM_H_SEGMENTED_ARRAY__
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <bloom/allocation.h>
+
+/**
+ * The first segment holds 2^SEGMENTED_ARRAY_FIRST_SEGMENT_LENGTH_LOG2 elements.
+ */
+size_t constexpr SEGMENTED_ARRAY_FIRST_SEGMENT_LENGTH_LOG2 = 3;
+size_t constexpr SEGMENTED_ARRAY_FIRST_SEGMENT_LENGTH = size_t(1) << SEGMENTED_ARRAY_FIRST_SEGMENT_LENGTH_LOG2;
+/**
+ * Enough segments for 32-bit indices, like token offsets.
+ */
+size_t constexpr SEGMENTED_ARRAY_MAX_SEGMENT_COUNT = 32 - SEGMENTED_ARRAY_FIRST_SEGMENT_LENGTH_LOG2;
+
+struct SegmentedArrayPosition {
+    size_t segment;
+    size_t offset;
+};
+
+/**
+ * Returns the segment of the element at the given index and its offset within the segment.
+ */
+inline auto segmented_array_position(size_t index) -> SegmentedArrayPosition {
+    size_t shifted_index = index + SEGMENTED_ARRAY_FIRST_SEGMENT_LENGTH;
+    size_t segment = (63 - __builtin_clzll(shifted_index)) - SEGMENTED_ARRAY_FIRST_SEGMENT_LENGTH_LOG2;
+    return SegmentedArrayPosition {
+        .segment = segment,
+        .offset = shifted_index - (SEGMENTED_ARRAY_FIRST_SEGMENT_LENGTH << segment),
+    };
+}
+
+inline auto segmented_array_segment_length(size_t segment) -> size_t {
+    return SEGMENTED_ARRAY_FIRST_SEGMENT_LENGTH << segment;
+}
+
+template<typename ElementType>
+struct SegmentedArray {
+    /**
+     * The allocator that new segments are allocated from. Other allocations
+     * may be made from it in between, as the segments don't need to be adjacent.
+     */
+    ArenaAllocator *allocator;
+    ElementType *segments[SEGMENTED_ARRAY_MAX_SEGMENT_COUNT];
+    size_t length;
+};
+
+/**
+ * Creates an empty segmented array in the given allocator, which it allocates its segments from.
+ * The array itself is allocated too, so that slices of it can point to it.
+ */
+template<typename ElementType>
+auto segmented_array_from_allocator(ArenaAllocator *allocator) -> SegmentedArray<ElementType>* {
+    auto block = allocate_array<SegmentedArray<ElementType>>(allocator, 1);
+    return new (block.data) SegmentedArray<ElementType> {
+        .allocator = allocator,
+        .segments = {},
+        .length = 0,
+    };
+}
+
+/**
+ * Creates a segmented array in the given allocator that views the elements of a
+ * contiguous array in place. The segments of a segmented array are back to back
+ * in a contiguous array, as each segment is as long as all the ones before it
+ * combined (plus the first segment length).
+ *
+ * Elements can't be appended to a view, as its last segment may be followed by
+ * other data, but its elements can be written.
+ */
+template<typename ElementType>
+auto segmented_array_view_from_allocator(
+    ArenaAllocator *allocator,
+    ElementType *data,
+    size_t length
+) -> SegmentedArray<ElementType>* {
+    auto block = allocate_array<SegmentedArray<ElementType>>(allocator, 1);
+    auto *array = new (block.data) SegmentedArray<ElementType> {
+        .allocator = nullptr,
+        .segments = {},
+        .length = length,
+    };
+    size_t segment_begin = 0;
+    for (size_t segment = 0; segment_begin < length; segment++) {
+        array->segments[segment] = data + segment_begin;
+        segment_begin += segmented_array_segment_length(segment);
+    }
+    return array;
+}
+
+template<typename ElementType>
+inline auto segmented_array_at(SegmentedArray<ElementType> *array, size_t index) -> ElementType* {
+    assert(index < array->length && "Segmented array index out of bounds");
+    auto position = segmented_array_position(index);
+    return &array->segments[position.segment][position.offset];
+}
+
+/**
+ * Appends the value to the end of the array, allocating a new segment if the last one is full.
+ * @return The appended element, which stays at the same address until the allocator is reset.
+ */
+template<typename ElementType>
+auto segmented_array_append(SegmentedArray<ElementType> *array, ElementType const &value) -> ElementType* {
+    assert(array->allocator != nullptr && "Can't append to a segmented array view");
+    auto position = segmented_array_position(array->length);
+    if (position.offset == 0) {
+        assert(position.segment < SEGMENTED_ARRAY_MAX_SEGMENT_COUNT &&
+            "Segmented array is out of segments");
+        auto block = allocate_array<ElementType>(
+            array->allocator,
+            segmented_array_segment_length(position.segment)
+        );
+        array->segments[position.segment] = block.data;
+    }
+    array->length++;
+    ElementType *element = &array->segments[position.segment][position.offset];
+    *element = value;
+    return element;
+}
+
+/**
+ * Grows the array to the given length, allocating the segments it needs.
+ * The new elements are left uninitialized, so that they can be written in any
+ * order (e.g. by multiple threads) afterwards.
+ */
+template<typename ElementType>
+auto segmented_array_resize(SegmentedArray<ElementType> *array, size_t length) -> void {
+    assert(length >= array->length && "Segmented arrays can't be shrunk");
+    assert(array->allocator != nullptr && "Can't resize a segmented array view");
+    if (length == 0) {
+        return;
+    }
+    auto last_position = segmented_array_position(length - 1);
+    assert(last_position.segment < SEGMENTED_ARRAY_MAX_SEGMENT_COUNT &&
+        "Segmented array is out of segments");
+    for (size_t segment = 0; segment <= last_position.segment; segment++) {
+        if (array->segments[segment] != nullptr) {
+            continue;
+        }
+        array->segments[segment] = allocate_array<ElementType>(
+            array->allocator,
+            segmented_array_segment_length(segment)
+        ).data;
+    }
+    array->length = length;
+}
+
+template<typename ElementType>
+struct SegmentedArrayIterator {
+    SegmentedArray<ElementType> *array;
+    size_t index;
+    ElementType *element;
+    ElementType *segment_end;
+
+    inline ElementType& operator*() { return *element; }
+
+    inline auto operator++() -> SegmentedArrayIterator& {
+        index++;
+        element++;
+        // Only move to the next segment if it exists
+        if (element == segment_end && index < array->length) {
+            auto position = segmented_array_position(index);
+            element = array->segments[position.segment];
+            segment_end = element + segmented_array_segment_length(position.segment);
+        }
+        return *this;
+    }
+
+    inline auto operator!=(SegmentedArrayIterator const &other) const -> bool {
+        return index != other.index;
+    }
+};
+
+/**
+ * A range of consecutive elements in a segmented array. The range may span segments.
+ */
+template<typename ElementType>
+struct SegmentedSlice {
+    SegmentedArray<ElementType> *array;
+    uint32_t first_index;
+    uint32_t length;
+
+    inline ElementType& operator[](size_t index) {
+        assert(index < length && "SegmentedSlice index out of bounds");
+        return *segmented_array_at(array, first_index + index);
+    }
+
+    // To support range-based for loops
+    inline auto begin() -> SegmentedArrayIterator<ElementType> {
+        if (length == 0) {
+            return end();
+        }
+        auto position = segmented_array_position(first_index);
+        ElementType *segment = array->segments[position.segment];
+        return SegmentedArrayIterator<ElementType> {
+            .array = array,
+            .index = first_index,
+            .element = segment + position.offset,
+            .segment_end = segment + segmented_array_segment_length(position.segment),
+        };
+    }
+    inline auto end() -> SegmentedArrayIterator<ElementType> {
+        return SegmentedArrayIterator<ElementType> {
+            .array = array,
+            .index = size_t(first_index) + length,
+            .element = nullptr,
+            .segment_end = nullptr,
+        };
+    }
+};
+
+/**
+ * Returns a slice of the array from begin (inclusive) to end (exclusive).
+ */
+template<typename ElementType>
+auto segmented_slice_by_offset(
+    SegmentedArray<ElementType> *array,
+    size_t begin,
+    size_t end
+) -> SegmentedSlice<ElementType> {
+    assert(begin <= end && end <= array->length && "Slice end out of bounds");
+    return SegmentedSlice<ElementType> {
+        .array = array,
+        .first_index = static_cast<uint32_t>(begin),
+        .length = static_cast<uint32_t>(end - begin),
+    };
+}
+
+/**
+ * Returns a slice of every element of the array.
+ */
+template<typename ElementType>
+inline auto to_slice(SegmentedArray<ElementType> *array) -> SegmentedSlice<ElementType> {
+    return segmented_slice_by_offset(array, 0, array->length);
+}
+
+#endif // __BLOOM_H_SEGMENTED_ARRAY__
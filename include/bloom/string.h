@@ -13,6 +13,11 @@ struct DynamicString {
     char *data;
     size_t length;
     size_t max_length;
+    /**
+     * The arena whose last allocation the string is, or null. Pushing to the
+     * string then grows the allocation, which commits the memory it needs.
+     */
+    ArenaAllocator *allocator;
 };
 
 /**
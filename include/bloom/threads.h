@@ -0,0 +1,31 @@
+#ifndef __BLOOM_H_THREADS__
+#define __BLOOM_H_THREADS__
+#include <cstddef>
+#include <utility>
+
+/**
+ * Returns the number of threads that run tasks in parallel,
+ * including the calling thread.
+ */
+extern auto worker_thread_count() -> size_t;
+
+/**
+ * Runs the task for every index in [0, count) on the worker thread pool and
+ * waits until all of them have finished. The calling thread runs tasks too.
+ *
+ * The pool is started on first use, and its threads sleep between calls.
+ * Calls must not be nested.
+ */
+extern auto parallel_for(size_t count, void (*task)(void *context, size_t index), void *context) -> void;
+
+/**
+ * Runs the given function for every index in [0, count) on the worker thread pool.
+ */
+template<typename Fn>
+inline auto parallel_for(size_t count, Fn &&fn) -> void {
+    parallel_for(count, [](void *context, size_t index) {
+        (*static_cast<std::remove_reference_t<Fn>*>(context))(index);
+    }, &fn);
+}
+
+#endif // __BLOOM_H_THREADS__
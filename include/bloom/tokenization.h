@@ -1,9 +1,12 @@
 #ifndef __BLOOM_H_TOKENIZATION__
 #define __BLOOM_H_TOKENIZATION__
+#include <cassert>
 #include <cstddef>
 #include <cstdint>
+#include <cstring>
 #include <bloom/array.h>
 #include <bloom/allocation.h>
+#include <bloom/interning.h>
 #include <bloom/string.h>
 
 enum class TokenType : uint8_t {
@@ -11,38 +14,191 @@ enum class TokenType : uint8_t {
     
     // Printable characters, ASCII code in ascending order
     NEWLINE           = '\n',
+    MODULO            = '%',
     PARENTHESIS_OPEN  = '(',
     PARENTHESIS_CLOSE = ')',
+    MULTIPLY          = '*',
     ADD               = '+',
     COMMA             = ',',
+    SUBTRACT          = '-',
+    DIVIDE            = '/',
+    LESS_THAN         = '<',
+    GREATER_THAN      = '>',
     BRACE_OPEN        = '{',
     BRACE_CLOSE       = '}',
     
     ARROW,
     CONST_DEF,
     END,
+    EQUAL,
+    GREATER_EQUAL,
     IDENTIFIER,
     INDENT,
     INTEGER_LITERAL,
     KEYWORD_PASS,
     KEYWORD_PROC,
+    LESS_EQUAL,
+    NOT_EQUAL,
     STRING_LITERAL,
     TYPE_SEPARATOR,
     VAR_DEF,
 };
+/**
+ * The number of token type values, for tables that are indexed by token type.
+ * VAR_DEF must stay the last token type.
+ */
+size_t constexpr TOKEN_TYPE_COUNT = static_cast<size_t>(TokenType::VAR_DEF) + 1;
+
+constexpr char const *TOKEN_KEYWORD_PASS = "pass";
+constexpr char const *TOKEN_KEYWORD_PROC = "proc";
+
+constexpr auto constexpr_strlen(char const *str) -> size_t {
+    size_t length = 0;
+    while (str[length] != '\0') {
+        length++;
+    }
+    return length;
+}
+
+struct Keyword {
+    char const *text;
+    size_t length;
+    TokenType type;
 
-const auto TOKEN_KEYWORD_PASS = "pass";
-const auto TOKEN_KEYWORD_PROC = "proc";
+    constexpr Keyword(char const *text, TokenType type) :
+        text(text), length(constexpr_strlen(text)), type(type) {}
+};
+
+/**
+ * All keywords of the language. The keyword hash table is generated from this list,
+ * so adding a keyword only requires adding its token type and an entry here.
+ */
+constexpr Keyword KEYWORDS[] = {
+    Keyword(TOKEN_KEYWORD_PASS, TokenType::KEYWORD_PASS),
+    Keyword(TOKEN_KEYWORD_PROC, TokenType::KEYWORD_PROC),
+};
+constexpr size_t KEYWORD_COUNT = sizeof(KEYWORDS) / sizeof(KEYWORDS[0]);
+
+/**
+ * Packs the length and the first, second and last characters of a word into a hash key.
+ * Only these characters are hashed, and the full text is compared after the lookup.
+ */
+constexpr auto keyword_hash_key(char const *data, size_t length) -> uint32_t {
+    uint32_t first = static_cast<uint8_t>(data[0]);
+    uint32_t second = length > 1 ? static_cast<uint8_t>(data[1]) : 0;
+    uint32_t last = static_cast<uint8_t>(data[length - 1]);
+    return first | (second << 8) | (last << 16) | (static_cast<uint32_t>(length) << 24);
+}
+
+/**
+ * A perfect hash table of the keywords, built at compile time by searching
+ * for a multiplicative hash seed under which no two keywords collide.
+ */
+struct KeywordTable {
+    static constexpr uint32_t BITS = [] {
+        // Keep the load factor at most 50%
+        uint32_t bits = 4;
+        while ((size_t(1) << bits) < 2 * KEYWORD_COUNT) {
+            bits++;
+        }
+        return bits;
+    }();
+    static constexpr size_t SIZE = size_t(1) << BITS;
+    static constexpr uint32_t MAX_SEED_ATTEMPTS = 1 << 16;
+
+    uint32_t seed;
+    /**
+     * Keyword index + 1 for each slot, 0 for empty slots.
+     */
+    uint8_t slots[SIZE];
+    size_t min_length;
+    size_t max_length;
+
+    static constexpr auto slot_index(uint32_t key, uint32_t seed) -> uint32_t {
+        return (key * seed) >> (32 - BITS);
+    }
+
+    constexpr KeywordTable() : seed(0), slots(), min_length(SIZE_MAX), max_length(0) {
+        static_assert(KEYWORD_COUNT < 255, "Too many keywords for the keyword table");
+        for (uint32_t attempt = 0; attempt < MAX_SEED_ATTEMPTS; attempt++) {
+            // Odd seeds starting from the golden ratio constant
+            uint32_t candidate = 0x9E3779B1u + 2 * attempt;
+            for (size_t i = 0; i < SIZE; i++) {
+                slots[i] = 0;
+            }
+            bool collided = false;
+            for (size_t i = 0; i < KEYWORD_COUNT && !collided; i++) {
+                uint32_t key = keyword_hash_key(KEYWORDS[i].text, KEYWORDS[i].length);
+                uint32_t slot = slot_index(key, candidate);
+                collided = slots[slot] != 0;
+                slots[slot] = static_cast<uint8_t>(i + 1);
+            }
+            if (!collided) {
+                seed = candidate;
+                break;
+            }
+        }
+        for (size_t i = 0; i < KEYWORD_COUNT; i++) {
+            min_length = KEYWORDS[i].length < min_length ? KEYWORDS[i].length : min_length;
+            max_length = KEYWORDS[i].length > max_length ? KEYWORDS[i].length : max_length;
+        }
+    }
+};
+
+constexpr KeywordTable KEYWORD_TABLE = KeywordTable();
+static_assert(KEYWORD_TABLE.seed != 0,
+    "No perfect hash seed found for the keywords, extend keyword_hash_key()");
+
+/**
+ * Returns the keyword token type of the given word, or IDENTIFIER if the word isn't a keyword.
+ */
+inline auto keyword_type(char const *data, size_t length) -> TokenType {
+    if (length < KEYWORD_TABLE.min_length || length > KEYWORD_TABLE.max_length) {
+        return TokenType::IDENTIFIER;
+    }
+    uint32_t key = keyword_hash_key(data, length);
+    uint8_t slot = KEYWORD_TABLE.slots[KeywordTable::slot_index(key, KEYWORD_TABLE.seed)];
+    if (slot == 0) {
+        return TokenType::IDENTIFIER;
+    }
+    Keyword const &keyword = KEYWORDS[slot - 1];
+    if (keyword.length != length || memcmp(keyword.text, data, length) != 0) {
+        return TokenType::IDENTIFIER;
+    }
+    return keyword.type;
+}
+
+/**
+ * Returns the byte that the escape sequence of a backslash and the given character
+ * stands for in a string literal, or -1 if the escape sequence isn't supported.
+ */
+constexpr auto string_escape_value(char escaped) -> int {
+    switch (escaped) {
+        case '"':  return '"';
+        case '0':  return '\0';
+        case '\\': return '\\';
+        case 'n':  return '\n';
+        case 'r':  return '\r';
+        case 't':  return '\t';
+        default:   return -1;
+    }
+}
 
 struct Token {
     TokenType type;
+    /**
+     * The offset of the first byte of the token in the source.
+     * The line and column are computed from it only when needed.
+     */
+    uint32_t offset;
     struct Position {
         uint64_t col;
         uint64_t line;
-    } position;
+    };
     union {
         struct {
             String content;
+            SymbolId symbol;
         } identifier;
         struct {
             size_t level;
@@ -52,13 +208,123 @@ struct Token {
                 int64_t value;
                 uint64_t uvalue;
             };
+            /**
+             * Set if the value is too large for a signed 64-bit integer.
+             */
+            bool is_unsigned;
         } integer_literal;
         struct {
+            /**
+             * The content between the quotes as it's written in the source,
+             * i.e. escape sequences haven't been decoded.
+             */
             String content;
+            bool has_escapes;
         } string_literal;
     };
 };
-static_assert(sizeof(Token) == 40, "Token size is not 40 bytes");
+static_assert(sizeof(Token) == 32, "Token size is not 32 bytes");
+
+/**
+ * The maximum input size, so that source offsets fit in 32 bits.
+ */
+size_t constexpr MAX_SOURCE_LENGTH = UINT32_MAX;
+
+/**
+ * Holds the value of a token in a token store.
+ */
+union TokenPayload {
+    /**
+     * Identifiers only store their symbol and length. The content
+     * is restored from the token offset when needed.
+     */
+    struct {
+        SymbolId symbol;
+        uint32_t length;
+    } identifier;
+    /**
+     * Likewise, string literals only store their content length, as
+     * the content begins right after the token offset.
+     */
+    struct {
+        uint32_t length;
+        bool has_escapes;
+    } string_literal;
+    struct {
+        uint64_t value;
+        bool is_unsigned;
+    } integer;
+    size_t indent_level;
+};
+static_assert(sizeof(TokenPayload) == 16, "TokenPayload size is not 16 bytes");
+
+/**
+ * Returns whether tokens of the given type carry a payload.
+ */
+constexpr auto token_has_payload(TokenType type) -> bool {
+    return type == TokenType::IDENTIFIER
+        || type == TokenType::INDENT
+        || type == TokenType::INTEGER_LITERAL
+        || type == TokenType::STRING_LITERAL;
+}
+
+/**
+ * Marks a missing token index in the side tables of a token store.
+ */
+uint32_t constexpr TOKEN_INDEX_NONE = UINT32_MAX;
+
+/**
+ * The number of tokens per payload rank entry in a token store.
+ */
+size_t constexpr TOKEN_STORE_RANK_BLOCK_SIZE = 64;
+
+/**
+ * Stores tokens as separate arrays, so that code that only looks at
+ * token types (e.g. the parser) touches 5 bytes per token.
+ *
+ * Payloads of identifiers, literals and indents are stored in a side table
+ * in token order. Other tokens don't take any space in it.
+ */
+struct TokenStore {
+    String source;
+    SymbolTable *symbols;
+    Array<TokenType> types;
+    Array<uint32_t> offsets;
+    Array<TokenPayload> payloads;
+    /**
+     * The number of payloads before each block of TOKEN_STORE_RANK_BLOCK_SIZE tokens,
+     * which allows looking up the payload of any token without scanning from the start.
+     */
+    Array<uint32_t> payload_ranks;
+    /**
+     * The index of the matching parenthesis of every opening and closing parenthesis,
+     * or TOKEN_INDEX_NONE if it's unmatched or the token isn't a parenthesis.
+     * Parentheses only match within a statement.
+     */
+    Array<uint32_t> matching_parens;
+    /**
+     * The index of the NEWLINE or END token that ends the statement of every token.
+     * The tables are filled in while lexing, so that the parser can jump over a
+     * statement or a parenthesized range without scanning the tokens in between.
+     */
+    Array<uint32_t> statement_ends;
+};
+
+/**
+ * Returns the index of the payload of the token at the given index.
+ * The token must carry a payload.
+ */
+extern auto token_store_payload_index(TokenStore *store, size_t index) -> size_t;
+
+/**
+ * Returns the number of payloads before the token at the given index.
+ */
+extern auto token_store_payload_count_before(TokenStore *store, size_t index) -> size_t;
+
+/**
+ * Materializes the token at the given index of a token store.
+ */
+extern auto token_at(TokenStore *store, size_t index) -> Token;
 
 constexpr auto to_string(TokenType type) -> String {
     #define STR(x) String::from_null_terminated_str(x)
@@ -69,16 +335,26 @@ constexpr auto to_string(TokenType type) -> String {
         case TokenType::BRACE_OPEN:        return STR("{");
         case TokenType::COMMA:             return STR(",");
         case TokenType::CONST_DEF:         return STR("const_def");
+        case TokenType::DIVIDE:            return STR("/");
         case TokenType::END:               return STR("end");
+        case TokenType::EQUAL:             return STR("==");
+        case TokenType::GREATER_EQUAL:     return STR(">=");
+        case TokenType::GREATER_THAN:      return STR(">");
         case TokenType::IDENTIFIER:        return STR("identifier");
         case TokenType::INDENT:            return STR("indent");
         case TokenType::INTEGER_LITERAL:   return STR("integer_literal");
         case TokenType::KEYWORD_PASS:      return STR(TOKEN_KEYWORD_PASS);
         case TokenType::KEYWORD_PROC:      return STR(TOKEN_KEYWORD_PROC);
+        case TokenType::LESS_EQUAL:        return STR("<=");
+        case TokenType::LESS_THAN:         return STR("<");
+        case TokenType::MODULO:            return STR("%");
+        case TokenType::MULTIPLY:          return STR("*");
         case TokenType::NEWLINE:           return STR("newline");
+        case TokenType::NOT_EQUAL:         return STR("!=");
         case TokenType::PARENTHESIS_CLOSE: return STR(")");
         case TokenType::PARENTHESIS_OPEN:  return STR("(");
         case TokenType::STRING_LITERAL:    return STR("string_literal");
+        case TokenType::SUBTRACT:          return STR("-");
         case TokenType::TYPE_SEPARATOR:    return STR(":");
         case TokenType::VAR_DEF:           return STR("var_def");
         default:                           return STR("undefined");
@@ -87,10 +363,169 @@ constexpr auto to_string(TokenType type) -> String {
 }
 
 /**
- * Tokenizes the input string into an array of tokens.
+ * Holds the state of a pull-based lexer, which produces one token per call to lexer_next().
+ */
+struct Lexer {
+    String input;
+    /**
+     * The offset of the next unread byte in the input.
+     */
+    size_t offset;
+    size_t first_indentation_space_count;
+    /**
+     * If set, INDENT tokens carry the number of spaces instead of the indentation level.
+     * This allows lexing a range of lines without knowing the indentation width, which
+     * is the only state that is carried across lines. The levels are resolved afterwards.
+     */
+    bool raw_indentation;
+    /**
+     * The table that identifiers are interned into. It may be shared by multiple lexers.
+     */
+    SymbolTable *symbols;
+};
+
+/**
+ * Creates a lexer for the input, which is validated as UTF-8 first.
+ * An invalid encoding is reported with its position, and lexing stops.
+ */
+extern auto lexer_from_input(String *input, SymbolTable *symbols) -> Lexer;
+
+/**
+ * Lexes and returns the next token from the input.
+ *
+ * Once the input has been exhausted, an END token is returned on every call.
+ */
+extern auto lexer_next(Lexer *lexer) -> Token;
+
+/**
+ * The number of tokens held by a token stream. One slot is reserved for the
+ * previously consumed token, so the maximum lookahead is one less than this.
+ */
+size_t constexpr TOKEN_STREAM_WINDOW_SIZE = 8;
+static_assert((TOKEN_STREAM_WINDOW_SIZE & (TOKEN_STREAM_WINDOW_SIZE - 1)) == 0,
+    "Token stream window size must be a power of two");
+
+/**
+ * Hands out tokens on demand through a small lookahead window.
+ *
+ * The tokens are either lexed from the source as they are needed, in which case the
+ * full token array never has to exist in memory, or read from a token store.
+ *
+ * Token pointers returned by the stream stay valid until the window has
+ * advanced past them, so copy a token if it's needed later.
+ */
+struct TokenStream {
+    String source;
+    /**
+     * The lexer to pull tokens from, or null if the tokens are read from a store.
+     */
+    Lexer *lexer;
+    TokenStore *store;
+    /**
+     * The index of the next payload to read from the store.
+     */
+    size_t store_payload_index;
+    /**
+     * The index of the store token at which the stream ends. Reading at or past it
+     * returns an END token, so a range of the store can be read as its own stream.
+     */
+    size_t store_end;
+    Token window[TOKEN_STREAM_WINDOW_SIZE];
+    /**
+     * The index of the next token to be consumed.
+     */
+    size_t next_index;
+    /**
+     * The number of tokens lexed into the window so far.
+     */
+    size_t lexed_count;
+    /**
+     * Optional observer, which is called once for every lexed token (e.g. for debug dumps).
+     */
+    void (*on_token)(TokenStream const *stream, Token const *token);
+    /**
+     * Arbitrary data for the observer.
+     */
+    void *on_token_context;
+};
+
+extern auto token_stream_from_lexer(Lexer *lexer) -> TokenStream;
+extern auto token_stream_from_store(TokenStore *store) -> TokenStream;
+
+/**
+ * Creates a stream of the store tokens in [begin, end). Token indices of the
+ * stream (e.g. next_index) are the indices of the tokens in the store.
+ */
+extern auto token_stream_from_store_range(TokenStore *store, size_t begin, size_t end) -> TokenStream;
+
+/**
+ * Lexes tokens into the stream window until the given number of tokens has been lexed.
+ */
+extern auto stream_fill(TokenStream *stream, size_t lexed_count) -> void;
+
+/**
+ * Peeks at a token ahead of the stream without consuming it.
+ * A lookahead of 0 returns the next token to be consumed.
+ */
+inline auto stream_peek(TokenStream *stream, size_t lookahead = 0) -> Token* {
+    assert(lookahead < TOKEN_STREAM_WINDOW_SIZE - 1 &&
+        "Token stream lookahead exceeds the window size");
+    size_t index = stream->next_index + lookahead;
+    if (index >= stream->lexed_count) {
+        stream_fill(stream, index + 1);
+    }
+    return &stream->window[index & (TOKEN_STREAM_WINDOW_SIZE - 1)];
+}
+
+/**
+ * Consumes the next token from the stream and returns it.
+ */
+inline auto stream_next(TokenStream *stream) -> Token* {
+    Token *token = stream_peek(stream);
+    stream->next_index++;
+    return token;
+}
+
+/**
+ * Returns the most recently consumed token.
+ */
+inline auto stream_prev(TokenStream *stream) -> Token* {
+    assert(stream->next_index > 0 &&
+        "No token has been consumed from the token stream yet");
+    return &stream->window[(stream->next_index - 1) & (TOKEN_STREAM_WINDOW_SIZE - 1)];
+}
+
+/**
+ * Skips the rest of the current statement, so that the next token to be consumed
+ * is the NEWLINE or END token that ends it. Used to recover from parse errors.
+ *
+ * Store-backed streams jump to the end in O(1) and skip the observer for the jumped
+ * over tokens. Lexer-backed streams have to lex the tokens in between.
+ * The previously consumed token is undefined afterwards.
+ */
+extern auto stream_skip_statement(TokenStream *stream) -> void;
+
+/**
+ * Returns whether the most recently consumed token, which must be an opening parenthesis,
+ * is known to be unmatched. Only store-backed streams know this upfront, so lexer-backed
+ * streams always return false and the parser finds out when the statement ends.
+ */
+extern auto stream_prev_paren_is_unmatched(TokenStream *stream) -> bool;
+
+/**
+ * Inputs at least this large are split into chunks at line boundaries,
+ * which are tokenized in parallel.
+ */
+size_t constexpr TOKENIZATION_MIN_CHUNK_SIZE = 512 * 1024;
+
+/**
+ * Tokenizes the input string into a token store.
+ *
+ * Large inputs are tokenized in parallel chunks, which are stitched in order.
+ * The chunks intern their identifiers into the same symbol table.
  *
  * The tokens are stored in an ArenaAllocator for efficient memory management.
  */
-auto tokenize(String *input, ArenaAllocator *allocator) -> Array<Token>;
+auto tokenize(String *input, SymbolTable *symbols, ArenaAllocator *allocator) -> TokenStore;
 
 #endif // __BLOOM_H_TOKENIZATION__
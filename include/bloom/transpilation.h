@@ -1,10 +1,18 @@
 #ifndef __BLOOM_H_TRANSPILATION__
 #define __BLOOM_H_TRANSPILATION__
+#include <bloom/call_graph.h>
+#include <bloom/folding.h>
 #include <bloom/parsing.h>
+#include <bloom/resolution.h>
+#include <bloom/type_checking.h>
 
 extern auto transpile_to_c(
     String *target_file_path,
-    Array<ASTNode> *ast_nodes,
+    AST *ast,
+    NameResolution *resolution,
+    TypeCheck *type_check,
+    CallGraph *call_graph,
+    ProcFolding *folding,
     ArenaAllocator *allocator
 ) -> void;
 
@@ -0,0 +1,125 @@
+/**
+ * Contains the type checking pass, which infers the type of every expression op
+ * of a resolved AST and checks that the operands, arguments and return values
+ * match the types they are used as.
+ *
+ * The types are a flat table of primitive types, so a type is a single byte that
+ * indexes the table, and every type maps to an exact-width C type.
+ */
+#ifndef __BLOOM_H_TYPE_CHECKING__
+#define __BLOOM_H_TYPE_CHECKING__
+#include <cstddef>
+#include <cstdint>
+#include <bloom/allocation.h>
+#include <bloom/array.h>
+#include <bloom/interning.h>
+#include <bloom/parsing.h>
+#include <bloom/resolution.h>
+
+enum class TypeKind : uint8_t {
+    /**
+     * The type of an ill-typed expression. No further errors are reported about
+     * it, so that a single mistake doesn't cascade into many errors.
+     */
+    ERROR = 0,
+    VOID,
+    BOOL,
+    I8,
+    I16,
+    I32,
+    I64,
+    U8,
+    U16,
+    U32,
+    U64,
+    STRING,
+    /**
+     * The type of an expression of integer literals, which takes the integer type
+     * that it's used as, or INT_DEFAULT_TYPE if nothing determines it.
+     */
+    INTEGER_LITERAL,
+    /**
+     * The type of a procedure name, which can only be called.
+     */
+    PROC,
+};
+
+struct TypeInfo {
+    char const *name;
+    /**
+     * The name of the C type, or null if values of the type can't be stored.
+     */
+    char const *c_name;
+    /**
+     * The size of an integer type in bytes, 0 for other types.
+     */
+    uint8_t size;
+    bool is_signed;
+};
+
+/**
+ * The info of every type, indexed by its kind.
+ */
+constexpr TypeInfo TYPE_INFOS[] = {
+    /* ERROR */           { "<error>",         nullptr,       0, false },
+    /* VOID */            { "Void",            "void",        0, false },
+    /* BOOL */            { "Bool",            "bool",        0, false },
+    /* I8 */              { "I8",              "int8_t",      1, true },
+    /* I16 */             { "I16",             "int16_t",     2, true },
+    /* I32 */             { "I32",             "int32_t",     4, true },
+    /* I64 */             { "I64",             "int64_t",     8, true },
+    /* U8 */              { "U8",              "uint8_t",     1, false },
+    /* U16 */             { "U16",             "uint16_t",    2, false },
+    /* U32 */             { "U32",             "uint32_t",    4, false },
+    /* U64 */             { "U64",             "uint64_t",    8, false },
+    /* STRING */          { "String",          "char const*", 0, false },
+    /* INTEGER_LITERAL */ { "integer literal", nullptr,       0, true },
+    /* PROC */            { "procedure",       nullptr,       0, false },
+};
+static_assert(sizeof(TYPE_INFOS) / sizeof(TYPE_INFOS[0]) == static_cast<size_t>(TypeKind::PROC) + 1,
+    "Every type kind needs its info");
+
+/**
+ * The type of integer literals whose type isn't determined by their use, which is
+ * also the type that the Int type name stands for.
+ */
+TypeKind constexpr INT_DEFAULT_TYPE = TypeKind::I32;
+
+inline auto type_info(TypeKind kind) -> TypeInfo const& {
+    return TYPE_INFOS[static_cast<size_t>(kind)];
+}
+
+inline auto is_integer_type(TypeKind kind) -> bool {
+    return type_info(kind).size != 0;
+}
+
+struct TypeCheck {
+    /**
+     * The type of the subexpression that ends at each op, indexed like the op array of the AST.
+     * The type of the last op of a variable definition value is the type of the variable.
+     */
+    Array<TypeKind> op_types;
+    /**
+     * The type that each type node of the AST names, indexed like the type array of the AST.
+     */
+    Array<TypeKind> types;
+    size_t error_count;
+};
+
+/**
+ * Checks the types of a resolved AST and prints the type errors.
+ *
+ * The types are allocated from the given allocator. The line index that the
+ * errors are reported with is reclaimed before returning.
+ */
+extern auto check_types(AST *ast, NameResolution *resolution, ArenaAllocator *allocator) -> TypeCheck;
+
+/**
+ * Returns the type of a variable, whose value is an EXPRESSION node.
+ */
+inline auto variable_type(AST const *ast, TypeCheck *type_check, VariableDefinitionASTNode const *variable_definition) -> TypeKind {
+    auto *expression = ast_expression(ast, variable_definition->value);
+    return type_check->op_types[expression->first_op + expression->op_count - 1];
+}
+
+#endif // __BLOOM_H_TYPE_CHECKING__
@@ -1,15 +1,82 @@
 #include <bloom/allocation.h>
 #include <bloom/print.h>
 #include <cstdarg>
+#include <cstdint>
 #include <cstring>
 
-ArenaAllocator::ArenaAllocator(size_t size) : offset(0), length(size) {
-    data = static_cast<byte*>(calloc(size, 1));
-    assert(data != nullptr && "Failed to allocate memory for ArenaAllocator");
+#include <sys/mman.h>
+
+static inline auto round_up(size_t value, size_t alignment) -> size_t {
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+static inline auto commit_granularity(ArenaAllocator const *allocator) -> size_t {
+    return allocator->options.use_huge_pages ? ARENA_HUGE_PAGE_SIZE : ARENA_COMMIT_GRANULARITY;
+}
+
+ArenaAllocator::ArenaAllocator(size_t size, ArenaOptions options)
+    : data(nullptr), length(0), offset(0), committed(0), options(options) {
+    // The range is reserved without any access, so it takes no memory until it's committed
+    length = round_up(size, commit_granularity(this));
+    size_t alignment = options.use_huge_pages ? ARENA_HUGE_PAGE_SIZE : 0;
+    void *reservation = mmap(nullptr, length + alignment, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    assert(reservation != MAP_FAILED && "Failed to reserve memory for ArenaAllocator");
+    data = static_cast<byte*>(reservation);
+    if (alignment != 0) {
+        // Huge pages need an aligned range, so the unaligned ends of the reservation are released
+        byte *aligned = reinterpret_cast<byte*>(round_up(reinterpret_cast<uintptr_t>(data), alignment));
+        size_t head = aligned - data;
+        if (head != 0) {
+            munmap(data, head);
+        }
+        if (alignment - head != 0) {
+            munmap(aligned + length, alignment - head);
+        }
+        data = aligned;
+        (void)madvise(data, length, MADV_HUGEPAGE);
+    }
 }
 
 auto delete_allocator(ArenaAllocator *allocator) -> void {
-    free(allocator->data);
+    munmap(allocator->data, allocator->length);
+}
+
+auto commit_allocator_memory(ArenaAllocator *allocator, size_t end) -> void {
+    assert(end <= allocator->length && "Failed to commit memory beyond the ArenaAllocator reservation");
+    size_t new_committed = round_up(end, commit_granularity(allocator));
+    if (new_committed > allocator->length) {
+        new_committed = allocator->length;
+    }
+    byte *begin = allocator->data + allocator->committed;
+    size_t size = new_committed - allocator->committed;
+    int result = mprotect(begin, size, PROT_READ | PROT_WRITE);
+    assert(result == 0 && "Failed to commit memory for ArenaAllocator");
+    (void)result;
+    if (allocator->options.prefault) {
+#ifdef MADV_POPULATE_WRITE
+        (void)madvise(begin, size, MADV_POPULATE_WRITE);
+#else
+        // Touch a byte of every page, which are zero
+        for (size_t i = 0; i < size; i += 4096) {
+            begin[i] = 0;
+        }
+#endif
+    }
+    allocator->committed = new_committed;
+}
+
+auto decommit_allocator_memory(ArenaAllocator *allocator) -> void {
+    size_t new_committed = round_up(allocator->offset, commit_granularity(allocator));
+    if (new_committed >= allocator->committed) {
+        return;
+    }
+    byte *begin = allocator->data + new_committed;
+    size_t size = allocator->committed - new_committed;
+    (void)madvise(begin, size, MADV_DONTNEED);
+    int result = mprotect(begin, size, PROT_NONE);
+    assert(result == 0 && "Failed to decommit memory of ArenaAllocator");
+    (void)result;
+    allocator->committed = new_committed;
 }
 
 auto debug_print_bytes(Array<DebugByte> bytes, DebugColor color) -> void {
@@ -43,11 +110,40 @@ auto reclaim_memory_by_markers(
     if (allocation_size_to_reclaim == 0) {
         return;
     }
-    memset(allocator->data + allocator->offset, 0, allocation_size_to_reclaim);
-    print("Allocator offset: %\n", allocator->offset);
     assert (allocator->offset >= allocation_size_to_reclaim &&
         "Allocator offset underflow on reclaim");
     allocator->offset -= allocation_size_to_reclaim;
+    if (allocator->options.decommit_on_reset) {
+        decommit_allocator_memory(allocator);
+    }
+}
+
+static ArenaOptions scratch_arena_options = {};
+
+/**
+ * The scratch arenas of a thread, which are released when the thread exits.
+ */
+struct ScratchArenas {
+    ArenaAllocator arenas[2];
+
+    ScratchArenas() : arenas {
+        ArenaAllocator(SCRATCH_ARENA_SIZE, scratch_arena_options),
+        ArenaAllocator(SCRATCH_ARENA_SIZE, scratch_arena_options),
+    } {}
+    ~ScratchArenas() {
+        for (auto &arena : arenas) {
+            delete_allocator(&arena);
+        }
+    }
+};
+
+auto set_scratch_arena_options(ArenaOptions options) -> void {
+    scratch_arena_options = options;
+}
+
+auto scratch_arena(ArenaAllocator const *conflict) -> ArenaAllocator* {
+    static thread_local ScratchArenas scratch_arenas;
+    return &scratch_arenas.arenas[conflict == &scratch_arenas.arenas[0]];
 }
 
 auto to_array(ArenaAllocator *allocator) -> Array<byte> {
@@ -0,0 +1,345 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <climits>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <type_traits>
+#include <bloom/caching.h>
+
+/**
+ * Hashes the source 32 bytes at a time in four independent lanes,
+ * so that the multiplications of the lanes overlap.
+ */
+auto hash_source(String const *source) -> uint64_t {
+    uint64_t constexpr MULTIPLIER = 0xBF58476D1CE4E5B9ull;
+    char const *data = source->data;
+    size_t const length = source->length;
+    uint64_t lanes[4] = {
+        0x9E3779B97F4A7C15ull ^ length,
+        0xC2B2AE3D27D4EB4Full,
+        0x165667B19E3779F9ull,
+        0x27D4EB2F165667C5ull,
+    };
+    size_t i = 0;
+    for (; i + sizeof(lanes) <= length; i += sizeof(lanes)) {
+        for (size_t lane = 0; lane < 4; lane++) {
+            uint64_t word;
+            memcpy(&word, data + i + lane * sizeof(uint64_t), sizeof(uint64_t));
+            lanes[lane] = (lanes[lane] ^ word) * MULTIPLIER;
+            lanes[lane] ^= lanes[lane] >> 31;
+        }
+    }
+
+    uint64_t hash = lanes[0];
+    for (size_t lane = 1; lane < 4; lane++) {
+        hash = (hash ^ lanes[lane]) * MULTIPLIER;
+        hash ^= hash >> 31;
+    }
+    for (; i < length; i += sizeof(uint64_t)) {
+        uint64_t word = 0;
+        memcpy(&word, data + i, length - i < sizeof(uint64_t) ? length - i : sizeof(uint64_t));
+        hash = (hash ^ word) * MULTIPLIER;
+        hash ^= hash >> 31;
+    }
+    hash ^= hash >> 29;
+    hash *= 0x94D049BB133111EBull;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+/**
+ * Calls the function with the section and the array of every AST array.
+ */
+template<typename Fn>
+static auto for_each_ast_section(ASTCacheHeader *header, AST *ast, Fn &&fn) -> void {
+    fn(&header->kinds, &ast->kinds);
+    fn(&header->parents, &ast->parents);
+    fn(&header->subtree_sizes, &ast->subtree_sizes);
+    fn(&header->payloads, &ast->payloads);
+    fn(&header->expressions, &ast->expressions);
+    fn(&header->proc_defs, &ast->proc_defs);
+    fn(&header->variable_definitions, &ast->variable_definitions);
+    fn(&header->expression_ops, &ast->expression_ops);
+    fn(&header->expression_op_offsets, &ast->expression_op_offsets);
+    fn(&header->proc_params, &ast->proc_params);
+    fn(&header->types, &ast->types);
+}
+
+/**
+ * Hashes the mapped cache file from the section table on, i.e. everything but the hash fields.
+ */
+static auto hash_content(byte const *mapping, size_t file_length) -> uint64_t {
+    size_t constexpr CONTENT_OFFSET = offsetof(ASTCacheHeader, source);
+    auto content = String::from_data_and_length(
+        reinterpret_cast<char const*>(mapping + CONTENT_OFFSET),
+        file_length - CONTENT_OFFSET
+    );
+    return hash_source(&content);
+}
+
+/**
+ * Places a section of the given length at the end of the file, aligned for its elements.
+ */
+template<typename ElementType>
+static auto place_section(ASTCacheSection *section, size_t *file_length, size_t length) -> void {
+    *file_length = (*file_length + alignof(ElementType) - 1) & ~(alignof(ElementType) - 1);
+    section->offset = *file_length;
+    section->length = length;
+    *file_length += length * sizeof(ElementType);
+}
+
+static auto write_all(int fd, void const *data, size_t length, size_t offset) -> bool {
+    auto const *bytes = static_cast<byte const*>(data);
+    while (length > 0) {
+        ssize_t written = pwrite(fd, bytes, length, offset);
+        if (written <= 0) {
+            return false;
+        }
+        bytes += written;
+        length -= written;
+        offset += written;
+    }
+    return true;
+}
+
+/**
+ * Writes the elements of the array into its section one segment at a time.
+ */
+template<typename ElementType>
+static auto write_section(int fd, ASTCacheSection const *section, SegmentedArray<ElementType> *array) -> bool {
+    size_t offset = section->offset;
+    size_t segment_begin = 0;
+    for (size_t segment = 0; segment_begin < array->length; segment++) {
+        size_t segment_length = segmented_array_segment_length(segment);
+        size_t count = array->length - segment_begin < segment_length
+            ? array->length - segment_begin
+            : segment_length;
+        if (!write_all(fd, array->segments[segment], count * sizeof(ElementType), offset)) {
+            return false;
+        }
+        offset += count * sizeof(ElementType);
+        segment_begin += count;
+    }
+    return true;
+}
+
+/**
+ * Reads the written file back to hash its content, and writes the hash into its header.
+ */
+static auto write_content_hash(int fd, size_t file_length) -> bool {
+    void *mapping = mmap(nullptr, file_length, PROT_READ, MAP_SHARED, fd, 0);
+    if (mapping == MAP_FAILED) {
+        return false;
+    }
+    uint64_t content_hash = hash_content(static_cast<byte const*>(mapping), file_length);
+    munmap(mapping, file_length);
+    return write_all(fd, &content_hash, sizeof(content_hash), offsetof(ASTCacheHeader, content_hash));
+}
+
+/**
+ * Writes the symbol names as source spans. Returns false if a name isn't in the source.
+ */
+static auto write_symbol_names(
+    int fd,
+    ASTCacheSection const *section,
+    String const *source,
+    SymbolTable const *symbols
+) -> bool {
+    // Write the spans in batches, so that they don't need to be allocated
+    size_t constexpr BATCH_LENGTH = 256;
+    SourceSpan batch[BATCH_LENGTH];
+    size_t offset = section->offset;
+    for (size_t begin = BUILTIN_SYMBOL_COUNT; begin < symbols->symbol_count; begin += BATCH_LENGTH) {
+        size_t count = symbols->symbol_count - begin < BATCH_LENGTH
+            ? symbols->symbol_count - begin
+            : BATCH_LENGTH;
+        for (size_t i = 0; i < count; i++) {
+            String name = symbol_name(symbols, static_cast<SymbolId>(begin + i));
+            if (name.data < source->data || name.data + name.length > source->data + source->length) {
+                return false;
+            }
+            batch[i] = SourceSpan {
+                .offset = static_cast<uint32_t>(name.data - source->data),
+                .length = static_cast<uint32_t>(name.length),
+            };
+        }
+        if (!write_all(fd, batch, count * sizeof(SourceSpan), offset)) {
+            return false;
+        }
+        offset += count * sizeof(SourceSpan);
+    }
+    return true;
+}
+
+auto write_ast_cache(
+    char const *path,
+    uint64_t source_hash,
+    AST const *ast,
+    SymbolTable const *symbols
+) -> bool {
+    ASTCacheHeader header = {
+        .magic = AST_CACHE_MAGIC,
+        .version = AST_CACHE_VERSION,
+        .source_hash = source_hash,
+    };
+    AST sections_ast = *ast;
+    size_t file_length = sizeof(ASTCacheHeader);
+    place_section<char>(&header.source, &file_length, ast->source.length);
+    place_section<SourceSpan>(&header.symbol_names, &file_length,
+        symbols->symbol_count - BUILTIN_SYMBOL_COUNT);
+    for_each_ast_section(&header, &sections_ast, [&](ASTCacheSection *section, auto **array) {
+        using ElementType = std::remove_reference_t<decltype(*(*array)->segments[0])>;
+        place_section<ElementType>(section, &file_length, (*array)->length);
+    });
+
+    char temporary_path[PATH_MAX];
+    if (snprintf(temporary_path, sizeof(temporary_path), "%s.%d.tmp", path, getpid()) >= PATH_MAX) {
+        return false;
+    }
+    // The file is also read back, since the AST arrays are scattered across segments in memory
+    int fd = open(temporary_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        return false;
+    }
+    bool written =
+        write_all(fd, &header, sizeof(header), 0) &&
+        write_all(fd, ast->source.data, ast->source.length, header.source.offset) &&
+        write_symbol_names(fd, &header.symbol_names, &ast->source, symbols);
+    for_each_ast_section(&header, &sections_ast, [&](ASTCacheSection *section, auto **array) {
+        written = written && write_section(fd, section, *array);
+    });
+    // The gaps between the sections are left as holes, which read as zeros
+    written = written && ftruncate(fd, file_length) == 0 && write_content_hash(fd, file_length);
+    close(fd);
+
+    if (!written || rename(temporary_path, path) != 0) {
+        unlink(temporary_path);
+        return false;
+    }
+    return true;
+}
+
+template<typename ElementType>
+static auto is_section_in_bounds(ASTCacheSection const *section, size_t file_length) -> bool {
+    return section->offset % alignof(ElementType) == 0 &&
+        section->offset <= file_length &&
+        section->length <= (file_length - section->offset) / sizeof(ElementType);
+}
+
+/**
+ * Returns whether the cached symbol names are spans of the source that intern in
+ * order, i.e. they are distinct and none of them is a builtin name.
+ *
+ * The names are interned into a scratch table, so that a damaged cache leaves the
+ * symbol table untouched. Its names would point into the unmapped file otherwise.
+ */
+static auto are_symbol_names_valid(String const *source, Array<SourceSpan const> names, ArenaAllocator *allocator) -> bool {
+    auto scratch = ScratchScope(allocator);
+    auto *scratch_symbols = symbol_table_from_allocator(scratch.allocator);
+    for (size_t i = 0; i < names.length; i++) {
+        SourceSpan span = names[i];
+        if (span.offset > source->length || span.length > source->length - span.offset) {
+            return false;
+        }
+        String name = String::from_data_and_length(source->data + span.offset, span.length);
+        if (intern_symbol(scratch_symbols, &name) != BUILTIN_SYMBOL_COUNT + i) {
+            return false;
+        }
+    }
+    return true;
+}
+
+auto map_ast_cache(
+    char const *path,
+    String const *source,
+    uint64_t source_hash,
+    SymbolTable *symbols,
+    ArenaAllocator *allocator
+) -> MappedAST {
+    assert(symbols->symbol_count == BUILTIN_SYMBOL_COUNT &&
+        "Symbol table must only contain the builtin symbols");
+    MappedAST mapped_ast = {};
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        // Not cached yet
+        return mapped_ast;
+    }
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) == -1 || static_cast<size_t>(file_stat.st_size) < sizeof(ASTCacheHeader)) {
+        close(fd);
+        return mapped_ast;
+    }
+    size_t const file_length = file_stat.st_size;
+    // The mapping is private and writable, so that later passes can
+    // update the nodes in place without modifying the file
+    byte *mapping = static_cast<byte*>(mmap(nullptr, file_length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0));
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        return mapped_ast;
+    }
+
+    auto *header = reinterpret_cast<ASTCacheHeader*>(mapping);
+    AST ast = {};
+    bool is_valid =
+        header->magic == AST_CACHE_MAGIC &&
+        header->version == AST_CACHE_VERSION &&
+        header->source_hash == source_hash &&
+        header->source.length == source->length &&
+        is_section_in_bounds<char>(&header->source, file_length) &&
+        is_section_in_bounds<SourceSpan>(&header->symbol_names, file_length);
+    for_each_ast_section(header, &ast, [&](ASTCacheSection *section, auto **array) {
+        using ElementType = std::remove_reference_t<decltype(*(*array)->segments[0])>;
+        is_valid = is_valid && is_section_in_bounds<ElementType>(section, file_length);
+    });
+    // Guard against hash collisions. Comparing is still much cheaper than parsing.
+    is_valid = is_valid && memcmp(mapping + header->source.offset, source->data, source->length) == 0;
+    // The AST arrays are trusted once they are mapped, so a damaged file must not get through
+    is_valid = is_valid && hash_content(mapping, file_length) == header->content_hash;
+    if (!is_valid) {
+        munmap(mapping, file_length);
+        return mapped_ast;
+    }
+
+    ast.source = String::from_data_and_length(
+        reinterpret_cast<char const*>(mapping + header->source.offset),
+        header->source.length
+    );
+    // Interning the names in ID order gives every symbol the same ID it had when cached
+    auto const *symbol_names = reinterpret_cast<SourceSpan const*>(mapping + header->symbol_names.offset);
+    auto names = Array<SourceSpan const>(symbol_names, header->symbol_names.length);
+    if (!are_symbol_names_valid(&ast.source, names, allocator)) {
+        munmap(mapping, file_length);
+        return mapped_ast;
+    }
+    for (size_t i = 0; i < names.length; i++) {
+        String name = ast_string(&ast, names[i]);
+        SymbolId symbol = intern_symbol(symbols, &name);
+        assert(symbol == BUILTIN_SYMBOL_COUNT + i && "Validated symbol names must intern in order");
+        (void)symbol;
+    }
+
+    for_each_ast_section(header, &ast, [&](ASTCacheSection *section, auto **array) {
+        using ElementType = std::remove_reference_t<decltype(*(*array)->segments[0])>;
+        *array = segmented_array_view_from_allocator(
+            allocator,
+            reinterpret_cast<ElementType*>(mapping + section->offset),
+            section->length
+        );
+    });
+
+    mapped_ast.mapping = mapping;
+    mapped_ast.mapping_length = file_length;
+    mapped_ast.ast = ast;
+    return mapped_ast;
+}
+
+auto unmap_ast_cache(MappedAST *mapped_ast) -> void {
+    if (mapped_ast->mapping != nullptr) {
+        munmap(mapped_ast->mapping, mapped_ast->mapping_length);
+        mapped_ast->mapping = nullptr;
+    }
+}
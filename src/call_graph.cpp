@@ -0,0 +1,137 @@
+#include <bloom/call_graph.h>
+#include <bloom/print.h>
+
+/**
+ * Calls the visitor with the procedure of every procedure name that's used in the subtree of the node.
+ */
+template<typename Visitor>
+static auto for_each_proc_use(CallGraph *graph, AST *ast, NameResolution *resolution, NodeId node, Visitor &&visit) -> void {
+    // The subtree is contiguous in pre-order, so its expressions are found without recursion
+    NodeId end = ast_subtree_end(ast, node);
+    for (NodeId descendant = node + 1; descendant < end; descendant++) {
+        if (ast_kind(ast, descendant) != ASTNodeType::EXPRESSION) {
+            continue;
+        }
+        auto *expression = ast_expression(ast, descendant);
+        for (uint32_t op = expression->first_op; op < expression->first_op + expression->op_count; op++) {
+            auto binding = resolution_binding(resolution, op);
+            if (binding.kind == BindingKind::PROC) {
+                uint32_t proc = call_graph_proc(graph, binding.index);
+                assert(proc != UINT32_MAX && "Procedure names are only bound to top-level procedures");
+                visit(proc);
+            }
+        }
+    }
+}
+
+auto call_graph_proc(CallGraph *graph, NodeId node) -> uint32_t {
+    // The procedures are in source order, which is also the order of their node IDs
+    size_t begin = 0;
+    size_t end = graph->procs.length;
+    while (begin < end) {
+        size_t middle = begin + (end - begin) / 2;
+        if (graph->procs[middle] < node) {
+            begin = middle + 1;
+        }
+        else {
+            end = middle;
+        }
+    }
+    return begin < graph->procs.length && graph->procs[begin] == node ? static_cast<uint32_t>(begin) : UINT32_MAX;
+}
+
+auto build_call_graph(
+    AST *ast,
+    NameResolution *resolution,
+    SymbolTable *symbols,
+    Array<SymbolId> root_symbols,
+    ArenaAllocator *allocator
+) -> CallGraph {
+    size_t proc_count = 0;
+    ast_for_each_root(ast, [&](NodeId root) {
+        proc_count += ast_kind(ast, root) == ASTNodeType::PROC_DEF;
+    });
+
+    auto procs_block = allocate_array<NodeId>(allocator, proc_count);
+    auto callee_offsets_block = allocate_array<uint32_t>(allocator, proc_count + 1);
+    auto graph = CallGraph {
+        .procs = Array<NodeId>(procs_block.data, proc_count),
+        .callee_offsets = Array<uint32_t>(callee_offsets_block.data, proc_count + 1),
+        .callees = {},
+        .is_root = {},
+        .is_reachable = {},
+        .reachable_count = 0,
+        .error_count = 0,
+    };
+    size_t proc_index = 0;
+    ast_for_each_root(ast, [&](NodeId root) {
+        if (ast_kind(ast, root) == ASTNodeType::PROC_DEF) {
+            graph.procs[proc_index++] = root;
+        }
+    });
+
+    // The edges are counted first, so that the callees are allocated as one array
+    uint32_t callee_count = 0;
+    for (size_t proc = 0; proc < proc_count; proc++) {
+        graph.callee_offsets[proc] = callee_count;
+        for_each_proc_use(&graph, ast, resolution, graph.procs[proc], [&](uint32_t) {
+            callee_count++;
+        });
+    }
+    graph.callee_offsets[proc_count] = callee_count;
+    auto callees_block = allocate_array<uint32_t>(allocator, callee_count);
+    graph.callees = Array<uint32_t>(callees_block.data, callee_count);
+    for (size_t proc = 0; proc < proc_count; proc++) {
+        uint32_t callee_index = graph.callee_offsets[proc];
+        for_each_proc_use(&graph, ast, resolution, graph.procs[proc], [&](uint32_t callee) {
+            graph.callees[callee_index++] = callee;
+        });
+    }
+
+    // Mark the reachable procedures with a depth-first search from the roots.
+    // A procedure is pushed at most once, so the stack never holds more than every procedure.
+    auto is_root_block = allocate_array<bool>(allocator, proc_count);
+    auto is_reachable_block = allocate_array<bool>(allocator, proc_count);
+    graph.is_root = Array<bool>(is_root_block.data, proc_count);
+    graph.is_reachable = Array<bool>(is_reachable_block.data, proc_count);
+    for (size_t proc = 0; proc < proc_count; proc++) {
+        graph.is_root[proc] = false;
+        graph.is_reachable[proc] = false;
+    }
+    auto scratch = ScratchScope(allocator);
+    auto stack = allocate_array<uint32_t>(scratch.allocator, proc_count);
+    size_t stack_length = 0;
+    for (SymbolId root_symbol : root_symbols) {
+        bool is_defined = false;
+        for (uint32_t proc = 0; proc < proc_count; proc++) {
+            if (ast_proc_def(ast, graph.procs[proc])->symbol != root_symbol) {
+                continue;
+            }
+            is_defined = true;
+            if (!graph.is_root[proc]) {
+                graph.is_root[proc] = true;
+                graph.is_reachable[proc] = true;
+                stack.data[stack_length++] = proc;
+            }
+        }
+        // A missing root would otherwise silently leave its entry point out of the output
+        if (!is_defined) {
+            eprint("Error: No top-level procedure named % to start from or export\n", symbol_name(symbols, root_symbol));
+            graph.error_count++;
+        }
+    }
+    while (stack_length > 0) {
+        uint32_t proc = stack.data[--stack_length];
+        graph.reachable_count++;
+        for (uint32_t i = graph.callee_offsets[proc]; i < graph.callee_offsets[proc + 1]; i++) {
+            uint32_t callee = graph.callees[i];
+            if (!graph.is_reachable[callee]) {
+                graph.is_reachable[callee] = true;
+                stack.data[stack_length++] = callee;
+            }
+        }
+    }
+
+    print("Reachable procedures: % of %\n", graph.reachable_count, proc_count);
+    return graph;
+}
@@ -0,0 +1,92 @@
+#include <bloom/diagnostics.h>
+#include <bloom/print.h>
+#include <bloom/scanning.h>
+
+size_t constexpr COL_BEGIN = 1;
+size_t constexpr LINE_BEGIN = 1;
+
+auto build_line_index(String const *source, ArenaAllocator *allocator) -> LineIndex {
+    assert(source->length <= MAX_SOURCE_LENGTH &&
+        "Source is too large for 32-bit line offsets");
+
+    // Every newline begins a new line, in addition to the first one
+    size_t newline_count = count_class(source, 0, CHAR_CLASS_NEWLINE);
+    auto line_begins = allocate_array<uint32_t>(allocator, newline_count + 1);
+    line_begins.data[0] = 0;
+    size_t written = collect_class_offsets(source, 0, CHAR_CLASS_NEWLINE, line_begins.data + 1);
+    assert(written == newline_count && "Newline count mismatch");
+    // Turn the newline offsets into the offsets of the bytes after them
+    for (size_t i = 1; i < line_begins.length; i++) {
+        line_begins.data[i]++;
+    }
+    return LineIndex {
+        .source = *source,
+        .line_begins = Array<uint32_t>(line_begins.data, line_begins.length),
+    };
+}
+
+auto line_index_line_of(LineIndex const *index, uint32_t offset) -> size_t {
+    assert(offset <= index->source.length && "Source offset out of bounds");
+    // Find the last line that begins at or before the offset
+    size_t low = 0;
+    size_t high = index->line_begins.length;
+    while (high - low > 1) {
+        size_t middle = low + (high - low) / 2;
+        if (index->line_begins.data[middle] <= offset) {
+            low = middle;
+        }
+        else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+auto line_index_position(LineIndex const *index, uint32_t offset) -> Token::Position {
+    size_t line = line_index_line_of(index, offset);
+    return Token::Position {
+        .col = offset - index->line_begins.data[line] + COL_BEGIN,
+        .line = line + LINE_BEGIN,
+    };
+}
+
+auto line_index_line_content(LineIndex const *index, uint32_t offset) -> String {
+    size_t line = line_index_line_of(index, offset);
+    size_t begin = index->line_begins.data[line];
+    size_t end = line + 1 < index->line_begins.length
+        ? index->line_begins.data[line + 1] - 1
+        : index->source.length;
+    return String::from_data_and_length(index->source.data + begin, end - begin);
+}
+
+auto print_source_error(String const *source, uint32_t offset, char const *message) -> void {
+    auto scratch = ScratchScope();
+    auto line_index = build_line_index(source, scratch.allocator);
+    auto position = line_index_position(&line_index, offset);
+    eprint("Error at line %, column %: %\n", position.line, position.col, message);
+    print_source_excerpt(stderr, &line_index, offset);
+}
+
+auto print_source_excerpt(FILE *file, LineIndex const *index, uint32_t offset) -> void {
+    auto position = line_index_position(index, offset);
+    auto content = line_index_line_content(index, offset);
+
+    // The caret line is padded to the width of the line number
+    char line_number[24];
+    int line_number_width = snprintf(
+        line_number,
+        sizeof(line_number),
+        "%lu",
+        static_cast<unsigned long>(position.line)
+    );
+    print(file, "    % | %\n", line_number, content);
+    print(file, "    ");
+    for (int i = 0; i < line_number_width; i++) {
+        fputc(' ', file);
+    }
+    print(file, " | ");
+    for (size_t col = COL_BEGIN; col < position.col; col++) {
+        fputc(' ', file);
+    }
+    print(file, "^\n");
+}
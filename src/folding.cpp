@@ -0,0 +1,252 @@
+#include <bloom/caching.h>
+#include <bloom/folding.h>
+#include <bloom/print.h>
+
+/**
+ * Marks the identifier of a recursive call, which is the same in identical procedures
+ * although the procedure that it calls differs.
+ */
+uint64_t constexpr SELF_REFERENCE = UINT64_MAX;
+
+struct Folder {
+    AST *ast;
+    NameResolution *resolution;
+    TypeCheck *type_check;
+    CallGraph *call_graph;
+};
+
+static inline auto hash_combine(uint64_t hash, uint64_t value) -> uint64_t {
+    hash = (hash ^ value) * 0xBF58476D1CE4E5B9ull;
+    return hash ^ (hash >> 31);
+}
+
+/**
+ * Returns the node relative to the procedure node, or NODE_NONE if there's none.
+ */
+static inline auto relative_node(NodeId proc_node, NodeId node) -> uint64_t {
+    return node == NODE_NONE ? NODE_NONE : node - proc_node;
+}
+
+/**
+ * Returns the operand or operator data of an op with the names normalized away,
+ * which is equal for the corresponding ops of identical procedures.
+ * A string literal is only identified by its escaping here, and its content is compared separately.
+ */
+static auto normalized_op_value(Folder *folder, uint32_t proc, uint32_t op) -> uint64_t {
+    AST *ast = folder->ast;
+    auto &expression_op = *segmented_array_at(ast->expression_ops, op);
+    switch (expression_op.kind) {
+        case ExpressionOpKind::IDENTIFIER: {
+            auto binding = resolution_binding(folder->resolution, op);
+            NodeId proc_node = folder->call_graph->procs[proc];
+            uint64_t index = 0;
+            switch (binding.kind) {
+                case BindingKind::PARAMETER:
+                    index = binding.index - ast_proc_def(ast, proc_node)->first_parameter;
+                    break;
+                case BindingKind::VARIABLE:
+                    index = relative_node(proc_node, binding.index);
+                    break;
+                case BindingKind::PROC: {
+                    uint32_t callee = call_graph_proc(folder->call_graph, binding.index);
+                    index = callee == proc ? SELF_REFERENCE : callee;
+                    break;
+                }
+                case BindingKind::BUILTIN:
+                case BindingKind::NONE:
+                    index = binding.index;
+                    break;
+            }
+            return hash_combine(static_cast<uint64_t>(binding.kind), index);
+        }
+        case ExpressionOpKind::INTEGER_LITERAL:
+            return expression_op.integer_value;
+        case ExpressionOpKind::STRING_LITERAL:
+            return expression_op.has_escapes;
+        case ExpressionOpKind::CALL:
+            return expression_op.argument_count;
+        default:
+            return 0;
+    }
+}
+
+/**
+ * Returns the value of a node that refers to another node, e.g. the value of a
+ * variable definition, relative to the procedure, and 0 for other nodes.
+ */
+static auto normalized_node_value(AST *ast, NodeId proc_node, NodeId node) -> uint64_t {
+    switch (ast_kind(ast, node)) {
+        case ASTNodeType::VARIABLE_DEFINITION:
+            return relative_node(proc_node, ast_variable_definition(ast, node)->value);
+        case ASTNodeType::RETURN:
+            return relative_node(proc_node, ast_return_value(ast, node));
+        default:
+            return 0;
+    }
+}
+
+/**
+ * Returns the type of a parameter or the return type, or VOID if there's no type.
+ */
+static inline auto proc_type(Folder *folder, TypeId type) -> TypeKind {
+    return type == TYPE_NONE ? TypeKind::VOID : folder->type_check->types[type];
+}
+
+/**
+ * Hashes the signature types and the body of a procedure with its names normalized away.
+ */
+static auto structural_hash(Folder *folder, uint32_t proc) -> uint64_t {
+    AST *ast = folder->ast;
+    NodeId proc_node = folder->call_graph->procs[proc];
+    auto *proc_def = ast_proc_def(ast, proc_node);
+    uint64_t hash = hash_combine(proc_def->parameter_count, static_cast<uint64_t>(proc_type(folder, proc_def->return_type)));
+    for (uint32_t i = 0; i < proc_def->parameter_count; i++) {
+        hash = hash_combine(hash, static_cast<uint64_t>(proc_type(folder, ast_proc_param(ast, proc_def, i)->type)));
+    }
+    NodeId end = ast_subtree_end(ast, proc_node);
+    for (NodeId node = proc_node + 1; node < end; node++) {
+        auto kind = ast_kind(ast, node);
+        hash = hash_combine(hash, static_cast<uint64_t>(kind));
+        hash = hash_combine(hash, normalized_node_value(ast, proc_node, node));
+        if (kind != ASTNodeType::EXPRESSION) {
+            continue;
+        }
+        auto *expression = ast_expression(ast, node);
+        for (uint32_t op = expression->first_op; op < expression->first_op + expression->op_count; op++) {
+            auto &expression_op = *segmented_array_at(ast->expression_ops, op);
+            hash = hash_combine(hash, static_cast<uint64_t>(expression_op.kind) << 32 | expression_op.size);
+            hash = hash_combine(hash, normalized_op_value(folder, proc, op));
+            if (expression_op.kind == ExpressionOpKind::STRING_LITERAL) {
+                auto content = ast_string(ast, expression_op.span);
+                hash = hash_combine(hash, hash_source(&content));
+            }
+        }
+    }
+    return hash;
+}
+
+/**
+ * Compares two procedures in full, with their names normalized away.
+ */
+static auto are_identical(Folder *folder, uint32_t proc, uint32_t other_proc) -> bool {
+    AST *ast = folder->ast;
+    NodeId proc_node = folder->call_graph->procs[proc];
+    NodeId other_node = folder->call_graph->procs[other_proc];
+    auto *proc_def = ast_proc_def(ast, proc_node);
+    auto *other_def = ast_proc_def(ast, other_node);
+    if (proc_def->parameter_count != other_def->parameter_count ||
+        proc_type(folder, proc_def->return_type) != proc_type(folder, other_def->return_type) ||
+        ast_subtree_size(ast, proc_node) != ast_subtree_size(ast, other_node)) {
+        return false;
+    }
+    for (uint32_t i = 0; i < proc_def->parameter_count; i++) {
+        if (proc_type(folder, ast_proc_param(ast, proc_def, i)->type) !=
+            proc_type(folder, ast_proc_param(ast, other_def, i)->type)) {
+            return false;
+        }
+    }
+
+    // The subtrees have the same size, so their nodes correspond one to one
+    for (NodeId offset = 1; offset < ast_subtree_size(ast, proc_node); offset++) {
+        NodeId node = proc_node + offset;
+        NodeId other = other_node + offset;
+        auto kind = ast_kind(ast, node);
+        if (kind != ast_kind(ast, other) ||
+            kind == ASTNodeType::PROC_DEF ||
+            ast_subtree_size(ast, node) != ast_subtree_size(ast, other) ||
+            normalized_node_value(ast, proc_node, node) != normalized_node_value(ast, other_node, other)) {
+            return false;
+        }
+        if (kind != ASTNodeType::EXPRESSION) {
+            continue;
+        }
+        auto *expression = ast_expression(ast, node);
+        auto *other_expression = ast_expression(ast, other);
+        if (expression->op_count != other_expression->op_count) {
+            return false;
+        }
+        for (uint32_t i = 0; i < expression->op_count; i++) {
+            uint32_t op = expression->first_op + i;
+            uint32_t other_op = other_expression->first_op + i;
+            auto &expression_op = *segmented_array_at(ast->expression_ops, op);
+            auto &other_expression_op = *segmented_array_at(ast->expression_ops, other_op);
+            if (expression_op.kind != other_expression_op.kind ||
+                expression_op.size != other_expression_op.size ||
+                normalized_op_value(folder, proc, op) != normalized_op_value(folder, other_proc, other_op)) {
+                return false;
+            }
+            if (expression_op.kind == ExpressionOpKind::STRING_LITERAL) {
+                auto content = ast_string(ast, expression_op.span);
+                auto other_content = ast_string(ast, other_expression_op.span);
+                if (content.length != other_content.length ||
+                    memcmp(content.data, other_content.data, content.length) != 0) {
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+auto fold_identical_procs(
+    AST *ast,
+    NameResolution *resolution,
+    TypeCheck *type_check,
+    CallGraph *call_graph,
+    ArenaAllocator *allocator
+) -> ProcFolding {
+    size_t proc_count = call_graph->procs.length;
+    auto representatives_block = allocate_array<uint32_t>(allocator, proc_count);
+    auto folding = ProcFolding {
+        .representatives = Array<uint32_t>(representatives_block.data, proc_count),
+        .folded_count = 0,
+    };
+    for (uint32_t proc = 0; proc < proc_count; proc++) {
+        folding.representatives[proc] = proc;
+    }
+    auto folder = Folder {
+        .ast = ast,
+        .resolution = resolution,
+        .type_check = type_check,
+        .call_graph = call_graph,
+    };
+
+    // An open-addressing table of the first procedure of every distinct structure,
+    // keyed by the structural hash, whose load factor stays at most 1/2
+    auto scratch = ScratchScope(allocator);
+    uint32_t capacity_bits = 2;
+    while ((size_t(1) << capacity_bits) < 2 * call_graph->reachable_count) {
+        capacity_bits++;
+    }
+    size_t capacity = size_t(1) << capacity_bits;
+    size_t mask = capacity - 1;
+    auto hashes = allocate_array<uint64_t>(scratch.allocator, proc_count);
+    auto slots = allocate_array<uint32_t>(scratch.allocator, capacity);
+    for (auto &slot : slots) {
+        slot = UINT32_MAX;
+    }
+
+    // Procedures are visited in source order, so the first of identical procedures represents them
+    for (uint32_t proc = 0; proc < proc_count; proc++) {
+        if (!call_graph->is_reachable[proc]) {
+            continue;
+        }
+        uint64_t hash = structural_hash(&folder, proc);
+        hashes.data[proc] = hash;
+        size_t index = hash >> (64 - capacity_bits);
+        for (; slots.data[index] != UINT32_MAX; index = (index + 1) & mask) {
+            uint32_t candidate = slots.data[index];
+            if (hashes.data[candidate] == hash && are_identical(&folder, candidate, proc)) {
+                folding.representatives[proc] = candidate;
+                folding.folded_count++;
+                break;
+            }
+        }
+        if (slots.data[index] == UINT32_MAX) {
+            slots.data[index] = proc;
+        }
+    }
+
+    print("Folded procedures: %\n", folding.folded_count);
+    return folding;
+}
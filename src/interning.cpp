@@ -0,0 +1,153 @@
+#include <new>
+#include <bloom/interning.h>
+
+/**
+ * Hashes a name 8 bytes at a time.
+ */
+static inline auto hash_name(char const *data, size_t length) -> uint64_t {
+    uint64_t constexpr MULTIPLIER = 0xBF58476D1CE4E5B9ull;
+    uint64_t hash = 0x9E3779B97F4A7C15ull ^ length;
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= length; i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(uint64_t));
+        hash = (hash ^ word) * MULTIPLIER;
+        hash ^= hash >> 31;
+    }
+    if (i < length) {
+        uint64_t word = 0;
+        memcpy(&word, data + i, length - i);
+        hash = (hash ^ word) * MULTIPLIER;
+        hash ^= hash >> 31;
+    }
+    // Finalize, so that both the shard bits (high) and the slot bits (low) are well mixed
+    hash ^= hash >> 29;
+    hash *= 0x94D049BB133111EBull;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+/**
+ * Allocates an array from the table's allocator.
+ * Must be called with the allocation mutex locked.
+ */
+template<typename ElementType>
+static auto allocate_table_array(SymbolTable *table, size_t length) -> ElementType* {
+    return allocate_array<ElementType>(table->allocator, length).data;
+}
+
+static auto allocate_empty_slots(SymbolTable *table, size_t capacity) -> SymbolTableSlot* {
+    SymbolTableSlot *slots = allocate_table_array<SymbolTableSlot>(table, capacity);
+    for (size_t i = 0; i < capacity; i++) {
+        slots[i] = SymbolTableSlot {
+            .hash = 0,
+            .symbol = SYMBOL_NONE,
+            .name = {},
+        };
+    }
+    return slots;
+}
+
+/**
+ * Doubles the capacity of a shard and reinserts its slots.
+ * Must be called with the shard and allocation mutexes locked.
+ */
+static auto grow_shard(SymbolTable *table, SymbolTableShard *shard) -> void {
+    size_t new_capacity = shard->capacity * 2;
+    SymbolTableSlot *new_slots = allocate_empty_slots(table, new_capacity);
+    for (size_t i = 0; i < shard->capacity; i++) {
+        SymbolTableSlot *slot = &shard->slots[i];
+        if (slot->symbol == SYMBOL_NONE) {
+            continue;
+        }
+        size_t index = slot->hash & (new_capacity - 1);
+        while (new_slots[index].symbol != SYMBOL_NONE) {
+            index = (index + 1) & (new_capacity - 1);
+        }
+        new_slots[index] = *slot;
+    }
+    // The old slots are left in the arena
+    shard->slots = new_slots;
+    shard->capacity = new_capacity;
+}
+
+/**
+ * Assigns the next symbol ID to the given name.
+ * Must be called with the allocation mutex locked.
+ */
+static auto add_symbol_name(SymbolTable *table, String const *name) -> SymbolId {
+    if (table->symbol_count == table->names_capacity) {
+        size_t new_capacity = table->names_capacity * 2;
+        String *new_names = allocate_table_array<String>(table, new_capacity);
+        memcpy(new_names, table->names, table->symbol_count * sizeof(String));
+        table->names = new_names;
+        table->names_capacity = new_capacity;
+    }
+    assert(table->symbol_count < SYMBOL_NONE && "Too many symbols");
+    SymbolId symbol = table->symbol_count++;
+    table->names[symbol] = *name;
+    return symbol;
+}
+
+auto symbol_table_from_allocator(ArenaAllocator *allocator) -> SymbolTable* {
+    auto block = allocate_array<SymbolTable>(allocator, 1);
+    SymbolTable *table = new (block.data) SymbolTable();
+    table->allocator = allocator;
+    table->names_capacity = SYMBOL_TABLE_SHARD_COUNT * SYMBOL_TABLE_SHARD_MIN_CAPACITY / 2;
+    table->names = allocate_table_array<String>(table, table->names_capacity);
+    table->symbol_count = 0;
+    for (auto &shard : table->shards) {
+        shard.slots = allocate_empty_slots(table, SYMBOL_TABLE_SHARD_MIN_CAPACITY);
+        shard.capacity = SYMBOL_TABLE_SHARD_MIN_CAPACITY;
+        shard.count = 0;
+    }
+
+    for (SymbolId symbol = 0; symbol < BUILTIN_SYMBOL_COUNT; symbol++) {
+        auto name = String::from_null_terminated_str(BUILTIN_SYMBOL_NAMES[symbol]);
+        SymbolId interned = intern_symbol(table, &name);
+        assert(interned == symbol && "Builtin symbols must be interned in order");
+        (void)interned;
+    }
+    return table;
+}
+
+auto intern_symbol(SymbolTable *table, String const *name) -> SymbolId {
+    uint64_t hash = hash_name(name->data, name->length);
+    uint32_t slot_hash = static_cast<uint32_t>(hash);
+    SymbolTableShard *shard = &table->shards[hash >> (64 - SYMBOL_TABLE_SHARD_BITS)];
+
+    std::lock_guard<std::mutex> shard_lock(shard->mutex);
+    size_t mask = shard->capacity - 1;
+    size_t index = slot_hash & mask;
+    while (true) {
+        SymbolTableSlot *slot = &shard->slots[index];
+        if (slot->symbol == SYMBOL_NONE) {
+            break;
+        }
+        if (slot->hash == slot_hash &&
+            slot->name.length == name->length &&
+            memcmp(slot->name.data, name->data, name->length) == 0) {
+            return slot->symbol;
+        }
+        index = (index + 1) & mask;
+    }
+
+    // The name is new. Keep the load factor at most 1/2, so that probe sequences stay short.
+    std::lock_guard<std::mutex> allocation_lock(table->allocation_mutex);
+    if ((shard->count + 1) * 2 > shard->capacity) {
+        grow_shard(table, shard);
+        mask = shard->capacity - 1;
+        index = slot_hash & mask;
+        while (shard->slots[index].symbol != SYMBOL_NONE) {
+            index = (index + 1) & mask;
+        }
+    }
+    SymbolId symbol = add_symbol_name(table, name);
+    shard->slots[index] = SymbolTableSlot {
+        .hash = slot_hash,
+        .symbol = symbol,
+        .name = *name,
+    };
+    shard->count++;
+    return symbol;
+}
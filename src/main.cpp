@@ -5,18 +5,115 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include <bloom/caching.h>
+#include <bloom/call_graph.h>
 #include <bloom/defer.h>
+#include <bloom/diagnostics.h>
+#include <bloom/folding.h>
 #include <bloom/print.h>
+#include <bloom/resolution.h>
 #include <bloom/transpilation.h>
+#include <bloom/type_checking.h>
 
 constexpr size_t kb(size_t n) { return n * 1024; }
 constexpr size_t mb(size_t n) { return n * 1024 * 1024; }
+constexpr size_t gb(size_t n) { return n * 1024 * 1024 * 1024; }
 
-const size_t MAIN_MEMORY_SIZE = kb(16);
+// The arenas only reserve address space upfront and commit it as it's used,
+// so they are reserved large enough for any realistic input
+const size_t MAIN_MEMORY_SIZE = gb(64);
+const size_t SYMBOL_MEMORY_SIZE = gb(4);
+
+/**
+ * Prints a token for debugging purposes.
+ * The observer context of the stream must be the line index of the source.
+ */
+static auto print_token(TokenStream const *stream, Token const *token) -> void {
+    auto *line_index = static_cast<LineIndex const*>(stream->on_token_context);
+    auto position = line_index_position(line_index, token->offset);
+    print("Token %:% %", position.line, position.col, to_string(token->type));
+    switch (token->type) {
+        case TokenType::IDENTIFIER:
+            print(" | % (% chars, symbol %)",
+                token->identifier.content,
+                token->identifier.content.length,
+                static_cast<size_t>(token->identifier.symbol)
+            );
+            break;
+        case TokenType::INDENT:
+            print(" | level: %",
+                token->indent.level
+            );
+            break;
+        case TokenType::INTEGER_LITERAL:
+            print(" | value: %%",
+                token->integer_literal.uvalue,
+                token->integer_literal.is_unsigned ? " (unsigned)" : ""
+            );
+            break;
+        case TokenType::KEYWORD_PROC:
+            print(" | keyword: %", TOKEN_KEYWORD_PROC);
+            break;
+        case TokenType::STRING_LITERAL:
+            print(" | content: %",
+                token->string_literal.content
+            );
+            break;
+    }
+    printf("\n");
+}
+
+/**
+ * Prints the ops of an EXPRESSION node in postfix order for debugging purposes.
+ */
+static auto print_expression(AST const *ast, NodeId node) -> void {
+    auto ops = ast_expression_ops(ast, ast_expression(ast, node));
+    bool is_first_op = true;
+    for (auto &op : ops) {
+        print(stdout, is_first_op ? "" : " ");
+        is_first_op = false;
+        switch (op.kind) {
+            case ExpressionOpKind::IDENTIFIER:
+                print("%", ast_string(ast, op.span));
+                break;
+            case ExpressionOpKind::INTEGER_LITERAL:
+                print("%", static_cast<size_t>(op.integer_value));
+                break;
+            case ExpressionOpKind::STRING_LITERAL:
+                print("\"%\"", ast_string(ast, op.span));
+                break;
+            case ExpressionOpKind::CALL:
+                print("call/%", static_cast<size_t>(op.argument_count));
+                break;
+            default:
+                print("%", to_string(op.kind));
+                break;
+        }
+    }
+}
+
+/**
+ * Interns the names of the root procedures: the entry procedure, from which the program
+ * starts, and the exported procedures, through which a library is used.
+ * The roots are allocated from the given allocator.
+ */
+static auto intern_root_symbols(int argc, char *argv[], SymbolTable *symbols, ArenaAllocator *allocator) -> Array<SymbolId> {
+    auto root_symbols_block = allocate_array<SymbolId>(allocator, argc);
+    size_t root_count = 0;
+    auto entry_proc_name = String::from_null_terminated_str(ENTRY_PROC_NAME);
+    root_symbols_block.data[root_count++] = intern_symbol(symbols, &entry_proc_name);
+    for (int i = 3; i + 1 < argc; i++) {
+        if (strcmp(argv[i], "--export") == 0) {
+            auto export_name = String::from_null_terminated_str(argv[++i]);
+            root_symbols_block.data[root_count++] = intern_symbol(symbols, &export_name);
+        }
+    }
+    return Array<SymbolId>(root_symbols_block.data, root_count);
+}
 
 int main(int argc, char* argv[]) {
     if (argc < 3) {
-        eprint("Usage: % run <input_file_path>\n", argv[0]);
+        eprint("Usage: % run <input_file_path> [--dump-tokens] [--token-store] [--no-cache] [--lazy] [--huge-pages] [--prefault] [--decommit] [--export <proc_name>]...\n", argv[0]);
         return 1;
     }
 
@@ -27,6 +124,47 @@ int main(int argc, char* argv[]) {
         return 1;
     }
 
+    bool dump_tokens = false;
+    bool use_token_store = false;
+    bool use_ast_cache = true;
+    bool parse_lazily = false;
+    ArenaOptions arena_options = {};
+    for (int i = 3; i < argc; i++) {
+        if (strcmp(argv[i], "--dump-tokens") == 0) {
+            dump_tokens = true;
+        }
+        else if (strcmp(argv[i], "--token-store") == 0) {
+            use_token_store = true;
+        }
+        else if (strcmp(argv[i], "--no-cache") == 0) {
+            use_ast_cache = false;
+        }
+        else if (strcmp(argv[i], "--lazy") == 0) {
+            parse_lazily = true;
+        }
+        else if (strcmp(argv[i], "--huge-pages") == 0) {
+            arena_options.use_huge_pages = true;
+        }
+        else if (strcmp(argv[i], "--prefault") == 0) {
+            arena_options.prefault = true;
+        }
+        else if (strcmp(argv[i], "--decommit") == 0) {
+            arena_options.decommit_on_reset = true;
+        }
+        else if (strcmp(argv[i], "--export") == 0) {
+            // The exported names are interned once the symbol table exists
+            if (i + 1 == argc) {
+                eprint("Error: Option '--export' requires a procedure name\n");
+                return 1;
+            }
+            i++;
+        }
+        else {
+            eprint("Error: Unknown option '%'\n", argv[i]);
+            return 1;
+        }
+    }
+
     auto input_file_path = std::filesystem::path(argv[2]);
     print("Input file path: %\n", input_file_path.string().c_str());
 
@@ -62,110 +200,190 @@ int main(int argc, char* argv[]) {
         return 1;
     }
 
-    auto main_allocator = ArenaAllocator(MAIN_MEMORY_SIZE);
+    auto main_allocator = ArenaAllocator(MAIN_MEMORY_SIZE, arena_options);
+    set_scratch_arena_options(arena_options);
+
+    // The mapped file isn't null-terminated, so its length is taken from the file size
+    auto input_file_content = String::from_data_and_length(
+        reinterpret_cast<char*>(mapped_memory),
+        file_stat.st_size
+    );
 
     // Print the file contents
-    print("File contents: %\n", reinterpret_cast<char*>(mapped_memory));
-
-    // Tokenize the input
-    auto input_file_content = String::from_null_terminated_str(reinterpret_cast<char*>(mapped_memory));
-    Array<Token> tokens = tokenize(&input_file_content, &main_allocator);
-    print("Tokenized % tokens\n", tokens.length);
-
-    for (auto &token : tokens) {
-        auto token_type = to_string(token.type);
-        print("Token %:% %", token.position.line, token.position.col, to_string(token.type));
-        switch (token.type) {
-            case TokenType::IDENTIFIER:
-                print(" | % (% chars)",
-                    token.identifier.content,
-                    token.identifier.content.length
-                );
-                break;
-            case TokenType::INDENT:
-                print(" | level: %",
-                    token.indent.level
-                );
-                break;
-            case TokenType::INTEGER_LITERAL:
-                print(" | value: %",
-                    token.integer_literal.value
-                );
-                break;
-            case TokenType::KEYWORD_PROC:
-                print(" | keyword: %", TOKEN_KEYWORD_PROC);
-                break;
-            case TokenType::STRING_LITERAL:
-                print(" | content: %",
-                    token.string_literal.content
-                );
-                break;
+    print("File contents: %\n", input_file_content);
+
+    // Identifiers are interned into a separate arena, as the table grows while lexing
+    auto symbol_allocator = ArenaAllocator(SYMBOL_MEMORY_SIZE, arena_options);
+    auto *symbols = symbol_table_from_allocator(&symbol_allocator);
+
+    // Unchanged sources are loaded from the AST cache instead of being parsed again.
+    // Dumping the tokens needs them to be lexed, so it always parses. A lazily parsed
+    // AST depends on the roots too, so it isn't cached.
+    use_ast_cache = use_ast_cache && !dump_tokens && !parse_lazily;
+    // The pre-parser of lazy parsing walks the lines of a token store
+    use_token_store = use_token_store || parse_lazily;
+    uint64_t source_hash = 0;
+    std::filesystem::path cache_file_path;
+    MappedAST cached_ast = {};
+    defer(unmap_ast_cache(&cached_ast));
+    Array<SymbolId> root_symbols = {};
+    if (use_ast_cache) {
+        source_hash = hash_source(&input_file_content);
+        char const *cache_directory_env = getenv("BLOOMC_CACHE_DIR");
+        auto cache_directory = cache_directory_env != nullptr
+            ? std::filesystem::path(cache_directory_env)
+            : current_path / AST_CACHE_DIRECTORY_NAME;
+        std::error_code error_code;
+        std::filesystem::create_directories(cache_directory, error_code);
+        char cache_file_name[32];
+        snprintf(cache_file_name, sizeof(cache_file_name), "%016llx.ast",
+            static_cast<unsigned long long>(source_hash));
+        cache_file_path = cache_directory / cache_file_name;
+        cached_ast = map_ast_cache(cache_file_path.c_str(), &input_file_content, source_hash, symbols, &main_allocator);
+    }
+
+    AST ast;
+    if (cached_ast.mapping != nullptr) {
+        ast = cached_ast.ast;
+        print("Loaded AST from cache: %\n", cache_file_path.c_str());
+    }
+    else {
+        // Tokenize the input (on demand while parsing, unless a token store is requested)
+        auto lexer = lexer_from_input(&input_file_content, symbols);
+        TokenStore token_store;
+        TokenStream tokens;
+        if (use_token_store) {
+            // Tokenize the whole input upfront into a compact token store
+            token_store = tokenize(&input_file_content, symbols, &main_allocator);
+            tokens = token_stream_from_store(&token_store);
+        }
+        else {
+            tokens = token_stream_from_lexer(&lexer);
+        }
+        LineIndex line_index;
+        if (dump_tokens) {
+            line_index = build_line_index(&input_file_content, &main_allocator);
+            tokens.on_token = print_token;
+            tokens.on_token_context = &line_index;
+        }
+
+        // Parse the tokens into an AST
+        if (parse_lazily) {
+            root_symbols = intern_root_symbols(argc, argv, symbols, &main_allocator);
+            ast = parse_reachable(&tokens, root_symbols, &main_allocator);
+        }
+        else {
+            ast = parse(&tokens, &main_allocator);
+        }
+        print("Parsed % tokens\n", tokens.lexed_count);
+
+        // An AST with errors isn't cached, so that the errors are reported again
+        if (use_ast_cache && ast.error_count == 0 &&
+            !write_ast_cache(cache_file_path.c_str(), source_hash, &ast, symbols)) {
+            eprint("Warning: Failed to write the AST cache file %\n", cache_file_path.c_str());
         }
-        printf("\n");
     }
-    printf("\n");
 
-    // Parse the tokens into an AST
-    auto ast_nodes = parse(&tokens, &main_allocator);
+    // The cache only holds the symbols that are named in the source, so the roots
+    // are interned after it's loaded or written
+    if (!parse_lazily) {
+        root_symbols = intern_root_symbols(argc, argv, symbols, &main_allocator);
+    }
 
     auto MISSING_TYPE = String::from_null_terminated_str("(none)");
 
-    for (auto &node : ast_nodes) {
-        if (node.parent != nullptr) {
-            continue;
-        }
-        print("AST Node type: %\n", to_string(node.type));
-        switch (node.type) {
-            case ASTNodeType::BINARY_ADD:
-                print("\tBinary operation: % + %\n",
-                    node.binary_operation.identifier_left,
-                    node.binary_operation.identifier_right
-                );
+    ast_for_each_root(&ast, [&](NodeId node) {
+        print("AST Node type: %\n", to_string(ast_kind(&ast, node)));
+        switch (ast_kind(&ast, node)) {
+            case ASTNodeType::EXPRESSION: {
+                print(stdout, "\tExpression: ");
+                print_expression(&ast, node);
+                print(stdout, "\n");
                 break;
-            case ASTNodeType::PROC_DEF:
+            }
+            case ASTNodeType::PROC_DEF: {
+                auto *proc_def = ast_proc_def(&ast, node);
                 print("\tProcedure name: % (% chars)\n",
-                    node.proc_def.name,
-                    node.proc_def.name.length
+                    ast_string(&ast, proc_def->name),
+                    static_cast<size_t>(proc_def->name.length)
                 );
-                print("\tProcedure parameters (%):\n", node.proc_def.parameters.length);
-                for (size_t i = 0; i < node.proc_def.parameters.length; i++) {
-                    auto &param = node.proc_def.parameters[i];
-                    print("\t\t%: % (% chars)\n", i, param.name, param.name.length);
+                print("\tProcedure parameters (%):\n", static_cast<size_t>(proc_def->parameter_count));
+                for (size_t i = 0; i < proc_def->parameter_count; i++) {
+                    auto *param = ast_proc_param(&ast, proc_def, i);
+                    print("\t\t%: % (% chars)\n", i, ast_string(&ast, param->name), static_cast<size_t>(param->name.length));
                 }
-                String return_type_name = node.proc_def.return_type
-                    ? node.proc_def.return_type->name
+                String return_type_name = proc_def->return_type != TYPE_NONE
+                    ? ast_string(&ast, ast_type(&ast, proc_def->return_type)->name)
                     : MISSING_TYPE;
                 print("\tProcedure return type: %\n", return_type_name);
-                print("\tProcedure body (length %):\n", node.proc_def.body.length);
-                for (auto &statement : node.proc_def.body) {
-                    if (statement.parent != &node) {
-                        continue;
-                    }
-                    print("\t\tStatement: %\n", to_string(statement.type));
-                    if (statement.type == ASTNodeType::PROC_CALL) {
-                        print("\t\t\tArgument count: %\n",
-                            statement.proc_call.arguments.length);
+                print("\tProcedure body (length %):\n", ast_child_count(&ast, node));
+                ast_for_each_child(&ast, node, [&](NodeId statement) {
+                    print("\t\tStatement: %\n", to_string(ast_kind(&ast, statement)));
+                    if (ast_kind(&ast, statement) == ASTNodeType::EXPRESSION) {
+                        print(stdout, "\t\t\tExpression: ");
+                        print_expression(&ast, statement);
+                        print(stdout, "\n");
                     }
-                    else if (statement.type == ASTNodeType::RETURN) {
-                        print("\t\t\tReturn value node type: %\n",
-                            to_string(statement.return_value->type));
-                    }
-                }
+                });
+                break;
+            }
+            default:
                 break;
         }
+    });
+
+    // Statements with parse errors are left out of the AST, so the rest of it isn't
+    // compiled either, as the generated C would silently miss them
+    bool has_errors = ast.error_count != 0;
+    if (has_errors) {
+        eprint("Error: Skipping name resolution due to parse errors\n");
     }
+    else {
+        // Bind every identifier to its definition, so that undefined names are
+        // reported here instead of by the C compiler
+        auto resolution = resolve_names(&ast, symbols, &main_allocator);
 
-    // Transpile AST nodes into C source code
-    String target_file_path = String::from_null_terminated_str("/home/henri/Personal/bloomc2/sum.c");
-    transpile_to_c(&target_file_path, &ast_nodes, &main_allocator);
+        // Type checking looks definitions up by the bindings, so it needs every name resolved
+        if (resolution.error_count != 0) {
+            has_errors = true;
+            eprint("Error: Skipping transpilation due to name errors\n");
+        }
+        else {
+            auto type_check = check_types(&ast, &resolution, &main_allocator);
+
+            // Transpile AST nodes into C source code
+            if (type_check.error_count == 0) {
+                // The rest of the procedures can't be called, so they aren't emitted
+                auto call_graph = build_call_graph(&ast, &resolution, symbols, root_symbols, &main_allocator);
+                if (call_graph.error_count != 0) {
+                    has_errors = true;
+                    eprint("Error: Skipping transpilation due to missing root procedures\n");
+                }
+                else {
+                    auto folding = fold_identical_procs(&ast, &resolution, &type_check, &call_graph, &main_allocator);
+
+                    String target_file_path = String::from_null_terminated_str("/home/henri/Personal/bloomc2/sum.c");
+                    transpile_to_c(&target_file_path, &ast, &resolution, &type_check, &call_graph, &folding, &main_allocator);
+                }
+            }
+            else {
+                has_errors = true;
+                eprint("Error: Skipping transpilation due to type errors\n");
+            }
+        }
+    }
 
     print(
-        "Main memory total: %, left: %, used: %\n",
+        "Main memory total: %, left: %, used: %, committed: %\n",
         MAIN_MEMORY_SIZE,
         memory_left(&main_allocator),
-        main_allocator.length - memory_left(&main_allocator)
+        main_allocator.length - memory_left(&main_allocator),
+        main_allocator.committed
     );
 
+    print("Interned symbols: %\n", static_cast<size_t>(symbols->symbol_count));
+
+    delete_allocator(&symbol_allocator);
     delete_allocator(&main_allocator);
-    return 0;
+    return has_errors ? 1 : 0;
 }
\ No newline at end of file
@@ -0,0 +1,176 @@
+#include <cstring>
+#include <bloom/numbers.h>
+
+// The digits are loaded into 64-bit words with the first digit in the lowest byte
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__,
+    "Integer literal parsing assumes a little-endian target");
+
+/**
+ * A 64-bit value has at most 64 binary digits, which is more than
+ * in any other supported base.
+ */
+size_t constexpr MAX_SIGNIFICANT_DIGITS = 64;
+
+uint64_t constexpr REPEATED_BYTE = 0x0101010101010101ull;
+uint64_t constexpr ZERO_DIGITS = '0' * REPEATED_BYTE;
+
+uint64_t constexpr POWERS_OF_10[9] = {
+    1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000,
+};
+
+/**
+ * Loads up to 8 digits into a word, so that the last digit is in the highest byte.
+ * The front of the word is padded with zero digits, which doesn't change the value.
+ */
+static inline auto load_digits(char const *data, size_t count) -> uint64_t {
+    uint64_t word = ZERO_DIGITS;
+    memcpy(reinterpret_cast<char*>(&word) + (sizeof(uint64_t) - count), data, count);
+    return word;
+}
+
+static inline auto are_8_decimal_digits(uint64_t word) -> bool {
+    // A byte is a digit if its high nibble is 3 and adding 6 to it doesn't carry into the high nibble
+    return ((word & (0xF0 * REPEATED_BYTE))
+        | (((word + 0x06 * REPEATED_BYTE) & (0xF0 * REPEATED_BYTE)) >> 4))
+        == 0x33 * REPEATED_BYTE;
+}
+
+/**
+ * Converts 8 decimal digits at once by combining neighboring digits,
+ * then neighboring pairs and finally neighboring quads.
+ */
+static inline auto convert_8_decimal_digits(uint64_t word) -> uint64_t {
+    word -= ZERO_DIGITS;
+    word = (word * 10) + (word >> 8);
+    word = (((word & 0x000000FF000000FFull) * (100 + (1000000ull << 32)))
+        + (((word >> 16) & 0x000000FF000000FFull) * (1 + (10000ull << 32)))) >> 32;
+    return word;
+}
+
+static inline auto are_8_binary_digits(uint64_t word) -> bool {
+    return (word & ~REPEATED_BYTE) == ZERO_DIGITS;
+}
+
+/**
+ * Converts 8 binary digits at once by multiplying every digit bit into
+ * its place in the highest byte.
+ */
+static inline auto convert_8_binary_digits(uint64_t word) -> uint64_t {
+    return ((word & REPEATED_BYTE) * 0x8040201008040201ull) >> 56;
+}
+
+/**
+ * Runs the 8 digit conversion over the digits, beginning with the
+ * remainder that doesn't fill a whole word.
+ */
+template<
+    int Base,
+    bool (*are_8_digits)(uint64_t),
+    uint64_t (*convert_8_digits)(uint64_t)
+>
+static inline auto parse_digits_by_8(char const *data, size_t count, uint64_t *value) -> IntegerLiteralStatus {
+    uint64_t result = 0;
+    size_t step = count % 8 != 0 ? count % 8 : 8;
+    for (size_t i = 0; i < count; i += step, step = 8) {
+        uint64_t word = load_digits(data + i, step);
+        if (!are_8_digits(word)) {
+            return IntegerLiteralStatus::INVALID_DIGIT;
+        }
+        uint64_t scale = Base == 10
+            ? POWERS_OF_10[step]
+            : uint64_t(1) << step;
+        if (__builtin_mul_overflow(result, scale, &result) ||
+            __builtin_add_overflow(result, convert_8_digits(word), &result)) {
+            return IntegerLiteralStatus::OVERFLOW;
+        }
+    }
+    *value = result;
+    return IntegerLiteralStatus::OK;
+}
+
+static inline auto hex_digit_value(char c) -> int {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    // Setting the 0x20 bit folds upper case letters to lower case
+    char lower = static_cast<char>(c | 0x20);
+    if (lower >= 'a' && lower <= 'f') {
+        return lower - 'a' + 10;
+    }
+    return -1;
+}
+
+/**
+ * Converts hexadecimal digits one at a time. There are at most 16 significant
+ * digits, each of which takes a single shift.
+ */
+static auto parse_hex_digits(char const *data, size_t count, uint64_t *value) -> IntegerLiteralStatus {
+    uint64_t result = 0;
+    for (size_t i = 0; i < count; i++) {
+        int digit = hex_digit_value(data[i]);
+        if (digit < 0) {
+            return IntegerLiteralStatus::INVALID_DIGIT;
+        }
+        if ((result >> 60) != 0) {
+            return IntegerLiteralStatus::OVERFLOW;
+        }
+        result = (result << 4) | static_cast<uint64_t>(digit);
+    }
+    *value = result;
+    return IntegerLiteralStatus::OK;
+}
+
+static auto parse_digits(char const *data, size_t count, int base, uint64_t *value) -> IntegerLiteralStatus {
+    switch (base) {
+        case 2:
+            return parse_digits_by_8<2, are_8_binary_digits, convert_8_binary_digits>(data, count, value);
+        case 16:
+            return parse_hex_digits(data, count, value);
+        default:
+            return parse_digits_by_8<10, are_8_decimal_digits, convert_8_decimal_digits>(data, count, value);
+    }
+}
+
+auto parse_integer_literal(char const *data, size_t length, uint64_t *value) -> IntegerLiteralStatus {
+    int base = 10;
+    if (length >= 2 && data[0] == '0') {
+        char prefix = static_cast<char>(data[1] | 0x20);
+        if (prefix == 'x' || prefix == 'b') {
+            base = prefix == 'x' ? 16 : 2;
+            data += 2;
+            length -= 2;
+        }
+    }
+    if (length == 0) {
+        return IntegerLiteralStatus::MISSING_DIGITS;
+    }
+
+    if (memchr(data, '_', length) == nullptr) {
+        return parse_digits(data, length, base, value);
+    }
+
+    // Separators can only be placed between digits
+    if (data[0] == '_' || data[length - 1] == '_') {
+        return IntegerLiteralStatus::MISPLACED_SEPARATOR;
+    }
+    // Drop the separators and leading zeros, so that the digits can be converted in one go
+    char digits[MAX_SIGNIFICANT_DIGITS];
+    size_t digit_count = 0;
+    for (size_t i = 0; i < length; i++) {
+        char c = data[i];
+        if (c == '_') {
+            if (data[i + 1] == '_') {
+                return IntegerLiteralStatus::MISPLACED_SEPARATOR;
+            }
+            continue;
+        }
+        if (c == '0' && digit_count == 0) {
+            continue;
+        }
+        if (digit_count == MAX_SIGNIFICANT_DIGITS) {
+            return IntegerLiteralStatus::OVERFLOW;
+        }
+        digits[digit_count++] = c;
+    }
+    return parse_digits(digits, digit_count, base, value);
+}
@@ -1,8 +1,9 @@
-#include <functional>
 #include <bloom/assert.h>
+#include <bloom/diagnostics.h>
+#include <bloom/grammar.h>
 #include <bloom/print.h>
-#include <bloom/ptr.h>
 #include <bloom/parsing.h>
+#include <bloom/threads.h>
 
 template<typename T, typename E>
 struct Result {
@@ -36,11 +37,27 @@ static inline auto is_ok(Result<T, E> const &result) -> bool {
 
 enum class ParseErrorCode {
     UNEXPECTED_TOKEN,
+    UNCLOSED_PARENTHESIS,
 };
 
+static auto to_string(ParseErrorCode code) -> char const* {
+    switch (code) {
+        case ParseErrorCode::UNEXPECTED_TOKEN: return "Unexpected token";
+        case ParseErrorCode::UNCLOSED_PARENTHESIS: return "Unclosed parenthesis";
+    }
+    return "Unknown error";
+}
+
 struct ParseError {
     ParseErrorCode code;
-    Token::Position position;
+    /**
+     * The type of the offending token.
+     */
+    TokenType token_type;
+    /**
+     * The source offset of the offending token.
+     */
+    uint32_t offset;
     size_t src_code_line;
 };
 
@@ -52,138 +69,6 @@ static inline auto to_array(AllocatedArrayBlock<PointerT> *block) -> Array<Point
     return Array<PointerT>(block->data, block->length);
 }
 
-template<typename ElementType>
-struct Iterator {
-    Array<ElementType> elements;
-    size_t current_index;
-};
-
-template<typename ElementType>
-static inline auto to_array(Iterator<ElementType> *iter) -> Array<ElementType> {
-    return Array<ElementType>(
-        iter->elements.data,
-        iter->current_index
-    );
-}
-
-template<typename ElementType>
-static inline auto to_iterator(AllocatedArrayBlock<ElementType> *block) -> Iterator<ElementType> {
-    return {
-        .elements = to_array(block),
-        .current_index = 0,
-    };
-}
-static inline auto to_iterator(Array<Token> *tokens) -> Iterator<Token> {
-    return {
-        .elements = *tokens,
-        .current_index = 0,
-    };
-}
-
-/**
- * Advances the iterator and sets the next element to the given value, and returns it.
- */
-template<typename ElementType>
-static auto iter_append(
-    Iterator<ElementType> *iter,
-    ElementType &&value
-) -> ElementType* {
-    auto next_elem = iter_next(iter);
-    *next_elem = value;
-    return next_elem;
-}
-
-template<typename ElementType>
-static auto iter_current(Iterator<ElementType> *iter) -> ElementType* {
-    return &iter->elements.data[iter->current_index];
-}
-
-/**
- * Peeks until the given condition is met, returning the index of the element that meets the condition.
- * If no such element is found, returns -1.
- */
-template<typename ElementType>
-static auto iter_get_index_at_if(
-    Iterator<ElementType> *iter,
-    std::function<bool(ElementType const*)> &&condition_fn
-) -> int64_t {
-    size_t start_index = iter->current_index;
-    for (size_t i = start_index; i < iter->elements.length; i++) {
-        if (condition_fn(&iter->elements.data[i])) {
-            return static_cast<int64_t>(i);
-        }
-    }
-    return -1;
-}
-
-/**
- * Advances the iterator and returns the next element.
- */
-template<typename ElementType>
-static auto iter_next(Iterator<ElementType> *iter) -> ElementType* {
-    assert (iter->elements.length > 0 &&
-        "Cannot advance iterator because the iterator length is 0.");
-    assertf(
-        iter->current_index < iter->elements.length,
-        "Iterator out of bounds while advancing to the next element:\n"
-        "\tElement type size: %\n"
-        "\tCurrent index: %\n"
-        "\tMax length: %",
-        sizeof(ElementType), iter->current_index, iter->elements.length
-    );
-    return &iter->elements.data[iter->current_index++];
-}
-
-/**
- * Peeks at the current element without advancing the iterator.
- */
-template<typename ElementType>
-static inline auto iter_peek(Iterator<ElementType> *iter) -> ElementType* {
-    assert(iter->current_index < iter->elements.length &&
-        "Iterator out of bounds while peeking");
-    return &iter->elements.data[iter->current_index];
-}
-
-/**
- * Peeks at the previous element without changing the iterator.
- */
-template<typename ElementType>
-static inline auto iter_peek_prev(Iterator<ElementType> *iter) -> ElementType* {
-    assert(iter->current_index > 0 &&
-        "Iterator out of bounds while peeking prev");
-    return &iter->elements.data[iter->current_index - 1];
-}
-
-/**
- * Creates a new iterator that is a slice of the given iterator from begin to end offsets.
- */
-template<typename ElementType>
-static auto iter_slice_by_offset(
-    Iterator<ElementType> *iter,
-    size_t begin,
-    int64_t end
-) -> Iterator<ElementType> {
-    // Copy the iterator
-    auto new_iter = *iter;
-    assert(end >= 0 && begin <= end && end <= iter->elements.length &&
-        "Slice end out of bounds");
-    new_iter.elements = slice_by_offset(&new_iter.elements, begin, static_cast<size_t>(end));
-    new_iter.current_index = 0;
-    return new_iter;
-}
-
-/**
- * Tries to advance the iterator and returns the next element.
- * If the next element is not found, null is returned.
- */
-template<typename ElementType>
-static auto iter_try_next(Iterator<ElementType> *iter) -> ElementType* {
-    if (iter->current_index >= iter->elements.length) {
-        return nullptr;
-    }
-    return &iter->elements.data[iter->current_index++];
-}
-
 template<typename ElementType>
 struct DynamicArray {
     ElementType *data;
@@ -213,88 +98,58 @@ static inline auto to_array(DynamicArray<T> *value) -> Array<T> {
 }
 
 struct Context {
-    Token *current_identifier = nullptr;
-    ASTNode *current_proc_node = nullptr;
+    /**
+     * Copy of the identifier token that is being defined. It is copied, because
+     * the token stream window moves past the token while parsing the definition.
+     */
+    Token current_identifier = {};
+    NodeId current_proc_node = NODE_NONE;
     bool in_proc_definition = false;
-    AllocatedArrayBlock<ASTNode> *nodes_block;
 };
 
 // For debugging purposes
 static auto print_value(FILE *file, Context *context) -> void {
-    auto *current_identifier = static_cast<void*>(context->current_identifier);
-    auto *current_proc_node = static_cast<void*>(context->current_proc_node);
+    auto *current_identifier = &context->current_identifier.identifier.content;
+    auto current_proc_node = static_cast<unsigned>(context->current_proc_node);
     char const *in_proc_definition = context->in_proc_definition ? "true" : "false";
     fprintf(
         _bloom_test_get_file(file),
-        "{current_identifier=%p, current_proc_node=%p, in_proc_definition=%s}",
-        current_identifier, current_proc_node, in_proc_definition
+        "{current_identifier=%.*s, current_proc_node=%u, in_proc_definition=%s}",
+        static_cast<int>(current_identifier->length), current_identifier->data,
+        current_proc_node, in_proc_definition
     );
 }
 
 /**
- * Parses procedure call parameters and appends them to the given procedure call AST node.
- * 
- * @return true on success, false on failure.
+ * Returns the span of the given content, which must be a part of the source.
  */
-static auto parse_proc_call_arguments(
-    Iterator<Token> *tokens_iter,
-    ASTNode *proc_call_node,
-    Iterator<ASTNode> *nodes_block_iter,
-    DynamicArray<ParseError> *errors
-) -> bool {
-    assert(proc_call_node->type == ASTNodeType::PROC_CALL &&
-        "Procedure call node should be of PROC_CALL type after parsing arguments");
-
-    size_t proc_call_nodes_begin_index = nodes_block_iter->current_index;
-    Token *next_token;
-    while(true) {
-        next_token = iter_try_next(tokens_iter);
-        if (next_token == nullptr) {
-            break;
-        }
-        assert(next_token->type != TokenType::PARENTHESIS_CLOSE &&
-            "Unexpected closing parenthesis while parsing procedure call arguments. "
-            "Closing parenthesis should have been handled by the caller function."
-        );
-        if (next_token->type == TokenType::COMMA) {
-            continue;
-        }
-        // TODO: Hardcoded argument parsing for now, fix later
-        else if (next_token->type == TokenType::IDENTIFIER) {
-            (void)iter_append(nodes_block_iter, ASTNode {
-                .type = ASTNodeType::IDENTIFIER,
-                .parent = proc_call_node,
-                .identifier = next_token->identifier.content,
-            });
-        }
-        else if (next_token->type == TokenType::STRING_LITERAL) {
-            (void)iter_append(nodes_block_iter, ASTNode {
-                .type = ASTNodeType::STRING_LITERAL,
-                .parent = proc_call_node,
-                .string_literal = {
-                    .value = next_token->string_literal.content,
-                },
-            });
-        }
-        else {
-            append(errors, ParseError {
-                .code = ParseErrorCode::UNEXPECTED_TOKEN,
-                .position = next_token->position,
-                .src_code_line = __LINE__,
-            });
-            return false;
-        }
-    }
-
-    // Set the arguments array for the procedure call node to include all parsed arguments
-    proc_call_node->proc_call.arguments = to_array(nodes_block_iter);
-    proc_call_node->proc_call.arguments = slice_by_offset(
-        &proc_call_node->proc_call.arguments,
-        proc_call_nodes_begin_index,
-        nodes_block_iter->current_index
-    );
+static inline auto to_source_span(String const *source, String const *content) -> SourceSpan {
+    return SourceSpan {
+        .offset = static_cast<uint32_t>(content->data - source->data),
+        .length = static_cast<uint32_t>(content->length),
+    };
+}
 
-    return true;
+/**
+ * Appends a node to the AST, and its payload to the given payload array of its kind.
+ * @return The ID of the appended node.
+ */
+template<typename PayloadType>
+static auto append_node(
+    AST *ast,
+    ASTNodeType kind,
+    NodeId parent,
+    SegmentedArray<PayloadType> *kind_payloads,
+    PayloadType const &payload
+) -> NodeId {
+    auto node = static_cast<NodeId>(ast_node_count(ast));
+    (void)segmented_array_append(ast->kinds, kind);
+    (void)segmented_array_append(ast->parents, parent);
+    // The subtree sizes are known once parsing has finished
+    (void)segmented_array_append(ast->subtree_sizes, 1u);
+    (void)segmented_array_append(ast->payloads, static_cast<uint32_t>(kind_payloads->length));
+    (void)segmented_array_append(kind_payloads, payload);
+    return node;
 }
 
 /**
@@ -305,24 +160,23 @@ static auto parse_proc_call_arguments(
  * @return true on success, false on failure.
  */
 static auto parse_proc_params(
-    Iterator<Token> *tokens_iter,
-    Iterator<ProcParameterASTNode> *proc_params_iter,
+    TokenStream *tokens,
+    AST *ast,
     DynamicArray<ParseError> *errors
 ) -> bool {
-    assert(proc_params_iter != nullptr &&
-        "Procedure parameters iterator should not be null in proc definition context");
 
-    Token *current_token = iter_next(tokens_iter);
+    Token *current_token = stream_next(tokens);
     if (current_token->type != TokenType::PARENTHESIS_OPEN) {
         append(errors, ParseError {
             .code = ParseErrorCode::UNEXPECTED_TOKEN,
-            .position = current_token->position,
+            .token_type = current_token->type,
+            .offset = current_token->offset,
             .src_code_line = __LINE__,
         });
         return false;
     }
     while(true) {
-        current_token = iter_next(tokens_iter);
+        current_token = stream_next(tokens);
         switch (current_token->type) {
             case TokenType::PARENTHESIS_CLOSE:
                 return true;
@@ -330,30 +184,47 @@ static auto parse_proc_params(
                 // Just skip commas
                 continue;
             case TokenType::IDENTIFIER: {
-                (void)iter_append(proc_params_iter, ProcParameterASTNode {
-                    .name = current_token->identifier.content
-                });
-
+                Token name_token = *current_token;
                 if (
-                    auto next_token = iter_next(tokens_iter);
+                    auto next_token = stream_next(tokens);
                     next_token->type != TokenType::TYPE_SEPARATOR
                 ) {
                     append(errors, ParseError {
                         .code = ParseErrorCode::UNEXPECTED_TOKEN,
-                        .position = iter_current(tokens_iter)->position,
+                        .token_type = next_token->type,
+                        .offset = next_token->offset,
                         .src_code_line = __LINE__,
                     });
                     return false;
                 }
 
-                // TODO: Skip the type token for now but deal with it later
-                (void)iter_next(tokens_iter);
+                auto *type_token = stream_next(tokens);
+                if (type_token->type != TokenType::IDENTIFIER) {
+                    append(errors, ParseError {
+                        .code = ParseErrorCode::UNEXPECTED_TOKEN,
+                        .token_type = type_token->type,
+                        .offset = type_token->offset,
+                        .src_code_line = __LINE__,
+                    });
+                    return false;
+                }
+                auto type = static_cast<TypeId>(ast->types->length);
+                (void)segmented_array_append(ast->types, TypeASTNode {
+                    .name = to_source_span(&tokens->source, &type_token->identifier.content),
+                    .symbol = type_token->identifier.symbol,
+                });
+                (void)segmented_array_append(ast->proc_params, ProcParameterASTNode {
+                    .name = to_source_span(&tokens->source, &name_token.identifier.content),
+                    .symbol = name_token.identifier.symbol,
+                    .type = type,
+                });
                 break;
             }
             default:
                 append(errors, ParseError {
                     .code = ParseErrorCode::UNEXPECTED_TOKEN,
-                    .position = current_token->position,
+                    .token_type = current_token->type,
+                    .offset = current_token->offset,
                     .src_code_line = __LINE__,
                 });
                 return false;
@@ -366,392 +237,1137 @@ static auto parse_proc_params(
 }
 
 static auto parse_statement(
-    Iterator<Token> *tokens_iter,
+    TokenStream *tokens,
     Context *context,
-    Iterator<ASTNode> *nodes_block_iter,
-    ASTNode *parent_node,
-    AllocatedArrayBlock<ProcParameterASTNode> *proc_params_block,
-    Iterator<ProcParameterASTNode> *proc_params_iter,
-    Iterator<TypeASTNode> *types_iter,
+    AST *ast,
+    NodeId parent_node,
     DynamicArray<ParseError> *errors
 ) -> bool;
 
 #define PARSE_ERROR_CREATE(error_code, token) \
-    ParseError { .code = ParseErrorCode::error_code, .position = token->position, .src_code_line = __LINE__ }
+    ParseError { \
+        .code = ParseErrorCode::error_code, \
+        .token_type = token->type, \
+        .offset = token->offset, \
+        .src_code_line = __LINE__ \
+    }
+
+/**
+ * Appends an op to the op array of the AST, with the offset of the token that created it.
+ * @return The size of the subexpression that ends at the op.
+ */
+static inline auto append_op(AST *ast, uint32_t offset, ExpressionOp op) -> uint32_t {
+    (void)segmented_array_append(ast->expression_ops, op);
+    (void)segmented_array_append(ast->expression_op_offsets, offset);
+    return op.size;
+}
+
+static auto parse_expression_ops(
+    TokenStream *tokens,
+    AST *ast,
+    uint8_t min_precedence
+) -> Result<uint32_t, ParseError>;
 
 static auto parse_expression(
-    Iterator<Token> *tokens_iter,
+    TokenStream *tokens,
     Context *context,
-    Iterator<ASTNode> *nodes_block_iter,
-    AllocatedArrayBlock<ProcParameterASTNode> *proc_params_block,
-    Iterator<ProcParameterASTNode> *proc_params_iter,
-    Iterator<TypeASTNode> *types_iter,
+    AST *ast,
+    NodeId parent_node,
     DynamicArray<ParseError> *errors
-) -> Result<ASTNode, ParseError> {
-    auto next_token = iter_next(tokens_iter);
-    assert(next_token != nullptr &&
-        "Next token should not be null when parsing an expression");
-    switch(next_token->type) {
-        case TokenType::INTEGER_LITERAL: {
-            return ok<ASTNode, ParseError>(ASTNode {
-                .type = ASTNodeType::INTEGER_LITERAL,
-                .parent = nullptr,
-                .integer_literal = {
-                    .value = IntegerLiteralASTNode {
-                        .value = next_token->integer_literal.value,
-                    },
-                },
-            });
-        }
-        case TokenType::KEYWORD_PROC: {
-            // Expect procedure definition
+) -> Result<NodeId, ParseError>;
+
+/**
+ * Returns the error for a token that should have closed the given parenthesis.
+ */
+static auto parenthesis_close_error(Token const *open_paren_token, Token const *token) -> ParseError {
+    // A statement can't continue on the next line, so the parenthesis is never closed
+    if (token->type == TokenType::NEWLINE || token->type == TokenType::END) {
+        return PARSE_ERROR_CREATE(UNCLOSED_PARENTHESIS, open_paren_token);
+    }
+    return PARSE_ERROR_CREATE(UNEXPECTED_TOKEN, token);
+}
+
+/**
+ * A handler of an action, which the dispatch table of a parser state calls
+ * for the tokens that select the action.
+ */
+template<typename Handler>
+struct ActionHandler {
+    ParseAction action;
+    Handler handler;
+};
 
-            // Parse procedure parameters
-            if (!parse_proc_params(tokens_iter, proc_params_iter, errors)) {
-                return err<ASTNode, ParseError>(PARSE_ERROR_CREATE(UNEXPECTED_TOKEN, next_token));
+template<typename Handler>
+struct DispatchEntry {
+    Handler handler;
+    GrammarRule rule;
+};
+
+/**
+ * The handler and the rule of every token type in a parser state, built at
+ * compile time from the parse table, so dispatching on a token is a single
+ * indexed load and an indirect call.
+ */
+template<typename Handler>
+struct DispatchTable {
+    DispatchEntry<Handler> entries[TOKEN_TYPE_COUNT];
+    /**
+     * Set if every action of the state has a handler.
+     */
+    bool is_complete;
+
+    template<size_t HANDLER_COUNT>
+    constexpr DispatchTable(ParserState state, ActionHandler<Handler> const (&handlers)[HANDLER_COUNT]) :
+        entries(), is_complete(true)
+    {
+        for (size_t type = 0; type < TOKEN_TYPE_COUNT; type++) {
+            auto const &rule = PARSE_TABLE.rules[static_cast<size_t>(state)][type];
+            bool has_handler = false;
+            for (auto const &action_handler : handlers) {
+                if (action_handler.action == rule.action) {
+                    entries[type] = DispatchEntry<Handler> {
+                        .handler = action_handler.handler,
+                        .rule = rule,
+                    };
+                    has_handler = true;
+                }
             }
+            is_complete = is_complete && has_handler;
+        }
+    }
+
+    inline auto operator[](TokenType type) const -> DispatchEntry<Handler> const& {
+        return entries[static_cast<size_t>(type)];
+    }
+};
 
-            // Parse procedure return type (if there is one)
-            // - If the procedure params are followed by an arrow token immediately,
-            //   then there is no return type.
-            // - If the procedure params are followed by an identifier token before the
-            //   arrow token, then that identifier token is the return type.
-            Token *proc_return_type_token = iter_next(tokens_iter);
-            TypeASTNode *return_type_node = nullptr;
-            if (proc_return_type_token->type == TokenType::ARROW) {
-                // Unneccessary, but for clarity
-                // return_type_node = nullptr;
+/**
+ * Parses an operand that begins with the given token, which has been consumed already.
+ * @return The size of the operand subexpression.
+ */
+using OperandHandler = auto (*)(TokenStream *tokens, AST *ast, Token const *token) -> Result<uint32_t, ParseError>;
+/**
+ * Parses the rest of an operator whose token has been consumed already, and appends it after
+ * its left operand.
+ * @return The size of the operation subexpression.
+ */
+using OperatorHandler = auto (*)(
+    TokenStream *tokens,
+    AST *ast,
+    GrammarRule const *rule,
+    uint32_t left_size
+) -> Result<uint32_t, ParseError>;
+/**
+ * Parses a statement or a value into a node, which is appended to the AST with the given parent.
+ */
+using NodeHandler = auto (*)(
+    TokenStream *tokens,
+    Context *context,
+    AST *ast,
+    NodeId parent_node,
+    DynamicArray<ParseError> *errors
+) -> Result<NodeId, ParseError>;
+
+static auto parse_identifier_operand(TokenStream *tokens, AST *ast, Token const *token) -> Result<uint32_t, ParseError> {
+    return ok<uint32_t, ParseError>(append_op(ast, token->offset, ExpressionOp {
+        .kind = ExpressionOpKind::IDENTIFIER,
+        .size = 1,
+        .span = to_source_span(&tokens->source, &token->identifier.content),
+    }));
+}
+
+static auto parse_integer_literal_operand(TokenStream *tokens, AST *ast, Token const *token) -> Result<uint32_t, ParseError> {
+    (void)tokens;
+    return ok<uint32_t, ParseError>(append_op(ast, token->offset, ExpressionOp {
+        .kind = ExpressionOpKind::INTEGER_LITERAL,
+        .is_unsigned = token->integer_literal.is_unsigned,
+        .size = 1,
+        .integer_value = token->integer_literal.uvalue,
+    }));
+}
+
+static auto parse_string_literal_operand(TokenStream *tokens, AST *ast, Token const *token) -> Result<uint32_t, ParseError> {
+    return ok<uint32_t, ParseError>(append_op(ast, token->offset, ExpressionOp {
+        .kind = ExpressionOpKind::STRING_LITERAL,
+        .has_escapes = token->string_literal.has_escapes,
+        .size = 1,
+        .span = to_source_span(&tokens->source, &token->string_literal.content),
+    }));
+}
+
+static auto parse_group_operand(TokenStream *tokens, AST *ast, Token const *token) -> Result<uint32_t, ParseError> {
+    Token open_paren_token = *token;
+    if (stream_prev_paren_is_unmatched(tokens)) {
+        return err<uint32_t, ParseError>(PARSE_ERROR_CREATE(UNCLOSED_PARENTHESIS, (&open_paren_token)));
+    }
+    // The parentheses only group, so they don't need an op
+    auto inner_result = parse_expression_ops(tokens, ast, LOWEST_PRECEDENCE);
+    if (!is_ok(inner_result)) {
+        return inner_result;
+    }
+    if (
+        auto *close_paren_token = stream_next(tokens);
+        close_paren_token->type != TokenType::PARENTHESIS_CLOSE
+    ) {
+        return err<uint32_t, ParseError>(parenthesis_close_error(&open_paren_token, close_paren_token));
+    }
+    return inner_result;
+}
+
+static auto parse_negate_operand(TokenStream *tokens, AST *ast, Token const *token) -> Result<uint32_t, ParseError> {
+    uint32_t offset = token->offset;
+    auto operand_result = parse_expression_ops(tokens, ast, PREFIX_PRECEDENCE);
+    if (!is_ok(operand_result)) {
+        return operand_result;
+    }
+    return ok<uint32_t, ParseError>(append_op(ast, offset, ExpressionOp {
+        .kind = ExpressionOpKind::NEGATE,
+        .size = operand_result.ok + 1,
+    }));
+}
+
+static auto parse_unexpected_operand(TokenStream *tokens, AST *ast, Token const *token) -> Result<uint32_t, ParseError> {
+    (void)tokens;
+    (void)ast;
+    return err<uint32_t, ParseError>(PARSE_ERROR_CREATE(UNEXPECTED_TOKEN, token));
+}
+
+static auto parse_binary_operator(
+    TokenStream *tokens,
+    AST *ast,
+    GrammarRule const *rule,
+    uint32_t left_size
+) -> Result<uint32_t, ParseError> {
+    uint32_t offset = stream_prev(tokens)->offset;
+    // The right operand only takes tighter operators, which makes the operator left-associative
+    auto right_result = parse_expression_ops(tokens, ast, rule->precedence + 1);
+    if (!is_ok(right_result)) {
+        return right_result;
+    }
+    return ok<uint32_t, ParseError>(append_op(ast, offset, ExpressionOp {
+        .kind = rule->op_kind,
+        .size = left_size + right_result.ok + 1,
+    }));
+}
+
+/**
+ * Parses the arguments of a call, which begin after the opening parenthesis token,
+ * and appends the CALL op after them. The callee has been appended already.
+ */
+static auto parse_call(
+    TokenStream *tokens,
+    AST *ast,
+    GrammarRule const *rule,
+    uint32_t callee_size
+) -> Result<uint32_t, ParseError> {
+    (void)rule;
+    Token open_paren_token = *stream_prev(tokens);
+    // A store-backed stream knows upfront whether the call is closed
+    // on the same line, so no arguments are parsed in vain
+    if (stream_prev_paren_is_unmatched(tokens)) {
+        return err<uint32_t, ParseError>(PARSE_ERROR_CREATE(UNCLOSED_PARENTHESIS, (&open_paren_token)));
+    }
+
+    uint32_t size = callee_size;
+    uint32_t argument_count = 0;
+    if (stream_peek(tokens)->type == TokenType::PARENTHESIS_CLOSE) {
+        (void)stream_next(tokens);
+    }
+    else {
+        while (true) {
+            auto argument_result = parse_expression_ops(tokens, ast, LOWEST_PRECEDENCE);
+            if (!is_ok(argument_result)) {
+                return argument_result;
             }
-            else if (proc_return_type_token->type == TokenType::IDENTIFIER) {
-                if (
-                    auto next_token = iter_next(tokens_iter);
-                    next_token->type != TokenType::ARROW
-                ) {
-                    return err<ASTNode, ParseError>(PARSE_ERROR_CREATE(UNEXPECTED_TOKEN, next_token));
-                }
+            size += argument_result.ok;
+            argument_count++;
 
-                return_type_node = iter_append(types_iter, TypeASTNode {
-                    .name = proc_return_type_token->identifier.content,
-                });
+            auto *separator_token = stream_next(tokens);
+            if (separator_token->type == TokenType::PARENTHESIS_CLOSE) {
+                break;
             }
-            if (
-                auto next_token = iter_next(tokens_iter);
-                next_token->type != TokenType::NEWLINE
-            ) {
-                return err<ASTNode, ParseError>(PARSE_ERROR_CREATE(UNEXPECTED_TOKEN, next_token));
+            if (separator_token->type != TokenType::COMMA) {
+                return err<uint32_t, ParseError>(parenthesis_close_error(&open_paren_token, separator_token));
             }
+        }
+    }
 
-            auto proc_node = iter_append(nodes_block_iter, ASTNode {
-                .type = ASTNodeType::PROC_DEF,
-                .parent = nullptr,
-                .proc_def = {
-                    .name = context->current_identifier->identifier.content,
-                    .parameters = Array<ProcParameterASTNode>(
-                        proc_params_block->data,
-                        proc_params_iter->current_index
-                    ),
-                    .return_type = return_type_node,
-                    .body = Array<ASTNode>(
-                        context->nodes_block->data + nodes_block_iter->current_index,
-                        0 // Will be updated later
-                    ),
-                },
-            });
+    return ok<uint32_t, ParseError>(append_op(ast, open_paren_token.offset, ExpressionOp {
+        .kind = ExpressionOpKind::CALL,
+        .size = size + 1,
+        .argument_count = argument_count,
+    }));
+}
 
-            // Parse procedure body
-            // - Expect each line to be indented and contain a single statement
-            while(true) {
-                // If the line doesn't begin with an indent token, the procedure body has ended
-                if (iter_peek(tokens_iter)->type != TokenType::INDENT) {
-                    break;
-                }
-                (void)iter_next(tokens_iter); // Consume the indent token
-                
-                if (!parse_statement(
-                    tokens_iter,
-                    context,
-                    nodes_block_iter,
-                    proc_node,
-                    proc_params_block,
-                    proc_params_iter,
-                    types_iter,
-                    errors
-                )) {
-                    return err<ASTNode, ParseError>(
-                        PARSE_ERROR_CREATE(UNEXPECTED_TOKEN, iter_peek_prev(tokens_iter))
-                    );
-                }
-                
-                print("Finished parsing procedure body statement, current token: %\n", to_string(iter_current(tokens_iter)->type));
-                // Now, at the end of a statement, the previous token
-                // should be either a newline or an end token
-                #if ASSERTIONS_ENABLED
-                    auto *prev_token = iter_peek_prev(tokens_iter);
-                    auto prev_token_str = to_string(prev_token->type);
-                    assertf(
-                        (prev_token->type == TokenType::NEWLINE ||
-                        prev_token->type == TokenType::END),
-                        "Expected newline or end token after procedure body statement, but got % at %:%\n",
-                        prev_token_str,
-                        prev_token->position.line,
-                        prev_token->position.col
-                    );
-                #endif // ASSERTIONS_ENABLED
-            }
+constexpr ActionHandler<OperandHandler> OPERAND_HANDLERS[] = {
+    { ParseAction::GROUP,              parse_group_operand },
+    { ParseAction::IDENTIFIER,         parse_identifier_operand },
+    { ParseAction::INTEGER_LITERAL,    parse_integer_literal_operand },
+    { ParseAction::NEGATE,             parse_negate_operand },
+    { ParseAction::STRING_LITERAL,     parse_string_literal_operand },
+    { ParseAction::UNEXPECTED_OPERAND, parse_unexpected_operand },
+};
+constexpr DispatchTable<OperandHandler> OPERAND_TABLE(ParserState::OPERAND, OPERAND_HANDLERS);
+static_assert(OPERAND_TABLE.is_complete, "Every operand action needs a handler");
+
+constexpr ActionHandler<OperatorHandler> OPERATOR_HANDLERS[] = {
+    { ParseAction::BINARY_OPERATOR, parse_binary_operator },
+    { ParseAction::CALL,            parse_call },
+    // Never called, as the precedence of the rule ends the expression
+    { ParseAction::NO_OPERATOR,     nullptr },
+};
+constexpr DispatchTable<OperatorHandler> OPERATOR_TABLE(ParserState::OPERATOR, OPERATOR_HANDLERS);
+static_assert(OPERATOR_TABLE.is_complete, "Every operator action needs a handler");
 
-            // Update the procedure body length so that it includes all parsed body statements
-            proc_node->proc_def.body.length =
-                nodes_block_iter->current_index
-                - ptr_sub(
-                    nodes_block_iter->elements.data,
-                    proc_node->proc_def.body.data
-                );
-
-            assert(proc_node->proc_def.body.length > 0 &&
-                "Procedure body should contain at least one statement");
-            assert(
-                nodes_block_iter->elements[proc_node->proc_def.body.length].type == ASTNodeType::UNKNOWN &&
-                "Next node after procedure body should be of UNKNOWN type");
-            return ok<ASTNode, ParseError>(*proc_node);
+/**
+ * Parses an expression by precedence climbing and appends its ops to the AST in
+ * postfix order. Only operators that bind at least as tightly as the given
+ * precedence are parsed, so the expression ends before the first looser operator.
+ *
+ * @return The size of the expression.
+ */
+static auto parse_expression_ops(
+    TokenStream *tokens,
+    AST *ast,
+    uint8_t min_precedence
+) -> Result<uint32_t, ParseError> {
+    auto *token = stream_next(tokens);
+    auto left_result = OPERAND_TABLE[token->type].handler(tokens, ast, token);
+    if (!is_ok(left_result)) {
+        return left_result;
+    }
+    uint32_t size = left_result.ok;
+    while (true) {
+        auto const &entry = OPERATOR_TABLE[stream_peek(tokens)->type];
+        // Tokens that aren't operators have a precedence of 0, which is below any minimum
+        if (entry.rule.precedence < min_precedence) {
+            break;
+        }
+        (void)stream_next(tokens);
+        auto operation_result = entry.handler(tokens, ast, &entry.rule, size);
+        if (!is_ok(operation_result)) {
+            return operation_result;
         }
-        default:
-            return err<ASTNode, ParseError>(PARSE_ERROR_CREATE(UNEXPECTED_TOKEN, next_token));
+        size = operation_result.ok;
     }
+    return ok<uint32_t, ParseError>(size);
 }
 
-static auto parse_statement(
-    Iterator<Token> *tokens_iter,
+/**
+ * Parses an expression into an EXPRESSION node, which is appended to the AST with the given parent.
+ */
+static auto parse_expression_node(
+    TokenStream *tokens,
     Context *context,
-    Iterator<ASTNode> *nodes_block_iter,
-    ASTNode *parent_node,
-    AllocatedArrayBlock<ProcParameterASTNode> *proc_params_block,
-    Iterator<ProcParameterASTNode> *proc_params_iter,
-    Iterator<TypeASTNode> *types_iter,
+    AST *ast,
+    NodeId parent_node,
     DynamicArray<ParseError> *errors
-) -> bool {
-    if (auto *next_token = iter_next(tokens_iter); next_token->type == TokenType::IDENTIFIER) {
-        switch (auto peeked_token = iter_peek(tokens_iter); peeked_token->type) {
-            case TokenType::PARENTHESIS_OPEN: {
-                // Expect a procedure call
-
-                int64_t proc_call_end_token_index = iter_get_index_at_if<Token>(
-                    tokens_iter, [](auto *token) {
-                        return token->type == TokenType::PARENTHESIS_CLOSE;
-                    }
-                );
-                auto proc_call_arg_tokens_iter = iter_slice_by_offset(
-                    tokens_iter,
-                    tokens_iter->current_index + 1,
-                    proc_call_end_token_index
-                );
-
-                auto *proc_call_node = iter_append(nodes_block_iter, ASTNode {
-                    .type = ASTNodeType::PROC_CALL,
-                    .parent = parent_node,
-                    .proc_call = {
-                        .caller_identifier = next_token->identifier.content,
-                    },
-                });
-                bool proc_call_args_parsed_ok = parse_proc_call_arguments(
-                    &proc_call_arg_tokens_iter,
-                    proc_call_node,
-                    nodes_block_iter,
-                    errors
-                );
-                if (!proc_call_args_parsed_ok) {
-                    // TODO: Append a better error
-                    append(errors, PARSE_ERROR_CREATE(UNEXPECTED_TOKEN, iter_current(tokens_iter)));
-                    return false;
-                }
+) -> Result<NodeId, ParseError> {
+    (void)context;
+    (void)errors;
+    auto first_op = static_cast<uint32_t>(ast->expression_ops->length);
+    auto ops_result = parse_expression_ops(tokens, ast, LOWEST_PRECEDENCE);
+    if (!is_ok(ops_result)) {
+        return err<NodeId, ParseError>(ops_result.err);
+    }
+    assert(ops_result.ok == ast->expression_ops->length - first_op &&
+        "Expression size should match the number of its ops");
+    return ok<NodeId, ParseError>(append_node(ast, ASTNodeType::EXPRESSION, parent_node, ast->expressions,
+        ExpressionASTNode {
+            .first_op = first_op,
+            .op_count = ops_result.ok,
+        }));
+}
 
-                tokens_iter->current_index = proc_call_end_token_index + 1; // Skip the closing parenthesis token
-                assert(iter_peek_prev(tokens_iter)->type == TokenType::PARENTHESIS_CLOSE &&
-                    "Expected closing parenthesis token after parsing procedure call arguments");
+/**
+ * Parses a procedure definition into a node, which is appended to the AST with the given parent.
+ */
+static auto parse_proc_definition(
+    TokenStream *tokens,
+    Context *context,
+    AST *ast,
+    NodeId parent_node,
+    DynamicArray<ParseError> *errors
+) -> Result<NodeId, ParseError> {
+    // Expect procedure definition
+    Token proc_token = *stream_next(tokens);
+
+    // Parse procedure parameters
+    auto proc_params_begin_index = static_cast<uint32_t>(ast->proc_params->length);
+    if (!parse_proc_params(tokens, ast, errors)) {
+        return err<NodeId, ParseError>(PARSE_ERROR_CREATE(UNEXPECTED_TOKEN, (&proc_token)));
+    }
 
-                // Consume the newline or end token
-                assert(
-                    iter_current(tokens_iter)->type == TokenType::NEWLINE ||
-                    iter_current(tokens_iter)->type == TokenType::END &&
-                    "Expected newline or end token after variable definition");
-                (void)iter_next(tokens_iter);
-                break;
-            }
-            case TokenType::VAR_DEF: {
-                (void)iter_next(tokens_iter); // Consume VAR_DEF token
-    
-                // Expect a variable definition
-    
-                // Find the end of the statement to create a sub-iterator for the expression
-                // (do not consume tokens in the main iterator yet)
-                int64_t expr_end_token_index = iter_get_index_at_if<Token>(
-                    tokens_iter, [](auto *token) {
-                        return token->type == TokenType::NEWLINE || token->type == TokenType::END;
-                    }
-                );
-                if (expr_end_token_index == -1) {
-                    append(errors, PARSE_ERROR_CREATE(UNEXPECTED_TOKEN, iter_current(tokens_iter)));
-                    return false;
-                }
-                auto expr_tokens_iter = iter_slice_by_offset(
-                    tokens_iter,
-                    tokens_iter->current_index,
-                    expr_end_token_index
-                );
-                if (expr_tokens_iter.elements.length == 0) {
-                    append(errors, PARSE_ERROR_CREATE(UNEXPECTED_TOKEN, iter_current(tokens_iter)));
-                    return false;
-                }
-    
-                // Parse the expression for the variable definition
-                auto expr_parse_result = parse_expression(
-                    &expr_tokens_iter,
-                    context,
-                    nodes_block_iter,
-                    proc_params_block,
-                    proc_params_iter,
-                    types_iter,
-                    errors
-                );
-                if (!is_ok(expr_parse_result)) {
-                    append(errors, expr_parse_result.err);
-                    return false;
-                }
-                auto expr_node = expr_parse_result.ok;
-                (void)iter_append(nodes_block_iter, ASTNode {
-                    .type = ASTNodeType::VARIABLE_DEFINITION,
-                    .parent = parent_node,
-                    .variable_definition = {
-                        .name = next_token->identifier.content,
-                        .value = expr_node.integer_literal.value,
-                    },
-                });
-                
-                tokens_iter->current_index += expr_tokens_iter.current_index;
-    
-                // Consume the newline or end token
-                assert(
-                    iter_current(tokens_iter)->type == TokenType::NEWLINE ||
-                    iter_current(tokens_iter)->type == TokenType::END &&
-                    "Expected newline or end token after variable definition");
-                (void)iter_next(tokens_iter);
-                break;
-            }
+    // Parse procedure return type (if there is one)
+    // - If the procedure params are followed by an arrow token immediately,
+    //   then there is no return type.
+    // - If the procedure params are followed by an identifier token before the
+    //   arrow token, then that identifier token is the return type.
+    Token proc_return_type_token = *stream_next(tokens);
+    TypeId return_type = TYPE_NONE;
+    if (proc_return_type_token.type == TokenType::ARROW) {
+        // Unneccessary, but for clarity
+        // return_type = TYPE_NONE;
+    }
+    else if (proc_return_type_token.type == TokenType::IDENTIFIER) {
+        if (
+            auto next_token = stream_next(tokens);
+            next_token->type != TokenType::ARROW
+        ) {
+            return err<NodeId, ParseError>(PARSE_ERROR_CREATE(UNEXPECTED_TOKEN, next_token));
         }
+
+        return_type = static_cast<TypeId>(ast->types->length);
+        (void)segmented_array_append(ast->types, TypeASTNode {
+            .name = to_source_span(&tokens->source, &proc_return_type_token.identifier.content),
+            .symbol = proc_return_type_token.identifier.symbol,
+        });
+    }
+    if (
+        auto next_token = stream_next(tokens);
+        next_token->type != TokenType::NEWLINE
+    ) {
+        return err<NodeId, ParseError>(PARSE_ERROR_CREATE(UNEXPECTED_TOKEN, next_token));
+    }
+
+    auto proc_node = append_node(ast, ASTNodeType::PROC_DEF, parent_node, ast->proc_defs,
+        ProcDefASTNode {
+            .name = to_source_span(&tokens->source, &context->current_identifier.identifier.content),
+            .symbol = context->current_identifier.identifier.symbol,
+            .first_parameter = proc_params_begin_index,
+            .parameter_count = static_cast<uint32_t>(ast->proc_params->length - proc_params_begin_index),
+            .return_type = return_type,
+        });
+
+    // Parse procedure body
+    // - Expect each line to be indented and contain a single statement
+    while(true) {
+        // If the line doesn't begin with an indent token, the procedure body has ended
+        if (stream_peek(tokens)->type != TokenType::INDENT) {
+            break;
+        }
+        (void)stream_next(tokens); // Consume the indent token
+        
+        if (!parse_statement(tokens, context, ast, proc_node, errors)) {
+            return err<NodeId, ParseError>(
+                PARSE_ERROR_CREATE(UNEXPECTED_TOKEN, stream_prev(tokens))
+            );
+        }
+        
+        // Now, at the end of a statement, the previous token
+        // should be either a newline or an end token
+        #if ASSERTIONS_ENABLED
+            auto *prev_token = stream_prev(tokens);
+            auto prev_token_str = to_string(prev_token->type);
+            assertf(
+                (prev_token->type == TokenType::NEWLINE ||
+                prev_token->type == TokenType::END),
+                "Expected newline or end token after procedure body statement, but got % at offset %\n",
+                prev_token_str,
+                static_cast<size_t>(prev_token->offset)
+            );
+        #endif // ASSERTIONS_ENABLED
+    }
+
+    return ok<NodeId, ParseError>(proc_node);
+}
+
+/**
+ * Parses a statement that begins with an identifier, which is either a variable
+ * definition or an expression.
+ */
+static auto parse_identifier_statement(
+    TokenStream *tokens,
+    Context *context,
+    AST *ast,
+    NodeId parent_node,
+    DynamicArray<ParseError> *errors
+) -> Result<NodeId, ParseError> {
+    if (stream_peek(tokens, 1)->type != TokenType::VAR_DEF) {
+        return parse_expression_node(tokens, context, ast, parent_node, errors);
+    }
+    // Expect a variable definition
+    // - The definition node is appended first, so that it precedes its value
+    Token name_token = *stream_next(tokens);
+    (void)stream_next(tokens); // Consume the VAR_DEF token
+    auto variable_definition_node = append_node(
+        ast,
+        ASTNodeType::VARIABLE_DEFINITION,
+        parent_node,
+        ast->variable_definitions,
+        VariableDefinitionASTNode {
+            .name = to_source_span(&tokens->source, &name_token.identifier.content),
+            .symbol = name_token.identifier.symbol,
+            .value = NODE_NONE,
+        }
+    );
+
+    // Parse the expression for the variable definition
+    auto expr_parse_result = parse_expression(
+        tokens,
+        context,
+        ast,
+        variable_definition_node,
+        errors
+    );
+    if (!is_ok(expr_parse_result)) {
+        return expr_parse_result;
+    }
+    ast_variable_definition(ast, variable_definition_node)->value = expr_parse_result.ok;
+    return ok<NodeId, ParseError>(variable_definition_node);
+}
+
+constexpr ActionHandler<NodeHandler> STATEMENT_HANDLERS[] = {
+    { ParseAction::EXPRESSION,           parse_expression_node },
+    { ParseAction::IDENTIFIER_STATEMENT, parse_identifier_statement },
+};
+constexpr DispatchTable<NodeHandler> STATEMENT_TABLE(ParserState::STATEMENT, STATEMENT_HANDLERS);
+static_assert(STATEMENT_TABLE.is_complete, "Every statement action needs a handler");
+
+constexpr ActionHandler<NodeHandler> VALUE_HANDLERS[] = {
+    { ParseAction::EXPRESSION,      parse_expression_node },
+    { ParseAction::PROC_DEFINITION, parse_proc_definition },
+};
+constexpr DispatchTable<NodeHandler> VALUE_TABLE(ParserState::VALUE, VALUE_HANDLERS);
+static_assert(VALUE_TABLE.is_complete, "Every value action needs a handler");
+
+/**
+ * Parses an expression into a node, which is appended to the AST with the given parent.
+ * The expression is either a procedure definition or an operation.
+ */
+static auto parse_expression(
+    TokenStream *tokens,
+    Context *context,
+    AST *ast,
+    NodeId parent_node,
+    DynamicArray<ParseError> *errors
+) -> Result<NodeId, ParseError> {
+    return VALUE_TABLE[stream_peek(tokens)->type].handler(tokens, context, ast, parent_node, errors);
+}
+
+static auto parse_statement(
+    TokenStream *tokens,
+    Context *context,
+    AST *ast,
+    NodeId parent_node,
+    DynamicArray<ParseError> *errors
+) -> bool {
+    auto statement_result = STATEMENT_TABLE[stream_peek(tokens)->type].handler(
+        tokens,
+        context,
+        ast,
+        parent_node,
+        errors
+    );
+    if (!is_ok(statement_result)) {
+        append(errors, statement_result.err);
+        return false;
     }
+
+    // Consume the newline or end token
+    if (
+        auto end_token = stream_peek(tokens);
+        end_token->type != TokenType::NEWLINE && end_token->type != TokenType::END
+    ) {
+        append(errors, PARSE_ERROR_CREATE(UNEXPECTED_TOKEN, end_token));
+        return false;
+    }
+    (void)stream_next(tokens);
     return true;
 }
 
 #undef PARSE_ERROR_CREATE
 
-auto parse(Array<Token> *tokens, ArenaAllocator *allocator) -> Array<ASTNode> {
-    // Allocate all necessary blocks upfront
-    // TODO Adjust the max error count so that it is exact
-    size_t constexpr MAX_ERROR_COUNT = 16; // Should be enough for now
-    auto errors_block = allocate_array<ParseError>(allocator, MAX_ERROR_COUNT);
+/**
+ * Adds the subtree size of every node to the size of its parent.
+ *
+ * The nodes are appended in pre-order, so the children of a node always come
+ * after it, and going through the nodes backwards completes every subtree
+ * before its size is added to the parent. This also holds for subtrees that
+ * were left incomplete by parse errors.
+ */
+static auto compute_subtree_sizes(AST *ast) -> void {
+    for (size_t node = ast_node_count(ast); node-- > 0;) {
+        NodeId parent = ast_parent(ast, node);
+        if (parent == NODE_NONE) {
+            continue;
+        }
+        assert(parent < node && "Parent node should precede its children");
+        *segmented_array_at(ast->subtree_sizes, parent) += ast_subtree_size(ast, node);
+    }
+}
 
-    auto types_block = allocate_array<TypeASTNode>(allocator, tokens->length);
-    auto types_iter = to_iterator(&types_block);
+// TODO Adjust the max error count so that it is exact
+size_t constexpr MAX_ERROR_COUNT = 16; // Should be enough for now
+// A failed definition reports at most one error per nesting level
+size_t constexpr MAX_ERRORS_PER_DEFINITION = 3;
 
-    // Store the initial allocation offset in order to resize
-    // both the nodes array and the proc params array later
-    auto initial_marker = allocator_marker_from_current_offset(allocator);
+/**
+ * Creates an empty AST whose arrays are allocated from the given allocator.
+ */
+static auto ast_from_allocator(String source, ArenaAllocator *allocator) -> AST {
+    // The node count isn't known while streaming, so the nodes are appended to
+    // segmented arrays, which grow as needed without moving the nodes.
+    return AST {
+        .source = source,
+        .error_count = 0,
+        .kinds = segmented_array_from_allocator<ASTNodeType>(allocator),
+        .parents = segmented_array_from_allocator<NodeId>(allocator),
+        .subtree_sizes = segmented_array_from_allocator<uint32_t>(allocator),
+        .payloads = segmented_array_from_allocator<uint32_t>(allocator),
+        .expressions = segmented_array_from_allocator<ExpressionASTNode>(allocator),
+        .proc_defs = segmented_array_from_allocator<ProcDefASTNode>(allocator),
+        .variable_definitions = segmented_array_from_allocator<VariableDefinitionASTNode>(allocator),
+        .expression_ops = segmented_array_from_allocator<ExpressionOp>(allocator),
+        .expression_op_offsets = segmented_array_from_allocator<uint32_t>(allocator),
+        .proc_params = segmented_array_from_allocator<ProcParameterASTNode>(allocator),
+        .types = segmented_array_from_allocator<TypeASTNode>(allocator),
+    };
+}
 
-    auto nodes_block = allocate_array<ASTNode>(allocator, tokens->length);
-    auto nodes_block_iter = to_iterator(&nodes_block);
+/**
+ * Handles the token at the beginning of a top-level line, which has been consumed already.
+ * @return Whether parsing should continue.
+ */
+using TopLevelHandler = auto (*)(
+    TokenStream *tokens,
+    Context *context,
+    AST *ast,
+    Token const *token,
+    DynamicArray<ParseError> *errors
+) -> bool;
 
-    auto proc_params_block = allocate_array<ProcParameterASTNode>(allocator, tokens->length);
-    auto proc_params_iter = to_iterator(&proc_params_block);
-    assert (proc_params_iter.current_index == 0 &&
-        "Procedure parameters iterator current index should be 0 at the start");
+/**
+ * Parses a top-level definition if the identifier token is followed by a CONST_DEF token.
+ */
+static auto parse_definition(
+    TokenStream *tokens,
+    Context *context,
+    AST *ast,
+    Token const *token,
+    DynamicArray<ParseError> *errors
+) -> bool {
+    if (stream_peek(tokens)->type != TokenType::CONST_DEF) {
+        return true;
+    }
+    context->current_identifier = *token;
+    (void)stream_next(tokens); // Consume the CONST_DEF token
+
+    auto expr_result = parse_expression(
+        tokens,
+        context,
+        ast,
+        NODE_NONE,
+        errors
+    );
+    if (!is_ok(expr_result)) {
+        append(errors, expr_result.err);
+        if (errors->length + MAX_ERRORS_PER_DEFINITION > errors->max_length) {
+            return false;
+        }
+        // Recover by skipping the rest of the failed statement, unless
+        // the error was at its end, and look for the next definition
+        if (stream_prev(tokens)->type != TokenType::NEWLINE) {
+            stream_skip_statement(tokens);
+        }
+    }
+    return true;
+}
+
+static auto skip_top_level_token(
+    TokenStream *tokens,
+    Context *context,
+    AST *ast,
+    Token const *token,
+    DynamicArray<ParseError> *errors
+) -> bool {
+    (void)tokens;
+    (void)context;
+    (void)ast;
+    (void)token;
+    (void)errors;
+    return true;
+}
+
+static auto end_definitions(
+    TokenStream *tokens,
+    Context *context,
+    AST *ast,
+    Token const *token,
+    DynamicArray<ParseError> *errors
+) -> bool {
+    (void)tokens;
+    (void)context;
+    (void)ast;
+    (void)token;
+    (void)errors;
+    return false;
+}
+
+constexpr ActionHandler<TopLevelHandler> TOP_LEVEL_HANDLERS[] = {
+    { ParseAction::DEFINITION, parse_definition },
+    { ParseAction::END,        end_definitions },
+    { ParseAction::SKIP,       skip_top_level_token },
+};
+constexpr DispatchTable<TopLevelHandler> TOP_LEVEL_TABLE(ParserState::TOP_LEVEL, TOP_LEVEL_HANDLERS);
+static_assert(TOP_LEVEL_TABLE.is_complete, "Every top-level action needs a handler");
 
-    // Parse the tokens into AST nodes
+/**
+ * Parses the top-level definitions pulled from the token stream into the AST
+ * until the stream ends or the error array is about to run out of capacity.
+ */
+static auto parse_definitions(
+    TokenStream *tokens,
+    AST *ast,
+    DynamicArray<ParseError> *errors
+) -> void {
     auto context = Context{};
-    assert(context.current_identifier == nullptr &&
-        "Current identifier in context should be null at the start");
-    context.nodes_block = &nodes_block;
-    auto errors = DynamicArray<ParseError>(&errors_block);
+    assert(context.current_identifier.type == TokenType::UNKNOWN &&
+        "Current identifier in context should be unset at the start");
 
-    // Parse tokens
-    auto tokens_iter = to_iterator(tokens);
+    // Parse tokens, dispatching on the token at the beginning of each top-level line
     while (true) {
-        auto *current_token = iter_next(&tokens_iter);
-        assert(current_token != nullptr &&
-            "Current token should not be null during parsing");
-
-        if (current_token->type == TokenType::END) {
+        auto *current_token = stream_next(tokens);
+        if (!TOP_LEVEL_TABLE[current_token->type].handler(tokens, &context, ast, current_token, errors)) {
             break;
         }
+    }
+}
+
+/**
+ * Prints the parse errors with their positions and source excerpts.
+ */
+static auto print_parse_errors(
+    String const *source,
+    Array<ParseError> errors,
+    ArenaAllocator *allocator
+) -> void {
+    print("Error count: %\n", errors.length);
+    if (errors.length == 0) {
+        return;
+    }
+    // Lines and columns are only needed for reporting, so the line index
+    // is built here instead of tracking positions while lexing. It's
+    // a scratch allocation, so it's released once the errors are printed.
+    auto scratch = ScratchScope(allocator);
+    auto line_index = build_line_index(source, scratch.allocator);
+    for (auto &error : errors) {
+        auto position = line_index_position(&line_index, error.offset);
+        print("\tParse error at line %, column %, source line %: % %\n",
+            position.line,
+            position.col,
+            error.src_code_line,
+            to_string(error.code),
+            to_string(error.token_type)
+        );
+        print_source_excerpt(stdout, &line_index, error.offset);
+    }
+}
+
+/**
+ * The index of the first node, expression op, parameter, type and payload
+ * of each node kind of a chunk in the merged AST.
+ */
+struct ASTBases {
+    size_t node;
+    size_t expression_op;
+    size_t proc_param;
+    size_t type;
+    size_t expression;
+    size_t proc_def;
+    size_t variable_definition;
+};
+
+/**
+ * A range of top-level definitions that is parsed by a single thread into its own AST.
+ */
+struct ParseChunk {
+    size_t token_begin;
+    size_t token_end;
+    ArenaAllocator *allocator;
+    AST ast;
+    AllocatedArrayBlock<ParseError> errors_block;
+    size_t error_count;
+    ASTBases bases;
+};
+
+/**
+ * An upper bound of the AST memory per token. Each token creates at most one node
+ * (with its payload), expression op, parameter or type, and a segmented array holds
+ * at most about twice its length.
+ */
+size_t constexpr AST_MAX_SIZE_PER_TOKEN = 2 * (
+    sizeof(ASTNodeType) + sizeof(NodeId) + 2 * sizeof(uint32_t)
+    + sizeof(ProcDefASTNode) + sizeof(ExpressionOp) + sizeof(uint32_t)
+    + sizeof(ProcParameterASTNode) + sizeof(TypeASTNode)
+);
+/**
+ * Covers the array headers and the segment alignment of a chunk.
+ */
+size_t constexpr PARSE_CHUNK_FIXED_MEMORY_SIZE = 16 * 1024;
 
-        // Parse top-level nodes
-        parse_top_level_node:
-            if (current_token->type == TokenType::IDENTIFIER) {
-                auto peeked_token = iter_next(&tokens_iter);
-                if (peeked_token->type == TokenType::CONST_DEF) {
-                    context.current_identifier = current_token;
-                    goto parse_expr;
+/**
+ * Splits the store into chunks that begin at top-level definitions.
+ *
+ * Definitions begin at unindented lines, so the lines are walked through with
+ * the statement end table, which touches a single token per line.
+ * @return The number of chunks.
+ */
+static auto split_into_parse_chunks(TokenStore *store, Array<ParseChunk> chunks) -> size_t {
+    size_t const end_index = store->types.length - 1;
+    size_t chunk_count = 0;
+    size_t begin = 0;
+    size_t line_begin = 0;
+    for (size_t i = 0; i < chunks.length && begin < end_index; i++) {
+        size_t end = end_index;
+        if (i + 1 < chunks.length) {
+            size_t target = end_index / chunks.length * (i + 1);
+            while (line_begin < end_index) {
+                bool is_definition =
+                    store->types.data[line_begin] == TokenType::IDENTIFIER &&
+                    store->types.data[line_begin + 1] == TokenType::CONST_DEF;
+                if (line_begin > begin && line_begin >= target && is_definition) {
+                    break;
                 }
+                line_begin = store->statement_ends.data[line_begin] + 1;
             }
+            end = line_begin < end_index ? line_begin : end_index;
+        }
+        if (end == begin) {
             continue;
+        }
+        chunks[chunk_count].token_begin = begin;
+        chunks[chunk_count].token_end = end;
+        chunk_count++;
+        begin = end;
+    }
+    return chunk_count;
+}
 
-        parse_expr:
-            auto expr_result = parse_expression(
-                &tokens_iter,
-                &context,
-                &nodes_block_iter,
-                &proc_params_block,
-                &proc_params_iter,
-                &types_iter,
-                &errors
-            );
-            if (!is_ok(expr_result)) {
-                append(&errors, expr_result.err);
-                goto after_parsing;
+/**
+ * Copies the elements of a chunk array into the merged array from the given base on,
+ * passing each of them through the rebase function.
+ */
+template<typename ElementType, typename RebaseFn>
+static auto merge_chunk_array(
+    SegmentedArray<ElementType> *merged,
+    size_t base,
+    SegmentedArray<ElementType> *chunk_array,
+    RebaseFn &&rebase
+) -> void {
+    size_t index = base;
+    for (auto &element : to_slice(chunk_array)) {
+        *segmented_array_at(merged, index++) = rebase(element);
+    }
+}
+
+/**
+ * Parses the chunks of top-level definitions of a token store in parallel, each into
+ * its own arena. The chunk ASTs are then merged into the AST in source order, rebasing
+ * the node, parameter, type and payload indices on the way.
+ *
+ * Subtree sizes are relative, so they are computed per chunk and copied as they are.
+ */
+static auto parse_chunks(
+    TokenStream *tokens,
+    AST *ast,
+    Array<ParseChunk> chunks,
+    DynamicArray<ParseError> *errors,
+    ArenaAllocator *allocator
+) -> void {
+    TokenStore *store = tokens->store;
+    // Each chunk gets its own arena, so the threads don't contend for one.
+    // The arenas are released once merged, so their headers are scratch allocations.
+    auto scratch = ScratchScope(allocator);
+    auto chunk_allocators_block = allocate_array<ArenaAllocator>(scratch.allocator, chunks.length);
+
+    // Parse the chunks in parallel
+    parallel_for(chunks.length, [&](size_t chunk_index) {
+        ParseChunk *chunk = &chunks[chunk_index];
+        size_t token_count = chunk->token_end - chunk->token_begin;
+        chunk->allocator = new (&chunk_allocators_block.data[chunk_index]) ArenaAllocator(
+            PARSE_CHUNK_FIXED_MEMORY_SIZE + token_count * AST_MAX_SIZE_PER_TOKEN
+        );
+        chunk->errors_block = allocate_array<ParseError>(chunk->allocator, MAX_ERROR_COUNT);
+        chunk->ast = ast_from_allocator(tokens->source, chunk->allocator);
+
+        auto chunk_tokens = token_stream_from_store_range(store, chunk->token_begin, chunk->token_end);
+        auto chunk_errors = DynamicArray<ParseError>(&chunk->errors_block);
+        parse_definitions(&chunk_tokens, &chunk->ast, &chunk_errors);
+        chunk->error_count = chunk_errors.length;
+        compute_subtree_sizes(&chunk->ast);
+    });
+
+    // Assign the indices of every chunk in the merged AST
+    ASTBases total = {};
+    for (auto &chunk : chunks) {
+        chunk.bases = total;
+        total.node += ast_node_count(&chunk.ast);
+        total.proc_param += chunk.ast.proc_params->length;
+        total.type += chunk.ast.types->length;
+        total.expression_op += chunk.ast.expression_ops->length;
+        total.expression += chunk.ast.expressions->length;
+        total.proc_def += chunk.ast.proc_defs->length;
+        total.variable_definition += chunk.ast.variable_definitions->length;
+
+        // Keep the errors in source order
+        for (size_t i = 0; i < chunk.error_count && errors->length < errors->max_length; i++) {
+            append(errors, chunk.errors_block.data[i]);
+        }
+    }
+    segmented_array_resize(ast->kinds, total.node);
+    segmented_array_resize(ast->parents, total.node);
+    segmented_array_resize(ast->subtree_sizes, total.node);
+    segmented_array_resize(ast->payloads, total.node);
+    segmented_array_resize(ast->proc_params, total.proc_param);
+    segmented_array_resize(ast->types, total.type);
+    segmented_array_resize(ast->expression_ops, total.expression_op);
+    segmented_array_resize(ast->expression_op_offsets, total.expression_op);
+    segmented_array_resize(ast->expressions, total.expression);
+    segmented_array_resize(ast->proc_defs, total.proc_def);
+    segmented_array_resize(ast->variable_definitions, total.variable_definition);
+
+    // Merge the chunks in parallel
+    parallel_for(chunks.length, [&](size_t chunk_index) {
+        ParseChunk *chunk = &chunks[chunk_index];
+        AST *chunk_ast = &chunk->ast;
+        auto node_base = static_cast<NodeId>(chunk->bases.node);
+        auto keep = [](auto const &element) { return element; };
+
+        merge_chunk_array(ast->kinds, chunk->bases.node, chunk_ast->kinds, keep);
+        merge_chunk_array(ast->subtree_sizes, chunk->bases.node, chunk_ast->subtree_sizes, keep);
+        merge_chunk_array(ast->parents, chunk->bases.node, chunk_ast->parents, [&](NodeId parent) {
+            return parent != NODE_NONE ? parent + node_base : NODE_NONE;
+        });
+        NodeId node = 0;
+        merge_chunk_array(ast->payloads, chunk->bases.node, chunk_ast->payloads, [&](uint32_t payload) {
+            size_t payload_base = 0;
+            switch (ast_kind(chunk_ast, node++)) {
+                case ASTNodeType::EXPRESSION:          payload_base = chunk->bases.expression; break;
+                case ASTNodeType::PROC_DEF:            payload_base = chunk->bases.proc_def; break;
+                case ASTNodeType::RETURN:
+                    payload_base = payload != NODE_NONE ? chunk->bases.node : 0;
+                    break;
+                case ASTNodeType::VARIABLE_DEFINITION: payload_base = chunk->bases.variable_definition; break;
+                default:                               break;
             }
-            continue;
+            return static_cast<uint32_t>(payload + payload_base);
+        });
+
+        merge_chunk_array(ast->proc_params, chunk->bases.proc_param, chunk_ast->proc_params,
+            [&](ProcParameterASTNode param) {
+                param.type += static_cast<TypeId>(chunk->bases.type);
+                return param;
+            });
+        merge_chunk_array(ast->types, chunk->bases.type, chunk_ast->types, keep);
+        // Op sizes are relative, so the ops are copied as they are
+        merge_chunk_array(ast->expression_ops, chunk->bases.expression_op, chunk_ast->expression_ops, keep);
+        merge_chunk_array(ast->expression_op_offsets, chunk->bases.expression_op, chunk_ast->expression_op_offsets, keep);
+        merge_chunk_array(ast->expressions, chunk->bases.expression, chunk_ast->expressions,
+            [&](ExpressionASTNode expression) {
+                expression.first_op += static_cast<uint32_t>(chunk->bases.expression_op);
+                return expression;
+            });
+        merge_chunk_array(ast->proc_defs, chunk->bases.proc_def, chunk_ast->proc_defs,
+            [&](ProcDefASTNode proc_def) {
+                proc_def.first_parameter += static_cast<uint32_t>(chunk->bases.proc_param);
+                if (proc_def.return_type != TYPE_NONE) {
+                    proc_def.return_type += static_cast<TypeId>(chunk->bases.type);
+                }
+                return proc_def;
+            });
+        merge_chunk_array(ast->variable_definitions, chunk->bases.variable_definition, chunk_ast->variable_definitions,
+            [&](VariableDefinitionASTNode variable_definition) {
+                if (variable_definition.value != NODE_NONE) {
+                    variable_definition.value += node_base;
+                }
+                return variable_definition;
+            });
+
+        delete_allocator(chunk->allocator);
+    });
+
+    print("AST: % nodes, % chunks\n", ast_node_count(ast), chunks.length);
+
+    // The whole store has been consumed
+    tokens->next_index = store->types.length;
+    tokens->lexed_count = store->types.length;
+}
+
+/**
+ * Parses large token stores by splitting them into as many chunks as there are worker threads.
+ */
+static auto parse_in_chunks(
+    TokenStream *tokens,
+    AST *ast,
+    DynamicArray<ParseError> *errors,
+    ArenaAllocator *allocator
+) -> void {
+    auto scratch = ScratchScope(allocator);
+    auto chunks_block = allocate_array<ParseChunk>(scratch.allocator, worker_thread_count());
+    Array<ParseChunk> chunks = Array<ParseChunk>(chunks_block.data, chunks_block.length);
+    chunks.length = split_into_parse_chunks(tokens->store, chunks);
+    parse_chunks(tokens, ast, chunks, errors, allocator);
+}
+
+auto parse(TokenStream *tokens, ArenaAllocator *allocator) -> AST {
+    auto errors_block = allocate_array<ParseError>(allocator, MAX_ERROR_COUNT);
+    auto errors = DynamicArray<ParseError>(&errors_block);
+    auto ast = ast_from_allocator(tokens->source, allocator);
+
+    // Chunks are only worth it for large inputs, and they need random access to the tokens.
+    // The token observer expects the tokens in order, so it rules chunks out too.
+    bool const parse_in_parallel =
+        tokens->store != nullptr &&
+        tokens->on_token == nullptr &&
+        tokens->next_index == 0 &&
+        tokens->store->types.length >= PARSING_MIN_CHUNK_TOKEN_COUNT * 2 &&
+        worker_thread_count() > 1;
+    if (parse_in_parallel) {
+        parse_in_chunks(tokens, &ast, &errors, allocator);
+    }
+    else {
+        parse_definitions(tokens, &ast, &errors);
+        compute_subtree_sizes(&ast);
     }
 
-    after_parsing:
-        print("Error count: %\n", errors.length);
-        for (auto &error : to_array(&errors)) {
-            print("\tParse error at line %, column %, source line %: %\n",
-                error.position.line,
-                error.position.col,
-                error.src_code_line,
-                static_cast<int>(error.code)
-            );
+    ast.error_count = errors.length;
+    print_parse_errors(&tokens->source, to_array(&errors), allocator);
+    return ast;
+}
+
+/**
+ * A top-level definition found by the pre-parser, whose tokens begin at the
+ * unindented line of its name and end where the next definition begins.
+ */
+struct DeferredDefinition {
+    SymbolId symbol;
+    uint32_t token_begin;
+    /**
+     * The next definition with the same name, or UINT32_MAX. Every definition of
+     * a reachable name is parsed, so that duplicate definitions are still reported.
+     */
+    uint32_t next_with_same_name;
+    bool is_reachable;
+};
+
+auto parse_reachable(TokenStream *tokens, Array<SymbolId> root_symbols, ArenaAllocator *allocator) -> AST {
+    TokenStore *store = tokens->store;
+    assert(store != nullptr && tokens->next_index == 0 && "Lazy parsing needs a whole token store");
+    auto errors_block = allocate_array<ParseError>(allocator, MAX_ERROR_COUNT);
+    auto errors = DynamicArray<ParseError>(&errors_block);
+    auto ast = ast_from_allocator(tokens->source, allocator);
+
+    // Pre-parse the definitions by walking the lines with the statement end table,
+    // the same way as the store is split into chunks. The tables of the pre-parser
+    // are only needed until the chunks are parsed, so they are scratch allocations.
+    auto scratch = ScratchScope(allocator);
+    size_t const end_index = store->types.length - 1;
+    auto is_definition = [&](size_t line_begin) {
+        return store->types.data[line_begin] == TokenType::IDENTIFIER &&
+            store->types.data[line_begin + 1] == TokenType::CONST_DEF;
+    };
+    size_t definition_count = 0;
+    for (size_t line_begin = 0; line_begin < end_index; line_begin = store->statement_ends.data[line_begin] + 1) {
+        definition_count += is_definition(line_begin);
+    }
+    auto definitions = allocate_array<DeferredDefinition>(scratch.allocator, definition_count);
+    size_t definition_index = 0;
+    for (size_t line_begin = 0; line_begin < end_index; line_begin = store->statement_ends.data[line_begin] + 1) {
+        if (is_definition(line_begin)) {
+            auto &payload = store->payloads.data[token_store_payload_index(store, line_begin)];
+            definitions.data[definition_index++] = DeferredDefinition {
+                .symbol = payload.identifier.symbol,
+                .token_begin = static_cast<uint32_t>(line_begin),
+                .next_with_same_name = UINT32_MAX,
+                .is_reachable = false,
+            };
+        }
+    }
+    auto definition_end = [&](size_t index) -> size_t {
+        return index + 1 < definition_count ? definitions.data[index + 1].token_begin : end_index;
+    };
+
+    // An open-addressing table of the first definition of every name, keyed by the
+    // symbol with Fibonacci hashing, whose load factor stays at most 1/2
+    uint32_t capacity_bits = 2;
+    while ((size_t(1) << capacity_bits) < 2 * definition_count) {
+        capacity_bits++;
+    }
+    size_t mask = (size_t(1) << capacity_bits) - 1;
+    auto slots = allocate_array<uint32_t>(scratch.allocator, mask + 1);
+    for (auto &slot : slots) {
+        slot = UINT32_MAX;
+    }
+    auto name_slot = [&](SymbolId symbol) -> uint32_t* {
+        size_t index = (symbol * 0x9E3779B1u) >> (32 - capacity_bits);
+        while (slots.data[index] != UINT32_MAX && definitions.data[slots.data[index]].symbol != symbol) {
+            index = (index + 1) & mask;
         }
+        return &slots.data[index];
+    };
+    // The definitions are inserted backwards, so that each name chain is in source order
+    for (size_t i = definition_count; i-- > 0;) {
+        uint32_t *slot = name_slot(definitions.data[i].symbol);
+        definitions.data[i].next_with_same_name = *slot;
+        *slot = static_cast<uint32_t>(i);
+    }
 
-        // Allocate new blocks with the exact sizes and copy the data over to them
-        auto nodes_block_arr = to_array(&nodes_block);
-        nodes_block_arr = slice_by_offset(&nodes_block_arr, 0, nodes_block_iter.current_index);
-        auto new_nodes_block = allocate_array_from_copy<ASTNode>(allocator, &nodes_block_arr);
-
-        auto old_proc_params_arr = to_array(&proc_params_block);
-        old_proc_params_arr = slice_by_offset(&old_proc_params_arr, 0, proc_params_iter.current_index);
-        auto old_proc_params_block = allocate_array_from_copy<ProcParameterASTNode>(allocator, &old_proc_params_arr);
-
-        // Reset the allocator offset to the initial value and re-allocate
-        // the nodes and proc params blocks to be tightly packed
-        allocator->offset = initial_marker.offset;
-
-        auto new_nodes_block_arr = to_array(&new_nodes_block);
-        new_nodes_block = allocate_array_from_copy<ASTNode>(allocator, &new_nodes_block_arr);
-        assert(new_nodes_block.length == nodes_block_iter.current_index &&
-            "Node count mismatch after re-allocation");
-
-        auto new_proc_params_arr = to_array(&old_proc_params_block);
-        auto new_proc_params_block = allocate_array_from_copy<ProcParameterASTNode>(allocator, &new_proc_params_arr);
-        assert(new_proc_params_block.length == proc_params_iter.current_index &&
-            "Proc parameter count mismatch after re-allocation");
-
-        // Update the proc parameters pointers in the AST nodes to point to the new tightly packed block
-        for (auto &node : new_nodes_block) {
-            if (node.type == ASTNodeType::PROC_DEF) {
-                node.proc_def.parameters.data =
-                    ptr_sub(node.proc_def.parameters.data,
-                        ptr_sub(node.proc_def.parameters.data, new_proc_params_block.data));
+    // Mark the reachable definitions with a depth-first search from the roots. The names
+    // used by a definition are read from the identifier tokens of the store, so nothing
+    // is parsed yet, and a definition is reached when any identifier has its name.
+    // This over-approximates the uses, e.g. a parameter with the name of a procedure.
+    auto stack = allocate_array<uint32_t>(scratch.allocator, definition_count);
+    size_t stack_length = 0;
+    auto reach = [&](SymbolId symbol) {
+        for (uint32_t i = *name_slot(symbol); i != UINT32_MAX; i = definitions.data[i].next_with_same_name) {
+            if (!definitions.data[i].is_reachable) {
+                definitions.data[i].is_reachable = true;
+                stack.data[stack_length++] = i;
             }
         }
+    };
+    for (SymbolId root_symbol : root_symbols) {
+        reach(root_symbol);
+    }
+    size_t reachable_count = 0;
+    while (stack_length > 0) {
+        uint32_t definition = stack.data[--stack_length];
+        reachable_count++;
+        // The name of the definition itself is skipped
+        size_t begin = definitions.data[definition].token_begin + 1;
+        size_t end = definition_end(definition);
+        size_t payload_index = token_store_payload_count_before(store, begin);
+        for (size_t i = begin; i < end; i++) {
+            TokenType type = store->types.data[i];
+            if (type == TokenType::IDENTIFIER) {
+                reach(store->payloads.data[payload_index].identifier.symbol);
+            }
+            payload_index += token_has_payload(type);
+        }
+    }
+
+    // Each run of consecutive reachable definitions is parsed as one chunk
+    size_t chunk_count = 0;
+    for (size_t i = 0; i < definition_count; i++) {
+        chunk_count += definitions.data[i].is_reachable && (i == 0 || !definitions.data[i - 1].is_reachable);
+    }
+    auto chunks_block = allocate_array<ParseChunk>(scratch.allocator, chunk_count);
+    Array<ParseChunk> chunks = Array<ParseChunk>(chunks_block.data, 0);
+    for (size_t i = 0; i < definition_count; i++) {
+        if (!definitions.data[i].is_reachable) {
+            continue;
+        }
+        if (i == 0 || !definitions.data[i - 1].is_reachable) {
+            chunks.data[chunks.length++].token_begin = definitions.data[i].token_begin;
+        }
+        chunks.data[chunks.length - 1].token_end = definition_end(i);
+    }
+    print("Reachable definitions: % of %\n", reachable_count, definition_count);
+
+    parse_chunks(tokens, &ast, chunks, &errors, allocator);
 
-        return to_array(&new_nodes_block);
+    ast.error_count = errors.length;
+    print_parse_errors(&tokens->source, to_array(&errors), allocator);
+    return ast;
 }
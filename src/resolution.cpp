@@ -0,0 +1,323 @@
+#include <bloom/diagnostics.h>
+#include <bloom/print.h>
+#include <bloom/resolution.h>
+
+/**
+ * The builtin symbols that can be used as values, e.g. called.
+ */
+SymbolId constexpr BUILTIN_VALUE_SYMBOLS[] = {
+    SYMBOL_PRINTF,
+};
+
+struct ScopeSlot {
+    SymbolId symbol;
+    Binding binding;
+};
+
+/**
+ * An open-addressing hash table from symbol IDs to the bindings defined in a scope.
+ * The number of names of a scope is known before it's created, so the table is
+ * sized upfront and never grows.
+ */
+struct Scope {
+    /**
+     * The enclosing scope, which is searched for the names that aren't defined
+     * in this scope, or null for the global scope.
+     */
+    Scope *parent;
+    ScopeSlot *slots;
+    /**
+     * The number of slots is 2^capacity_bits.
+     */
+    uint32_t capacity_bits;
+};
+
+enum class NameErrorCode {
+    DUPLICATE_DEFINITION,
+    UNDEFINED_NAME,
+};
+
+static auto to_string(NameErrorCode code) -> char const* {
+    switch (code) {
+        case NameErrorCode::DUPLICATE_DEFINITION: return "Duplicate definition of";
+        case NameErrorCode::UNDEFINED_NAME: return "Undefined name";
+    }
+    return "Unknown error";
+}
+
+struct NameError {
+    NameErrorCode code;
+    SourceSpan name;
+};
+
+// Only the first errors are kept for reporting, the rest are just counted
+size_t constexpr MAX_NAME_ERROR_COUNT = 16;
+
+struct Resolver {
+    AST *ast;
+    SymbolTable *symbols;
+    ArenaAllocator *allocator;
+    Scope *global_scope;
+    Array<Binding> bindings;
+    NameError errors[MAX_NAME_ERROR_COUNT];
+    size_t error_count;
+};
+
+/**
+ * Creates an empty scope with room for the given number of names, whose load factor
+ * stays at most 1/2, so that probe sequences stay short.
+ */
+static auto scope_from_allocator(ArenaAllocator *allocator, Scope *parent, size_t name_count) -> Scope {
+    uint32_t capacity_bits = 2;
+    while ((size_t(1) << capacity_bits) < 2 * name_count) {
+        capacity_bits++;
+    }
+    size_t capacity = size_t(1) << capacity_bits;
+    auto slots = allocate_array<ScopeSlot>(allocator, capacity);
+    for (size_t i = 0; i < capacity; i++) {
+        slots.data[i] = ScopeSlot {
+            .symbol = SYMBOL_NONE,
+            .binding = {},
+        };
+    }
+    return Scope {
+        .parent = parent,
+        .slots = slots.data,
+        .capacity_bits = capacity_bits,
+    };
+}
+
+/**
+ * Returns the slot of the symbol in the scope, or the empty slot where it would be inserted.
+ */
+static auto scope_slot(Scope const *scope, SymbolId symbol) -> ScopeSlot* {
+    // Symbol IDs are dense, so they are spread over the table by Fibonacci hashing
+    size_t mask = (size_t(1) << scope->capacity_bits) - 1;
+    size_t index = (symbol * 0x9E3779B1u) >> (32 - scope->capacity_bits);
+    while (scope->slots[index].symbol != SYMBOL_NONE && scope->slots[index].symbol != symbol) {
+        index = (index + 1) & mask;
+    }
+    return &scope->slots[index];
+}
+
+/**
+ * Defines the symbol in the scope.
+ * @return false if the symbol is defined in the scope already.
+ */
+static auto scope_define(Scope *scope, SymbolId symbol, Binding binding) -> bool {
+    ScopeSlot *slot = scope_slot(scope, symbol);
+    if (slot->symbol == symbol) {
+        return false;
+    }
+    *slot = ScopeSlot {
+        .symbol = symbol,
+        .binding = binding,
+    };
+    return true;
+}
+
+/**
+ * Looks the symbol up in the scope and then in its enclosing scopes.
+ * @return The binding of the innermost definition, whose kind is NONE if there's none.
+ */
+static auto scope_lookup(Scope const *scope, SymbolId symbol) -> Binding {
+    for (; scope != nullptr; scope = scope->parent) {
+        ScopeSlot *slot = scope_slot(scope, symbol);
+        if (slot->symbol == symbol) {
+            return slot->binding;
+        }
+    }
+    return Binding { .kind = BindingKind::NONE, .index = 0 };
+}
+
+static auto report_error(Resolver *resolver, NameErrorCode code, SourceSpan name) -> void {
+    if (resolver->error_count < MAX_NAME_ERROR_COUNT) {
+        resolver->errors[resolver->error_count] = NameError {
+            .code = code,
+            .name = name,
+        };
+    }
+    resolver->error_count++;
+}
+
+static auto define_name(Resolver *resolver, Scope *scope, SymbolId symbol, SourceSpan name, Binding binding) -> void {
+    if (!scope_define(scope, symbol, binding)) {
+        report_error(resolver, NameErrorCode::DUPLICATE_DEFINITION, name);
+    }
+}
+
+/**
+ * Binds every identifier of an EXPRESSION node.
+ */
+static auto resolve_expression(Resolver *resolver, Scope const *scope, NodeId node) -> void {
+    auto *expression = ast_expression(resolver->ast, node);
+    uint32_t op_index = expression->first_op;
+    for (auto &op : ast_expression_ops(resolver->ast, expression)) {
+        if (op.kind == ExpressionOpKind::IDENTIFIER) {
+            // The name was interned while lexing, so this only looks up its symbol
+            auto name = ast_string(resolver->ast, op.span);
+            auto binding = scope_lookup(scope, intern_symbol(resolver->symbols, &name));
+            if (binding.kind == BindingKind::NONE) {
+                report_error(resolver, NameErrorCode::UNDEFINED_NAME, op.span);
+            }
+            resolver->bindings[op_index] = binding;
+        }
+        op_index++;
+    }
+}
+
+static auto resolve_proc(Resolver *resolver, NodeId node) -> void;
+
+/**
+ * Resolves a statement of a procedure body, and defines the name of a variable
+ * definition in the local scope after its value, so that the value can't refer to it.
+ */
+static auto resolve_statement(Resolver *resolver, Scope *local_scope, NodeId statement) -> void {
+    AST *ast = resolver->ast;
+    switch (ast_kind(ast, statement)) {
+        case ASTNodeType::EXPRESSION:
+            resolve_expression(resolver, local_scope, statement);
+            break;
+        case ASTNodeType::VARIABLE_DEFINITION: {
+            auto *variable_definition = ast_variable_definition(ast, statement);
+            if (variable_definition->value != NODE_NONE) {
+                if (ast_kind(ast, variable_definition->value) == ASTNodeType::PROC_DEF) {
+                    resolve_proc(resolver, variable_definition->value);
+                }
+                else {
+                    resolve_expression(resolver, local_scope, variable_definition->value);
+                }
+            }
+            // A local can't shadow a parameter, as they share a scope in C
+            Scope *parameter_scope = local_scope->parent;
+            if (scope_slot(parameter_scope, variable_definition->symbol)->symbol == variable_definition->symbol) {
+                report_error(resolver, NameErrorCode::DUPLICATE_DEFINITION, variable_definition->name);
+                break;
+            }
+            define_name(resolver, local_scope, variable_definition->symbol, variable_definition->name, Binding {
+                .kind = BindingKind::VARIABLE,
+                .index = statement,
+            });
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+/**
+ * Resolves a procedure in a scope of its parameters and a scope of its locals,
+ * which are both nested in the global scope, as procedures can't capture locals.
+ */
+static auto resolve_proc(Resolver *resolver, NodeId node) -> void {
+    AST *ast = resolver->ast;
+    auto *proc_def = ast_proc_def(ast, node);
+    auto temporaries = ArenaScope(resolver->allocator);
+
+    auto parameter_scope = scope_from_allocator(resolver->allocator, resolver->global_scope, proc_def->parameter_count);
+    for (uint32_t i = 0; i < proc_def->parameter_count; i++) {
+        auto *param = ast_proc_param(ast, proc_def, i);
+        define_name(resolver, &parameter_scope, param->symbol, param->name, Binding {
+            .kind = BindingKind::PARAMETER,
+            .index = proc_def->first_parameter + i,
+        });
+    }
+
+    size_t local_count = 0;
+    ast_for_each_child(ast, node, [&](NodeId statement) {
+        local_count += ast_kind(ast, statement) == ASTNodeType::VARIABLE_DEFINITION;
+    });
+    auto local_scope = scope_from_allocator(resolver->allocator, &parameter_scope, local_count);
+    ast_for_each_child(ast, node, [&](NodeId statement) {
+        resolve_statement(resolver, &local_scope, statement);
+    });
+}
+
+/**
+ * Prints the name errors with their positions and source excerpts.
+ */
+static auto print_name_errors(Resolver *resolver) -> void {
+    print("Name error count: %\n", resolver->error_count);
+    if (resolver->error_count == 0) {
+        return;
+    }
+    auto line_index = build_line_index(&resolver->ast->source, resolver->allocator);
+    size_t reported_count = resolver->error_count < MAX_NAME_ERROR_COUNT
+        ? resolver->error_count
+        : MAX_NAME_ERROR_COUNT;
+    for (size_t i = 0; i < reported_count; i++) {
+        auto &error = resolver->errors[i];
+        auto position = line_index_position(&line_index, error.name.offset);
+        print("\tName error at line %, column %: % %\n",
+            position.line,
+            position.col,
+            to_string(error.code),
+            ast_string(resolver->ast, error.name)
+        );
+        print_source_excerpt(stdout, &line_index, error.name.offset);
+    }
+}
+
+auto resolve_names(AST *ast, SymbolTable *symbols, ArenaAllocator *allocator) -> NameResolution {
+    size_t op_count = ast->expression_ops->length;
+    auto bindings_block = allocate_array<Binding>(allocator, op_count);
+    for (size_t i = 0; i < op_count; i++) {
+        bindings_block.data[i] = Binding { .kind = BindingKind::NONE, .index = 0 };
+    }
+    // The scopes and the line index are only needed during the pass
+    auto temporaries = ArenaScope(allocator);
+
+    auto resolver = Resolver {
+        .ast = ast,
+        .symbols = symbols,
+        .allocator = allocator,
+        .global_scope = nullptr,
+        .bindings = Array<Binding>(bindings_block.data, bindings_block.length),
+        .errors = {},
+        .error_count = 0,
+    };
+
+    // The procedures are defined before any body is resolved, so that
+    // they can be called before their definition
+    size_t global_count = sizeof(BUILTIN_VALUE_SYMBOLS) / sizeof(BUILTIN_VALUE_SYMBOLS[0]);
+    ast_for_each_root(ast, [&](NodeId root) {
+        global_count += ast_kind(ast, root) == ASTNodeType::PROC_DEF;
+    });
+    auto global_scope = scope_from_allocator(allocator, nullptr, global_count);
+    resolver.global_scope = &global_scope;
+    for (SymbolId symbol : BUILTIN_VALUE_SYMBOLS) {
+        (void)scope_define(&global_scope, symbol, Binding {
+            .kind = BindingKind::BUILTIN,
+            .index = symbol,
+        });
+    }
+    ast_for_each_root(ast, [&](NodeId root) {
+        if (ast_kind(ast, root) != ASTNodeType::PROC_DEF) {
+            return;
+        }
+        auto *proc_def = ast_proc_def(ast, root);
+        define_name(&resolver, &global_scope, proc_def->symbol, proc_def->name, Binding {
+            .kind = BindingKind::PROC,
+            .index = root,
+        });
+    });
+
+    ast_for_each_root(ast, [&](NodeId root) {
+        switch (ast_kind(ast, root)) {
+            case ASTNodeType::EXPRESSION:
+                resolve_expression(&resolver, &global_scope, root);
+                break;
+            case ASTNodeType::PROC_DEF:
+                resolve_proc(&resolver, root);
+                break;
+            default:
+                break;
+        }
+    });
+
+    print_name_errors(&resolver);
+    return NameResolution {
+        .bindings = resolver.bindings,
+        .error_count = resolver.error_count,
+    };
+}
@@ -12,37 +12,43 @@ class TestLine:
 
 COMMENT_LINE_BEGIN_STR = " * "
 CODE_LINE_PREFIX = ">>> "
-HEADER_FILE_PATH = "/home/henri/Personal/bloomc2/include/bloom/allocation.h"
-
-with open(HEADER_FILE_PATH, "r") as file:
-    header_content = file.read()
+INCLUDE_DIRECTORY_PATH = "/home/henri/Personal/bloomc2/include/bloom"
+HEADER_FILE_NAMES = [
+    "allocation.h",
+    "numbers.h",
+    "scanning.h",
+]
 
 examples: list[list[TestLine]] = []
 
-line_iter = iter(header_content.split("\n"))
-try:
-    while True:
-        line = next(line_iter)
-        if not "@example" in line:
-            continue
-        example_lines = []
-        while line := next(line_iter):
-            offset = line.find(COMMENT_LINE_BEGIN_STR)
-            if offset == 0:
-                # If the line contains an include directive
-                if line.find("#include") == len(COMMENT_LINE_BEGIN_STR):
-                    example_lines.append((TestLineType.INCLUDE, line[offset + len(COMMENT_LINE_BEGIN_STR):].strip()))
-                # If the line starts with code
-                elif line.find(CODE_LINE_PREFIX) == len(COMMENT_LINE_BEGIN_STR):
-                    example_lines.append((TestLineType.CODE, line[offset + 3 + len(CODE_LINE_PREFIX):].strip()))
-                # If the line contains stdout
+for header_file_name in HEADER_FILE_NAMES:
+    with open(f"{INCLUDE_DIRECTORY_PATH}/{header_file_name}", "r") as file:
+        header_content = file.read()
+
+    line_iter = iter(header_content.split("\n"))
+    try:
+        while True:
+            line = next(line_iter)
+            if not "@example" in line:
+                continue
+            example_lines = []
+            while line := next(line_iter):
+                offset = line.find(COMMENT_LINE_BEGIN_STR)
+                if offset == 0:
+                    # If the line contains an include directive
+                    if line.find("#include") == len(COMMENT_LINE_BEGIN_STR):
+                        example_lines.append((TestLineType.INCLUDE, line[offset + len(COMMENT_LINE_BEGIN_STR):].strip()))
+                    # If the line starts with code
+                    elif line.find(CODE_LINE_PREFIX) == len(COMMENT_LINE_BEGIN_STR):
+                        example_lines.append((TestLineType.CODE, line[offset + 3 + len(CODE_LINE_PREFIX):].strip()))
+                    # If the line contains stdout
+                    else:
+                        example_lines.append((TestLineType.STDOUT, line[offset + len(COMMENT_LINE_BEGIN_STR):].strip()))
                 else:
-                    example_lines.append((TestLineType.STDOUT, line[offset + len(COMMENT_LINE_BEGIN_STR):].strip()))
-            else:
-                break
-        examples.append(example_lines)
-except StopIteration:
-    pass
+                    break
+            examples.append(example_lines)
+    except StopIteration:
+        pass
 
 full_src: str = ""
 
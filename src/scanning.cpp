@@ -0,0 +1,646 @@
+#include <cstring>
+#include <bloom/scanning.h>
+
+#if defined(__x86_64__)
+#   define BLOOM_SCAN_X86 1
+#   include <immintrin.h>
+#else
+#   define BLOOM_SCAN_X86 0
+#endif
+
+/**
+ * Scans the input one byte at a time using the class table.
+ *
+ * If `StopInClass` is true, scanning stops at the first byte in the class.
+ * Otherwise, scanning stops at the first byte outside the class.
+ */
+template<bool StopInClass>
+static auto scan_scalar(String const *input, size_t begin, uint8_t class_mask) -> size_t {
+    size_t i = begin;
+    for (; i < input->length; i++) {
+        bool in_class = is_char_class(input->data[i], class_mask);
+        if (in_class == StopInClass) {
+            break;
+        }
+    }
+    return i;
+}
+
+static auto scan_until_string_delimiter_scalar(String const *input, size_t begin) -> size_t {
+    size_t i = begin;
+    for (; i < input->length; i++) {
+        char c = input->data[i];
+        if (c == '"' || c == '\\' || c == '\n') {
+            break;
+        }
+    }
+    return i;
+}
+
+static auto count_class_scalar(String const *input, size_t begin, uint8_t class_mask) -> size_t {
+    size_t count = 0;
+    for (size_t i = begin; i < input->length; i++) {
+        count += is_char_class(input->data[i], class_mask);
+    }
+    return count;
+}
+
+static auto collect_class_offsets_scalar(
+    String const *input,
+    size_t begin,
+    uint8_t class_mask,
+    uint32_t *offsets
+) -> size_t {
+    size_t count = 0;
+    for (size_t i = begin; i < input->length; i++) {
+        if (is_char_class(input->data[i], class_mask)) {
+            offsets[count++] = static_cast<uint32_t>(i);
+        }
+    }
+    return count;
+}
+
+/**
+ * Writes the offset of every set bit of a block mask.
+ * @return The number of offsets written.
+ */
+static inline auto write_mask_offsets(uint32_t bits, size_t block_offset, uint32_t *offsets) -> size_t {
+    size_t count = 0;
+    while (bits != 0) {
+        offsets[count++] = static_cast<uint32_t>(block_offset + __builtin_ctz(bits));
+        bits &= bits - 1; // Clear the lowest set bit
+    }
+    return count;
+}
+
+/**
+ * Returns the length of the UTF-8 sequence that begins at the given index,
+ * or 0 if the sequence is invalid (overlong, a surrogate, out of range or truncated).
+ */
+static inline auto utf8_sequence_length(String const *input, size_t index) -> size_t {
+    auto byte_at = [&](size_t i) { return static_cast<uint8_t>(input->data[i]); };
+    uint8_t lead = byte_at(index);
+    if (lead < 0x80) {
+        return 1;
+    }
+    // The second byte has a narrower range after some lead bytes, which rules out
+    // overlong encodings, surrogates and code points above U+10FFFF
+    size_t length = 0;
+    uint8_t second_min = 0x80;
+    uint8_t second_max = 0xBF;
+    if (lead >= 0xC2 && lead <= 0xDF) {
+        length = 2;
+    }
+    else if (lead >= 0xE0 && lead <= 0xEF) {
+        length = 3;
+        second_min = lead == 0xE0 ? 0xA0 : 0x80;
+        second_max = lead == 0xED ? 0x9F : 0xBF;
+    }
+    else if (lead >= 0xF0 && lead <= 0xF4) {
+        length = 4;
+        second_min = lead == 0xF0 ? 0x90 : 0x80;
+        second_max = lead == 0xF4 ? 0x8F : 0xBF;
+    }
+    else {
+        return 0;
+    }
+    if (index + length > input->length) {
+        return 0;
+    }
+    uint8_t second = byte_at(index + 1);
+    if (second < second_min || second > second_max) {
+        return 0;
+    }
+    for (size_t i = 2; i < length; i++) {
+        if ((byte_at(index + i) & 0xC0) != 0x80) {
+            return 0;
+        }
+    }
+    return length;
+}
+
+static auto validate_utf8_scalar(String const *input, size_t begin) -> size_t {
+    size_t i = begin;
+    while (i < input->length) {
+        size_t length = utf8_sequence_length(input, i);
+        if (length == 0) {
+            break;
+        }
+        i += length;
+    }
+    return i;
+}
+
+#if BLOOM_SCAN_X86
+
+/**
+ * Classifies 16 bytes at a time. SSE2 has no byte shuffle, so the class bits
+ * are computed with range comparisons that mirror the nibble tables.
+ */
+static inline auto classify_sse2(__m128i bytes) -> __m128i {
+    auto in_range = [](__m128i value, char low, char high) -> __m128i {
+        return _mm_and_si128(
+            _mm_cmpgt_epi8(value, _mm_set1_epi8(static_cast<char>(low - 1))),
+            _mm_cmplt_epi8(value, _mm_set1_epi8(static_cast<char>(high + 1)))
+        );
+    };
+    auto with_class = [](__m128i matches, uint8_t class_bits) -> __m128i {
+        return _mm_and_si128(matches, _mm_set1_epi8(static_cast<char>(class_bits)));
+    };
+    // Setting the 0x20 bit folds upper case letters to lower case
+    __m128i folded = _mm_or_si128(bytes, _mm_set1_epi8(0x20));
+
+    __m128i classes = with_class(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('\n')), CHAR_CLASS_NEWLINE);
+    classes = _mm_or_si128(classes, with_class(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(' ')), CHAR_CLASS_SPACE));
+    classes = _mm_or_si128(classes, with_class(in_range(bytes, '0', '9'), CHAR_CLASS_DIGIT));
+    classes = _mm_or_si128(classes, with_class(in_range(folded, 'a', 'o'), CHAR_CLASS_ALPHA_1_F));
+    classes = _mm_or_si128(classes, with_class(in_range(folded, 'p', 'z'), CHAR_CLASS_ALPHA_0_A));
+    classes = _mm_or_si128(classes, with_class(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('_')), CHAR_CLASS_UNDERSCORE));
+    // Bytes with the high bit set are negative as signed bytes
+    classes = _mm_or_si128(classes, with_class(_mm_cmplt_epi8(bytes, _mm_setzero_si128()), CHAR_CLASS_NON_ASCII));
+    return classes;
+}
+
+template<bool StopInClass>
+static auto scan_sse2(String const *input, size_t begin, uint8_t class_mask) -> size_t {
+    size_t constexpr BLOCK_SIZE = 16;
+    __m128i const mask = _mm_set1_epi8(static_cast<char>(class_mask));
+    __m128i const zero = _mm_setzero_si128();
+
+    size_t i = begin;
+    for (; i + BLOCK_SIZE <= input->length; i += BLOCK_SIZE) {
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<__m128i const*>(input->data + i));
+        __m128i outside = _mm_cmpeq_epi8(_mm_and_si128(classify_sse2(bytes), mask), zero);
+        uint32_t stops = static_cast<uint32_t>(_mm_movemask_epi8(outside));
+        if (StopInClass) {
+            stops = ~stops & 0xFFFF;
+        }
+        if (stops != 0) {
+            return i + __builtin_ctz(stops);
+        }
+    }
+    return scan_scalar<StopInClass>(input, i, class_mask);
+}
+
+static auto scan_until_string_delimiter_sse2(String const *input, size_t begin) -> size_t {
+    size_t constexpr BLOCK_SIZE = 16;
+    __m128i const quote = _mm_set1_epi8('"');
+    __m128i const backslash = _mm_set1_epi8('\\');
+    __m128i const newline = _mm_set1_epi8('\n');
+
+    size_t i = begin;
+    for (; i + BLOCK_SIZE <= input->length; i += BLOCK_SIZE) {
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<__m128i const*>(input->data + i));
+        __m128i delimiters = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(bytes, quote), _mm_cmpeq_epi8(bytes, backslash)),
+            _mm_cmpeq_epi8(bytes, newline)
+        );
+        uint32_t stops = static_cast<uint32_t>(_mm_movemask_epi8(delimiters));
+        if (stops != 0) {
+            return i + __builtin_ctz(stops);
+        }
+    }
+    return scan_until_string_delimiter_scalar(input, i);
+}
+
+/**
+ * Returns a mask with a bit set for every byte of the 16 byte block that is in the class.
+ */
+static inline auto block_class_mask_sse2(char const *data, uint8_t class_mask) -> uint32_t {
+    __m128i bytes = _mm_loadu_si128(reinterpret_cast<__m128i const*>(data));
+    __m128i classes = _mm_and_si128(classify_sse2(bytes), _mm_set1_epi8(static_cast<char>(class_mask)));
+    __m128i outside = _mm_cmpeq_epi8(classes, _mm_setzero_si128());
+    return ~static_cast<uint32_t>(_mm_movemask_epi8(outside)) & 0xFFFF;
+}
+
+static auto count_class_sse2(String const *input, size_t begin, uint8_t class_mask) -> size_t {
+    size_t constexpr BLOCK_SIZE = 16;
+    size_t count = 0;
+    size_t i = begin;
+    for (; i + BLOCK_SIZE <= input->length; i += BLOCK_SIZE) {
+        count += __builtin_popcount(block_class_mask_sse2(input->data + i, class_mask));
+    }
+    return count + count_class_scalar(input, i, class_mask);
+}
+
+static auto collect_class_offsets_sse2(
+    String const *input,
+    size_t begin,
+    uint8_t class_mask,
+    uint32_t *offsets
+) -> size_t {
+    size_t constexpr BLOCK_SIZE = 16;
+    size_t count = 0;
+    size_t i = begin;
+    for (; i + BLOCK_SIZE <= input->length; i += BLOCK_SIZE) {
+        count += write_mask_offsets(block_class_mask_sse2(input->data + i, class_mask), i, offsets + count);
+    }
+    return count + collect_class_offsets_scalar(input, i, class_mask, offsets + count);
+}
+
+/**
+ * Skips ASCII blocks of 16 bytes, and validates the sequences of other blocks
+ * one by one. SSE2 has no byte shuffle for the vectorized validation.
+ */
+static auto validate_utf8_sse2(String const *input, size_t begin) -> size_t {
+    size_t constexpr BLOCK_SIZE = 16;
+    size_t i = begin;
+    while (i + BLOCK_SIZE <= input->length) {
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<__m128i const*>(input->data + i));
+        if (_mm_movemask_epi8(bytes) == 0) {
+            i += BLOCK_SIZE;
+            continue;
+        }
+        // The last sequence may extend past the block, in which case the next block begins after it
+        size_t block_end = i + BLOCK_SIZE;
+        while (i < block_end) {
+            size_t length = utf8_sequence_length(input, i);
+            if (length == 0) {
+                return i;
+            }
+            i += length;
+        }
+    }
+    return validate_utf8_scalar(input, i);
+}
+
+/**
+ * Classifies 32 bytes at a time by looking up both nibbles of each byte
+ * from the class nibble tables.
+ */
+__attribute__((target("avx2")))
+static inline auto classify_avx2(__m256i bytes) -> __m256i {
+    __m256i const low_table = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128(reinterpret_cast<__m128i const*>(CHAR_CLASS_LOW_NIBBLE))
+    );
+    __m256i const high_table = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128(reinterpret_cast<__m128i const*>(CHAR_CLASS_HIGH_NIBBLE))
+    );
+    __m256i const nibble_mask = _mm256_set1_epi8(0x0F);
+
+    __m256i low = _mm256_and_si256(bytes, nibble_mask);
+    __m256i high = _mm256_and_si256(_mm256_srli_epi16(bytes, 4), nibble_mask);
+    return _mm256_and_si256(
+        _mm256_shuffle_epi8(low_table, low),
+        _mm256_shuffle_epi8(high_table, high)
+    );
+}
+
+template<bool StopInClass>
+__attribute__((target("avx2")))
+static auto scan_avx2(String const *input, size_t begin, uint8_t class_mask) -> size_t {
+    size_t constexpr BLOCK_SIZE = 32;
+    __m256i const mask = _mm256_set1_epi8(static_cast<char>(class_mask));
+    __m256i const zero = _mm256_setzero_si256();
+
+    size_t i = begin;
+    for (; i + BLOCK_SIZE <= input->length; i += BLOCK_SIZE) {
+        __m256i bytes = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(input->data + i));
+        __m256i outside = _mm256_cmpeq_epi8(_mm256_and_si256(classify_avx2(bytes), mask), zero);
+        uint32_t stops = static_cast<uint32_t>(_mm256_movemask_epi8(outside));
+        if (StopInClass) {
+            stops = ~stops;
+        }
+        if (stops != 0) {
+            return i + __builtin_ctz(stops);
+        }
+    }
+    return scan_scalar<StopInClass>(input, i, class_mask);
+}
+
+__attribute__((target("avx2")))
+static auto scan_until_string_delimiter_avx2(String const *input, size_t begin) -> size_t {
+    size_t constexpr BLOCK_SIZE = 32;
+    __m256i const quote = _mm256_set1_epi8('"');
+    __m256i const backslash = _mm256_set1_epi8('\\');
+    __m256i const newline = _mm256_set1_epi8('\n');
+
+    size_t i = begin;
+    for (; i + BLOCK_SIZE <= input->length; i += BLOCK_SIZE) {
+        __m256i bytes = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(input->data + i));
+        __m256i delimiters = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(bytes, quote), _mm256_cmpeq_epi8(bytes, backslash)),
+            _mm256_cmpeq_epi8(bytes, newline)
+        );
+        uint32_t stops = static_cast<uint32_t>(_mm256_movemask_epi8(delimiters));
+        if (stops != 0) {
+            return i + __builtin_ctz(stops);
+        }
+    }
+    return scan_until_string_delimiter_scalar(input, i);
+}
+
+/**
+ * Returns a mask with a bit set for every byte of the 32 byte block that is in the class.
+ */
+__attribute__((target("avx2")))
+static inline auto block_class_mask_avx2(char const *data, uint8_t class_mask) -> uint32_t {
+    __m256i bytes = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(data));
+    __m256i classes = _mm256_and_si256(classify_avx2(bytes), _mm256_set1_epi8(static_cast<char>(class_mask)));
+    __m256i outside = _mm256_cmpeq_epi8(classes, _mm256_setzero_si256());
+    return ~static_cast<uint32_t>(_mm256_movemask_epi8(outside));
+}
+
+__attribute__((target("avx2,popcnt")))
+static auto count_class_avx2(String const *input, size_t begin, uint8_t class_mask) -> size_t {
+    size_t constexpr BLOCK_SIZE = 32;
+    size_t count = 0;
+    size_t i = begin;
+    for (; i + BLOCK_SIZE <= input->length; i += BLOCK_SIZE) {
+        count += __builtin_popcount(block_class_mask_avx2(input->data + i, class_mask));
+    }
+    return count + count_class_scalar(input, i, class_mask);
+}
+
+__attribute__((target("avx2,bmi")))
+static auto collect_class_offsets_avx2(
+    String const *input,
+    size_t begin,
+    uint8_t class_mask,
+    uint32_t *offsets
+) -> size_t {
+    size_t constexpr BLOCK_SIZE = 32;
+    size_t count = 0;
+    size_t i = begin;
+    for (; i + BLOCK_SIZE <= input->length; i += BLOCK_SIZE) {
+        count += write_mask_offsets(block_class_mask_avx2(input->data + i, class_mask), i, offsets + count);
+    }
+    return count + collect_class_offsets_scalar(input, i, class_mask, offsets + count);
+}
+
+// Error bits of the vectorized UTF-8 validation. Each bit is set by the lookup of both
+// nibbles of a byte and the high nibble of the byte after it, and an error is reported
+// if all three agree. See "Validating UTF-8 In Less Than One Instruction Per Byte"
+// by John Keiser and Daniel Lemire.
+uint8_t constexpr UTF8_TOO_SHORT      = 1 << 0; // 11______ 0_______ or 11______ 11______
+uint8_t constexpr UTF8_TOO_LONG       = 1 << 1; // 0_______ 10______
+uint8_t constexpr UTF8_OVERLONG_3     = 1 << 2; // 11100000 100_____
+uint8_t constexpr UTF8_TOO_LARGE      = 1 << 3; // 11110100 1001____ and larger
+uint8_t constexpr UTF8_SURROGATE      = 1 << 4; // 11101101 101_____
+uint8_t constexpr UTF8_OVERLONG_2     = 1 << 5; // 1100000_ 10______
+uint8_t constexpr UTF8_TOO_LARGE_1000 = 1 << 6; // 11110101 1000____ and larger
+uint8_t constexpr UTF8_OVERLONG_4     = 1 << 6; // 11110000 1000____
+uint8_t constexpr UTF8_TWO_CONTS      = 1 << 7; // 10______ 10______
+uint8_t constexpr UTF8_CARRY          = UTF8_TOO_SHORT | UTF8_TOO_LONG | UTF8_TWO_CONTS;
+
+uint8_t constexpr UTF8_BYTE_1_HIGH[16] = {
+    // 0_______ ________
+    UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+    UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+    // 10______ ________
+    UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS,
+    // 1100____ ________
+    UTF8_TOO_SHORT | UTF8_OVERLONG_2,
+    // 1101____ ________
+    UTF8_TOO_SHORT,
+    // 1110____ ________
+    UTF8_TOO_SHORT | UTF8_OVERLONG_3 | UTF8_SURROGATE,
+    // 1111____ ________
+    UTF8_TOO_SHORT | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4,
+};
+
+uint8_t constexpr UTF8_BYTE_1_LOW[16] = {
+    // ____0000 ________
+    UTF8_CARRY | UTF8_OVERLONG_3 | UTF8_OVERLONG_2 | UTF8_OVERLONG_4,
+    // ____0001 ________
+    UTF8_CARRY | UTF8_OVERLONG_2,
+    // ____001_ ________
+    UTF8_CARRY,
+    UTF8_CARRY,
+    // ____0100 ________
+    UTF8_CARRY | UTF8_TOO_LARGE,
+    // ____0101 ________ and larger
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    // ____1101 ________
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_SURROGATE,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+};
+
+uint8_t constexpr UTF8_BYTE_2_HIGH[16] = {
+    // ________ 0_______
+    UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+    UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+    // ________ 1000____
+    UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4,
+    // ________ 1001____
+    UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 | UTF8_TOO_LARGE,
+    // ________ 101_____
+    UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE | UTF8_TOO_LARGE,
+    UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE | UTF8_TOO_LARGE,
+    // ________ 11______
+    UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+};
+
+struct Utf8ValidationState {
+    __m256i previous_block;
+    /**
+     * Non-zero if the previous block ends in the middle of a sequence.
+     */
+    __m256i previous_incomplete;
+};
+
+__attribute__((target("avx2")))
+static inline auto lookup_avx2(uint8_t const *table, __m256i indices) -> __m256i {
+    return _mm256_shuffle_epi8(
+        _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<__m128i const*>(table))),
+        indices
+    );
+}
+
+/**
+ * Returns the block shifted by N bytes towards higher indices, with the
+ * last N bytes of the previous block shifted in.
+ */
+template<int N>
+__attribute__((target("avx2")))
+static inline auto previous_bytes_avx2(__m256i block, __m256i previous_block) -> __m256i {
+    return _mm256_alignr_epi8(block, _mm256_permute2x128_si256(previous_block, block, 0x21), 16 - N);
+}
+
+/**
+ * Validates a block of 32 bytes, continuing from the previous block.
+ * @return Whether no error has been found so far.
+ */
+__attribute__((target("avx2")))
+static inline auto validate_utf8_block_avx2(Utf8ValidationState *state, __m256i block) -> bool {
+    __m256i const nibble_mask = _mm256_set1_epi8(0x0F);
+    __m256i errors;
+    if (_mm256_movemask_epi8(block) == 0) {
+        // An ASCII block can only complete an error, if the previous block ends in the middle of a sequence
+        errors = state->previous_incomplete;
+        state->previous_incomplete = _mm256_setzero_si256();
+    }
+    else {
+        __m256i previous_1 = previous_bytes_avx2<1>(block, state->previous_block);
+        __m256i byte_1_high = lookup_avx2(UTF8_BYTE_1_HIGH,
+            _mm256_and_si256(_mm256_srli_epi16(previous_1, 4), nibble_mask));
+        __m256i byte_1_low = lookup_avx2(UTF8_BYTE_1_LOW,
+            _mm256_and_si256(previous_1, nibble_mask));
+        __m256i byte_2_high = lookup_avx2(UTF8_BYTE_2_HIGH,
+            _mm256_and_si256(_mm256_srli_epi16(block, 4), nibble_mask));
+        __m256i special_cases = _mm256_and_si256(_mm256_and_si256(byte_1_high, byte_1_low), byte_2_high);
+
+        // The third and fourth bytes of 3 and 4 byte sequences must be continuations, and
+        // only them. Only bytes after a 111_____ or 1111____ lead get the high bit set here.
+        __m256i is_third_byte = _mm256_subs_epu8(
+            previous_bytes_avx2<2>(block, state->previous_block), _mm256_set1_epi8(static_cast<char>(0xE0 - 0x80)));
+        __m256i is_fourth_byte = _mm256_subs_epu8(
+            previous_bytes_avx2<3>(block, state->previous_block), _mm256_set1_epi8(static_cast<char>(0xF0 - 0x80)));
+        __m256i must_be_continuation = _mm256_and_si256(
+            _mm256_or_si256(is_third_byte, is_fourth_byte),
+            _mm256_set1_epi8(static_cast<char>(0x80))
+        );
+        errors = _mm256_xor_si256(must_be_continuation, special_cases);
+
+        // The last 3 bytes may begin a sequence that continues in the next block
+        __m256i const max_complete = _mm256_setr_epi8(
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+            static_cast<char>(0xF0 - 1), static_cast<char>(0xE0 - 1), static_cast<char>(0xC0 - 1)
+        );
+        state->previous_incomplete = _mm256_subs_epu8(block, max_complete);
+    }
+    state->previous_block = block;
+    return _mm256_testz_si256(errors, errors);
+}
+
+/**
+ * Validates 32 bytes at a time with the lookup algorithm, skipping the lookups for
+ * ASCII blocks. Once a block has an error, its exact position is found with the
+ * scalar validation.
+ */
+__attribute__((target("avx2")))
+static auto validate_utf8_avx2(String const *input, size_t begin) -> size_t {
+    size_t constexpr BLOCK_SIZE = 32;
+    Utf8ValidationState state = {
+        .previous_block = _mm256_setzero_si256(),
+        .previous_incomplete = _mm256_setzero_si256(),
+    };
+    size_t i = begin;
+    bool is_valid = true;
+    for (; i + BLOCK_SIZE <= input->length; i += BLOCK_SIZE) {
+        __m256i block = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(input->data + i));
+        is_valid = validate_utf8_block_avx2(&state, block);
+        if (!is_valid) {
+            break;
+        }
+    }
+    if (is_valid) {
+        // Pad the rest of the input with zeros, which also reveals a truncated sequence at the end
+        char rest[BLOCK_SIZE] = {};
+        memcpy(rest, input->data + i, input->length - i);
+        __m256i block = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(rest));
+        if (validate_utf8_block_avx2(&state, block)) {
+            return input->length;
+        }
+    }
+    // The error may be in a sequence that began in the last 3 bytes of the previous
+    // block, so begin the scalar validation from the first byte of that sequence
+    size_t sequence_begin = i;
+    for (size_t j = i; j > begin && j + 3 > i; j--) {
+        uint8_t byte = static_cast<uint8_t>(input->data[j - 1]);
+        if (byte < 0x80) {
+            break;
+        }
+        if (byte >= 0xC0) {
+            sequence_begin = j - 1;
+            break;
+        }
+    }
+    return validate_utf8_scalar(input, sequence_begin);
+}
+
+#endif // BLOOM_SCAN_X86
+
+struct ScanImplementation {
+    char const *name;
+    size_t (*scan_while_class)(String const *input, size_t begin, uint8_t class_mask);
+    size_t (*scan_until_class)(String const *input, size_t begin, uint8_t class_mask);
+    size_t (*scan_until_string_delimiter)(String const *input, size_t begin);
+    size_t (*count_class)(String const *input, size_t begin, uint8_t class_mask);
+    size_t (*collect_class_offsets)(String const *input, size_t begin, uint8_t class_mask, uint32_t *offsets);
+    size_t (*validate_utf8)(String const *input, size_t begin);
+};
+
+/**
+ * Selects the widest scanning implementation the current CPU supports.
+ */
+static auto select_scan_implementation() -> ScanImplementation {
+#if BLOOM_SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt") && __builtin_cpu_supports("bmi")) {
+        return {
+            "avx2",
+            scan_avx2<false>,
+            scan_avx2<true>,
+            scan_until_string_delimiter_avx2,
+            count_class_avx2,
+            collect_class_offsets_avx2,
+            validate_utf8_avx2,
+        };
+    }
+    // SSE2 is always available on x86-64
+    return {
+        "sse2",
+        scan_sse2<false>,
+        scan_sse2<true>,
+        scan_until_string_delimiter_sse2,
+        count_class_sse2,
+        collect_class_offsets_sse2,
+        validate_utf8_sse2,
+    };
+#else
+    return {
+        "scalar",
+        scan_scalar<false>,
+        scan_scalar<true>,
+        scan_until_string_delimiter_scalar,
+        count_class_scalar,
+        collect_class_offsets_scalar,
+        validate_utf8_scalar,
+    };
+#endif // BLOOM_SCAN_X86
+}
+
+static ScanImplementation const SCAN_IMPLEMENTATION = select_scan_implementation();
+
+auto scan_while_class(String const *input, size_t begin, uint8_t class_mask) -> size_t {
+    return SCAN_IMPLEMENTATION.scan_while_class(input, begin, class_mask);
+}
+
+auto scan_until_class(String const *input, size_t begin, uint8_t class_mask) -> size_t {
+    return SCAN_IMPLEMENTATION.scan_until_class(input, begin, class_mask);
+}
+
+auto scan_until_string_delimiter(String const *input, size_t begin) -> size_t {
+    return SCAN_IMPLEMENTATION.scan_until_string_delimiter(input, begin);
+}
+
+auto count_class(String const *input, size_t begin, uint8_t class_mask) -> size_t {
+    return SCAN_IMPLEMENTATION.count_class(input, begin, class_mask);
+}
+
+auto collect_class_offsets(
+    String const *input,
+    size_t begin,
+    uint8_t class_mask,
+    uint32_t *offsets
+) -> size_t {
+    return SCAN_IMPLEMENTATION.collect_class_offsets(input, begin, class_mask, offsets);
+}
+
+auto validate_utf8(String const *input, size_t begin) -> size_t {
+    return SCAN_IMPLEMENTATION.validate_utf8(input, begin);
+}
+
+auto scan_implementation_name() -> char const* {
+    return SCAN_IMPLEMENTATION.name;
+}
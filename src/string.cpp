@@ -38,9 +38,22 @@ auto contains_str(String *str, char c) -> bool {
     return false;
 }
 
+/**
+ * Grows the arena allocation of an arena-backed dynamic string by the given length.
+ */
+static auto grow_dynamic_str(DynamicString *str, size_t length) -> void {
+    if (str->allocator == nullptr) {
+        return;
+    }
+    assert(str->data + str->length == reinterpret_cast<char*>(str->allocator->data + str->allocator->offset) &&
+        "DynamicString must be the last allocation of its arena");
+    (void)allocate_array<char>(str->allocator, length);
+}
+
 auto push_str(DynamicString *str, char value) -> size_t {
     assert (str->length + 1 < str->max_length &&
         "Not enough space in DynamicString to push new value");
+    grow_dynamic_str(str, 1);
     str->data[str->length] = value;
     str->length += 1;
     return 1;
@@ -49,6 +62,7 @@ auto push_str(DynamicString *str, String *value) -> size_t {
     size_t const value_len = value->length;
     assert (str->length + value_len < str->max_length &&
         "Not enough space in DynamicString to push new value");
+    grow_dynamic_str(str, value_len);
     memcpy(str->data + str->length, value->data, value_len * sizeof(char));
     str->length += value_len;
     return value_len;
@@ -0,0 +1,129 @@
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <bloom/threads.h>
+
+struct ThreadPoolJob {
+    void (*task)(void *context, size_t index);
+    void *context;
+    size_t task_count;
+};
+
+/**
+ * A fixed set of worker threads that all work on the current job until
+ * every task of it has been claimed.
+ */
+struct ThreadPool {
+    std::mutex mutex;
+    std::condition_variable job_posted;
+    std::condition_variable job_finished;
+
+    ThreadPoolJob job = {};
+    std::atomic<size_t> next_task_index{0};
+    size_t finished_task_count = 0;
+    /**
+     * The number of threads currently claiming tasks. A new job is only
+     * posted once this is 0, so no thread ever works on a stale job.
+     */
+    size_t active_thread_count = 0;
+    /**
+     * Incremented for every posted job, so that sleeping workers can tell a new job apart.
+     */
+    size_t job_generation = 0;
+
+    size_t thread_count = 1;
+};
+
+/**
+ * Claims and runs tasks of the given job until none are left.
+ * Must be called with the pool mutex unlocked and the thread counted as active.
+ */
+static auto run_tasks(ThreadPool *pool, ThreadPoolJob job) -> void {
+    size_t finished = 0;
+    while (true) {
+        size_t index = pool->next_task_index.fetch_add(1, std::memory_order_relaxed);
+        if (index >= job.task_count) {
+            break;
+        }
+        job.task(job.context, index);
+        finished++;
+    }
+    std::lock_guard<std::mutex> lock(pool->mutex);
+    pool->finished_task_count += finished;
+    pool->active_thread_count--;
+    if (pool->active_thread_count == 0) {
+        pool->job_finished.notify_all();
+    }
+}
+
+static auto worker_main(ThreadPool *pool) -> void {
+    size_t seen_generation = 0;
+    while (true) {
+        ThreadPoolJob job;
+        {
+            std::unique_lock<std::mutex> lock(pool->mutex);
+            pool->job_posted.wait(lock, [&] { return pool->job_generation != seen_generation; });
+            seen_generation = pool->job_generation;
+            job = pool->job;
+            pool->active_thread_count++;
+        }
+        run_tasks(pool, job);
+    }
+}
+
+static auto get_thread_pool() -> ThreadPool* {
+    static ThreadPool *pool = [] {
+        auto *pool = new ThreadPool();
+        size_t hardware_threads = std::thread::hardware_concurrency();
+        pool->thread_count = hardware_threads > 0 ? hardware_threads : 1;
+        // The calling thread is one of the workers
+        for (size_t i = 1; i < pool->thread_count; i++) {
+            std::thread(worker_main, pool).detach();
+        }
+        return pool;
+    }();
+    return pool;
+}
+
+auto worker_thread_count() -> size_t {
+    return get_thread_pool()->thread_count;
+}
+
+auto parallel_for(size_t count, void (*task)(void *context, size_t index), void *context) -> void {
+    if (count == 0) {
+        return;
+    }
+    ThreadPool *pool = get_thread_pool();
+    if (count == 1 || pool->thread_count == 1) {
+        for (size_t i = 0; i < count; i++) {
+            task(context, i);
+        }
+        return;
+    }
+
+    ThreadPoolJob job = {
+        .task = task,
+        .context = context,
+        .task_count = count,
+    };
+    {
+        // A worker that woke up late for the previous job may still be claiming
+        // tasks of it, so wait for it before resetting the task index
+        std::unique_lock<std::mutex> lock(pool->mutex);
+        pool->job_finished.wait(lock, [&] { return pool->active_thread_count == 0; });
+        pool->job = job;
+        pool->finished_task_count = 0;
+        pool->next_task_index.store(0, std::memory_order_relaxed);
+        pool->active_thread_count++;
+        pool->job_generation++;
+    }
+    pool->job_posted.notify_all();
+
+    run_tasks(pool, job);
+
+    std::unique_lock<std::mutex> lock(pool->mutex);
+    pool->job_finished.wait(lock, [&] {
+        return pool->finished_task_count == count && pool->active_thread_count == 0;
+    });
+}
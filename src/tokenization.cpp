@@ -1,234 +1,770 @@
-#include <cctype>
 #include <cstdio>
-#include <bloom/defer.h>
+#include <bloom/diagnostics.h>
+#include <bloom/numbers.h>
 #include <bloom/print.h>
+#include <bloom/scanning.h>
+#include <bloom/threads.h>
 #include <bloom/tokenization.h>
-#include <cstring>
 
-static auto next_char_or_null_char(String *str, size_t current_index) -> char {
-    if (current_index + 1 < str->length) {
-        return char_at(str, current_index + 1);
-    } else {
-        return '\0';
+template<typename ElementType>
+static inline auto to_array(AllocatedArrayBlock<ElementType> *block) -> Array<ElementType> {
+    return Array<ElementType>(block->data, block->length);
+}
+
+/**
+ * Validates the input as UTF-8 from the given offset on,
+ * and reports the first invalid sequence as a fatal error.
+ */
+static auto expect_valid_utf8(String const *input, size_t begin) -> void {
+    size_t invalid_offset = validate_utf8(input, begin);
+    if (invalid_offset < input->length) {
+        print_source_error(input, static_cast<uint32_t>(invalid_offset), "Invalid UTF-8 encoding");
+        exit(1);
     }
 }
 
-static inline auto to_array(AllocatedArrayBlock<Token> *tokens_block) -> Array<Token> {
-    return Array<Token>(tokens_block->data, tokens_block->length);
+auto lexer_from_input(String *input, SymbolTable *symbols) -> Lexer {
+    assert(input->length <= MAX_SOURCE_LENGTH &&
+        "Input is too large for 32-bit token offsets");
+    expect_valid_utf8(input, 0);
+    return Lexer {
+        .input = *input,
+        .offset = 0,
+        .first_indentation_space_count = 0,
+        .raw_indentation = false,
+        .symbols = symbols,
+    };
 }
 
 /**
- * Tokenizes the input string into an array of tokens.
- *
- * The tokens are stored in an ArenaAllocator for efficient memory management.
+ * Converts a number of indentation spaces into an indentation level.
+ * The first indentation of the input determines the width of a single level.
  */
-auto tokenize(String *input, ArenaAllocator *allocator) -> Array<Token> {
-    // Allocate initially based on the input string length and
-    // shrink the allocation later once the final token count is known
-    auto tokens_block = allocate_array<Token>(allocator, input->length);
-    auto result = to_array(&tokens_block);
+static auto indentation_level(size_t *first_indentation_space_count, size_t space_count) -> size_t {
+    if (*first_indentation_space_count == 0) {
+        *first_indentation_space_count = space_count;
+    }
+    // Ensure the indentation is not inconsistent. If it is, create an error
+    if ((space_count % *first_indentation_space_count) != 0) {
+        eprint("Inconsistent indentation\n");
+        exit(1);
+    }
+    return space_count / *first_indentation_space_count;
+}
 
-    size_t const COL_BEGIN = 1;
+/**
+ * Completes a token that spans the input from begin (inclusive) to end (exclusive)
+ * and moves the lexer past it.
+ */
+static inline auto emit_token(Lexer *lexer, Token &&token, size_t begin, size_t end) -> Token {
+    token.offset = static_cast<uint32_t>(begin);
+    lexer->offset = end;
+    return token;
+}
 
-    Token::Position current_position = {
-        .col = COL_BEGIN,
-        .line = 1,
-    };
-    size_t current_token_index = 0;
-    size_t first_indentation_space_count = 0;
+auto lexer_next(Lexer *lexer) -> Token {
+    char const *data = lexer->input.data;
+    size_t const length = lexer->input.length;
 
-    auto append_token = [&](Token &&token) {
-        token.position = current_position;
-        result[current_token_index] = token;
-        current_token_index++;
-    };
-    auto append_token_of_type = [&](TokenType token_type) {
-        result[current_token_index] = {
-            .type = token_type,
-            .position = current_position
-        };
-        current_token_index++;
-    };
+    // Skip single spaces and unknown characters until a token begins
+    for (size_t i = lexer->offset; i < length; i++) {
+        char c = data[i];
+        switch (c) {
+            case static_cast<char>(TokenType::NEWLINE):
+                return emit_token(lexer, { .type = TokenType::NEWLINE }, i, i + 1);
+            case ' ': {
+                size_t space_end = scan_while_class(&lexer->input, i, CHAR_CLASS_SPACE);
+                size_t indentation = space_end - i;
+                if (indentation == 1) {
+                    continue;
+                }
 
-    for (size_t i = 0; i < input->length; i++) {
-        char c = char_at(input, i);
-        if (isalpha(c) || c == '_') {
-            // Expect an identifier
-            auto begin = i;
-            while (i + 1 < input->length) {
-                size_t next_i = i + 1;
-                // Keep going if the next character is an alphabet
-                if (isalnum(char_at(input, next_i)) || char_at(input, next_i) == '_') {
-                    i++;
-                } else {
-                    break;
+                size_t level = lexer->raw_indentation
+                    ? indentation
+                    : indentation_level(&lexer->first_indentation_space_count, indentation);
+
+                return emit_token(lexer, {
+                    .type = TokenType::INDENT,
+                    .indent = {
+                        .level = level,
+                    }
+                }, i, space_end);
+            }
+            case static_cast<char>(TokenType::COMMA):
+            case static_cast<char>(TokenType::ADD):
+            case static_cast<char>(TokenType::MULTIPLY):
+            case static_cast<char>(TokenType::DIVIDE):
+            case static_cast<char>(TokenType::MODULO):
+            case static_cast<char>(TokenType::BRACE_CLOSE):
+            case static_cast<char>(TokenType::BRACE_OPEN):
+            case static_cast<char>(TokenType::PARENTHESIS_CLOSE):
+            case static_cast<char>(TokenType::PARENTHESIS_OPEN):
+                // Single character tokens use their ASCII code as the token type
+                return emit_token(lexer, { .type = static_cast<TokenType>(c) }, i, i + 1);
+            case '-':
+                if (i + 1 < length && data[i + 1] == '>') {
+                    return emit_token(lexer, { .type = TokenType::ARROW }, i, i + 2);
+                }
+                return emit_token(lexer, { .type = TokenType::SUBTRACT }, i, i + 1);
+            case '<':
+            case '>': {
+                // Comparisons are either the character alone or followed by '='
+                bool is_less = c == '<';
+                if (i + 1 < length && data[i + 1] == '=') {
+                    return emit_token(lexer, {
+                        .type = is_less ? TokenType::LESS_EQUAL : TokenType::GREATER_EQUAL
+                    }, i, i + 2);
+                }
+                return emit_token(lexer, { .type = static_cast<TokenType>(c) }, i, i + 1);
+            }
+            case '=':
+            case '!':
+                // Equality comparisons are the only tokens that begin with these
+                if (i + 1 < length && data[i + 1] == '=') {
+                    return emit_token(lexer, {
+                        .type = c == '=' ? TokenType::EQUAL : TokenType::NOT_EQUAL
+                    }, i, i + 2);
+                }
+                continue;
+            case ':': {
+                char next_char = i + 1 < length ? data[i + 1] : '\0';
+                switch (next_char) {
+                    case ':':
+                        return emit_token(lexer, { .type = TokenType::CONST_DEF }, i, i + 2);
+                    case '=':
+                        return emit_token(lexer, { .type = TokenType::VAR_DEF }, i, i + 2);
+                    default:
+                        return emit_token(lexer, { .type = TokenType::TYPE_SEPARATOR }, i, i + 1);
+                }
+            }
+            case '"': {
+                // Expect a string literal. String literals can't span lines,
+                // which keeps lines independent of each other for chunked lexing.
+                // Escape sequences are only validated here, and the content is
+                // left as is for the consumers to decode if they need the bytes.
+                auto begin = i + 1;
+                auto end = scan_until_string_delimiter(&lexer->input, begin);
+                bool has_escapes = false;
+                while (end < length && data[end] == '\\') {
+                    if (end + 1 >= length || string_escape_value(data[end + 1]) < 0) {
+                        print_source_error(&lexer->input, static_cast<uint32_t>(end),
+                            "Invalid escape sequence in string literal");
+                        exit(1);
+                    }
+                    has_escapes = true;
+                    end = scan_until_string_delimiter(&lexer->input, end + 2);
+                }
+                if (end >= length || data[end] != '"') {
+                    print_source_error(&lexer->input, static_cast<uint32_t>(i),
+                        "Unterminated string literal");
+                    exit(1);
                 }
+                return emit_token(lexer, {
+                    .type = TokenType::STRING_LITERAL,
+                    .string_literal = {
+                        .content = String::from_data_and_length(
+                            data + begin,
+                            end - begin
+                        ),
+                        .has_escapes = has_escapes,
+                    },
+                }, i, end + 1); // Skip the closing quote
             }
-            auto end = i;
-            auto identifier_len = end - begin + 1;
+            default:
+                break;
+        }
 
-            defer(current_position.col += identifier_len);
+        uint8_t c_class = char_class(c);
+        if (c_class & CHAR_CLASS_IDENTIFIER_BEGIN) {
+            // Expect an identifier
+            auto begin = i;
+            auto end = scan_while_class(&lexer->input, i + 1, CHAR_CLASS_IDENTIFIER);
+            auto identifier_len = end - begin;
 
             // If the text is a keyword
-            if (identifier_len == 4) {
-                if (strncmp(input->data + begin, TOKEN_KEYWORD_PASS, identifier_len) == 0) {
-                    append_token_of_type(TokenType::KEYWORD_PASS);
-                    continue;
-                }
-                if (strncmp(input->data + begin, TOKEN_KEYWORD_PROC, identifier_len) == 0) {
-                    append_token_of_type(TokenType::KEYWORD_PROC);
-                    continue;
-                }
+            if (
+                TokenType keyword = keyword_type(data + begin, identifier_len);
+                keyword != TokenType::IDENTIFIER
+            ) {
+                return emit_token(lexer, { .type = keyword }, begin, end);
             }
 
             // If the text wasn't a keyword, treat it as a regular identifier
-            append_token({
+            auto content = String::from_data_and_length(data + begin, identifier_len);
+            return emit_token(lexer, {
                 .type = TokenType::IDENTIFIER,
-                .position = current_position,
                 .identifier = {
-                    .content = String::from_data_and_length(
-                        input->data + begin,
-                        identifier_len
-                    )
+                    .content = content,
+                    .symbol = intern_symbol(lexer->symbols, &content),
                 }
-            });
-        }
-        else if (c == static_cast<char>(TokenType::COMMA)) {
-            append_token_of_type(TokenType::COMMA);
-            current_position.col += 1;
-        }
-        else if (c == static_cast<char>(TokenType::NEWLINE)) {
-            append_token_of_type(TokenType::NEWLINE);
-            current_position.line++;
-            current_position.col = COL_BEGIN;
-        }
-        else if (c == ' ') {
-            if (char next_char = next_char_or_null_char(input, i); next_char == ' ') {
-                i++;
-                // 2 for the number of spaces that were consumed already
-                size_t space_begin = i - 2;
-                do {
-                    i++;
-                    next_char = next_char_or_null_char(input, i);
-                } while (next_char == ' ');
-
-                size_t indentation = i - space_begin;
-                if (first_indentation_space_count == 0) {
-                    first_indentation_space_count = indentation;
+            }, begin, end);
+        }
+        if (c_class & CHAR_CLASS_DIGIT) {
+            // Expect an integer literal. Prefixes, separators and hex digits
+            // are all identifier characters, and anything invalid among them is
+            // reported instead of being split into another token.
+            auto begin = i;
+            auto end = scan_while_class(&lexer->input, i + 1, CHAR_CLASS_IDENTIFIER);
+            uint64_t value = 0;
+            auto status = parse_integer_literal(data + begin, end - begin, &value);
+            if (status != IntegerLiteralStatus::OK) {
+                print_source_error(&lexer->input, static_cast<uint32_t>(begin), to_string(status));
+                exit(1);
+            }
+            return emit_token(lexer, {
+                .type = TokenType::INTEGER_LITERAL,
+                .integer_literal = {
+                    .uvalue = value,
+                    .is_unsigned = value > INT64_MAX,
                 }
-                size_t level = first_indentation_space_count / indentation;
+            }, begin, end);
+        }
+    }
 
-                // Ensure the indentation is not inconsistent. If it is, create an error
-                if ((first_indentation_space_count % indentation) != 0) {
-                    eprint("Inconsistent indentation\n");
-                    exit(1);
-                }
+    return emit_token(lexer, { .type = TokenType::END }, length, length);
+}
 
-                append_token({
-                    .type = TokenType::INDENT,
-                    .indent = {
-                        .level = level,
-                    }
-                });
-                current_position.col += indentation;
-            }
-            else {
-                current_position.col += 1;
+auto token_store_payload_count_before(TokenStore *store, size_t index) -> size_t {
+    size_t block_begin = index - (index % TOKEN_STORE_RANK_BLOCK_SIZE);
+    size_t payload_count = store->payload_ranks[index / TOKEN_STORE_RANK_BLOCK_SIZE];
+    for (size_t i = block_begin; i < index; i++) {
+        payload_count += token_has_payload(store->types.data[i]);
+    }
+    return payload_count;
+}
+
+auto token_store_payload_index(TokenStore *store, size_t index) -> size_t {
+    assert(token_has_payload(store->types[index]) &&
+        "Token at the given index doesn't carry a payload");
+    return token_store_payload_count_before(store, index);
+}
+
+/**
+ * Copies a token's value into a token store payload.
+ */
+static inline auto to_payload(Token const *token) -> TokenPayload {
+    TokenPayload payload = {};
+    switch (token->type) {
+        case TokenType::IDENTIFIER:
+            payload.identifier.symbol = token->identifier.symbol;
+            payload.identifier.length = static_cast<uint32_t>(token->identifier.content.length);
+            break;
+        case TokenType::INDENT:
+            payload.indent_level = token->indent.level;
+            break;
+        case TokenType::INTEGER_LITERAL:
+            payload.integer.value = token->integer_literal.uvalue;
+            payload.integer.is_unsigned = token->integer_literal.is_unsigned;
+            break;
+        case TokenType::STRING_LITERAL:
+            payload.string_literal.length = static_cast<uint32_t>(token->string_literal.content.length);
+            payload.string_literal.has_escapes = token->string_literal.has_escapes;
+            break;
+        default:
+            assert(false && "Token type doesn't carry a payload");
+    }
+    return payload;
+}
+
+/**
+ * Materializes a token from its type, offset and payload (if the type carries one).
+ */
+static inline auto from_store_entry(
+    String const *source,
+    TokenType type,
+    uint32_t offset,
+    TokenPayload const *payload
+) -> Token {
+    Token token = {
+        .type = type,
+        .offset = offset,
+    };
+    switch (type) {
+        case TokenType::IDENTIFIER:
+            token.identifier.content = String::from_data_and_length(
+                source->data + offset,
+                payload->identifier.length
+            );
+            token.identifier.symbol = payload->identifier.symbol;
+            break;
+        case TokenType::INDENT:
+            token.indent.level = payload->indent_level;
+            break;
+        case TokenType::INTEGER_LITERAL:
+            token.integer_literal.uvalue = payload->integer.value;
+            token.integer_literal.is_unsigned = payload->integer.is_unsigned;
+            break;
+        case TokenType::STRING_LITERAL:
+            // The content begins after the opening quote
+            token.string_literal.content = String::from_data_and_length(
+                source->data + offset + 1,
+                payload->string_literal.length
+            );
+            token.string_literal.has_escapes = payload->string_literal.has_escapes;
+            break;
+        default:
+            break;
+    }
+    return token;
+}
+
+auto token_at(TokenStore *store, size_t index) -> Token {
+    TokenType type = store->types[index];
+    TokenPayload const *payload = token_has_payload(type)
+        ? &store->payloads[token_store_payload_index(store, index)]
+        : nullptr;
+    return from_store_entry(&store->source, type, store->offsets[index], payload);
+}
+
+auto token_stream_from_lexer(Lexer *lexer) -> TokenStream {
+    TokenStream stream = {};
+    stream.source = lexer->input;
+    stream.lexer = lexer;
+    return stream;
+}
+
+auto token_stream_from_store(TokenStore *store) -> TokenStream {
+    assert(store->types.length > 0 &&
+        store->types[store->types.length - 1] == TokenType::END &&
+        "Token store should end with an END token");
+    TokenStream stream = {};
+    stream.source = store->source;
+    stream.store = store;
+    stream.store_end = store->types.length - 1;
+    return stream;
+}
+
+auto token_stream_from_store_range(TokenStore *store, size_t begin, size_t end) -> TokenStream {
+    assert(begin <= end && end < store->types.length &&
+        "Token store range out of bounds");
+    TokenStream stream = token_stream_from_store(store);
+    stream.next_index = begin;
+    stream.lexed_count = begin;
+    stream.store_payload_index = token_store_payload_count_before(store, begin);
+    stream.store_end = end;
+    return stream;
+}
+
+/**
+ * Reads the next token of a store-backed stream. Reading past the end of
+ * the stream keeps returning an END token, like the lexer does.
+ */
+static inline auto next_store_token(TokenStream *stream) -> Token {
+    TokenStore *store = stream->store;
+    size_t index = stream->lexed_count;
+    if (index >= stream->store_end) {
+        return Token {
+            .type = TokenType::END,
+            .offset = store->offsets.data[stream->store_end],
+        };
+    }
+    TokenType type = store->types.data[index];
+    TokenPayload const *payload = nullptr;
+    if (token_has_payload(type)) {
+        payload = &store->payloads[stream->store_payload_index++];
+    }
+    return from_store_entry(&store->source, type, store->offsets.data[index], payload);
+}
+
+auto stream_fill(TokenStream *stream, size_t lexed_count) -> void {
+    // Keep the previously consumed token in the window
+    assert(lexed_count - stream->next_index < TOKEN_STREAM_WINDOW_SIZE &&
+        "Token stream window overflow");
+    while (stream->lexed_count < lexed_count) {
+        Token *slot = &stream->window[stream->lexed_count & (TOKEN_STREAM_WINDOW_SIZE - 1)];
+        *slot = stream->lexer != nullptr
+            ? lexer_next(stream->lexer)
+            : next_store_token(stream);
+        if (stream->on_token != nullptr) {
+            stream->on_token(stream, slot);
+        }
+        stream->lexed_count++;
+    }
+}
+
+auto stream_skip_statement(TokenStream *stream) -> void {
+    if (stream->store == nullptr) {
+        while (true) {
+            TokenType type = stream_peek(stream)->type;
+            if (type == TokenType::NEWLINE || type == TokenType::END) {
+                return;
             }
+            (void)stream_next(stream);
         }
-        else if (isdigit(c)) {
-            // Expect an integer literal
-            auto begin = i;
-            while (i + 1 < input->length) {
-                // Keep going if the next character is a digit
-                if (isdigit(char_at(input, i + 1))) {
-                    i++;
-                } else {
-                    break;
+    }
+
+    TokenStore *store = stream->store;
+    if (stream->next_index >= stream->store_end) {
+        // At the end, where an END token is returned on every read
+        return;
+    }
+    size_t end_index = store->statement_ends[stream->next_index];
+    if (end_index > stream->store_end) {
+        end_index = stream->store_end;
+    }
+    if (end_index < stream->lexed_count) {
+        // Already in the window
+        stream->next_index = end_index;
+        return;
+    }
+    stream->next_index = end_index;
+    stream->lexed_count = end_index;
+    stream->store_payload_index = token_store_payload_count_before(store, end_index);
+}
+
+auto stream_prev_paren_is_unmatched(TokenStream *stream) -> bool {
+    assert(stream_prev(stream)->type == TokenType::PARENTHESIS_OPEN &&
+        "Previous token should be an opening parenthesis");
+    if (stream->store == nullptr) {
+        return false;
+    }
+    return stream->store->matching_parens[stream->next_index - 1] == TOKEN_INDEX_NONE;
+}
+
+/**
+ * Lexes tokens until the END token into the given arrays, which must be large enough.
+ *
+ * The parenthesis and statement end tables are filled in on the way. While a statement
+ * is open, the entries of its unclosed opening parentheses link to the previous unclosed
+ * one, which makes them a stack that doesn't need any memory of its own.
+ *
+ * @return The number of tokens (including the END token) and payloads lexed.
+ */
+static auto lex_into(
+    Lexer *lexer,
+    TokenType *types,
+    uint32_t *offsets,
+    TokenPayload *payloads,
+    uint32_t *matching_parens,
+    uint32_t *statement_ends,
+    size_t *payload_count
+) -> size_t {
+    size_t token_count = 0;
+    size_t statement_begin = 0;
+    uint32_t open_paren = TOKEN_INDEX_NONE;
+    *payload_count = 0;
+    while (true) {
+        Token token = lexer_next(lexer);
+        uint32_t index = static_cast<uint32_t>(token_count);
+        types[token_count] = token.type;
+        offsets[token_count] = token.offset;
+        token_count++;
+        if (token_has_payload(token.type)) {
+            payloads[(*payload_count)++] = to_payload(&token);
+        }
+
+        switch (token.type) {
+            case TokenType::PARENTHESIS_OPEN:
+                matching_parens[index] = open_paren;
+                open_paren = index;
+                break;
+            case TokenType::PARENTHESIS_CLOSE:
+                matching_parens[index] = open_paren;
+                if (open_paren != TOKEN_INDEX_NONE) {
+                    uint32_t enclosing_paren = matching_parens[open_paren];
+                    matching_parens[open_paren] = index;
+                    open_paren = enclosing_paren;
                 }
-            }
-            auto end = i;
-            append_token({
-                .type = TokenType::INTEGER_LITERAL,
-                .integer_literal = {
-                    .value = strtol(input->data + begin, nullptr, 10)
+                break;
+            case TokenType::NEWLINE:
+            case TokenType::END:
+                matching_parens[index] = TOKEN_INDEX_NONE;
+                // Parentheses that are still open are unmatched
+                while (open_paren != TOKEN_INDEX_NONE) {
+                    uint32_t enclosing_paren = matching_parens[open_paren];
+                    matching_parens[open_paren] = TOKEN_INDEX_NONE;
+                    open_paren = enclosing_paren;
                 }
-            });
-            current_position.col += (end - begin + 1);
-        }
-        else if (c == '-') {
-            if (char next_char = next_char_or_null_char(input, i); next_char == '>') {
-                i++;
-                append_token_of_type(TokenType::ARROW);
-                current_position.col += 2;
+                for (size_t i = statement_begin; i <= index; i++) {
+                    statement_ends[i] = index;
+                }
+                statement_begin = token_count;
+                break;
+            default:
+                matching_parens[index] = TOKEN_INDEX_NONE;
+                break;
+        }
+
+        if (token.type == TokenType::END) {
+            break;
+        }
+    }
+    return token_count;
+}
+
+/**
+ * Fills in the payload rank of every block of TOKEN_STORE_RANK_BLOCK_SIZE tokens.
+ */
+static auto compute_payload_ranks(TokenStore *store) -> void {
+    size_t payload_count = 0;
+    for (size_t i = 0; i < store->types.length; i++) {
+        if (i % TOKEN_STORE_RANK_BLOCK_SIZE == 0) {
+            store->payload_ranks.data[i / TOKEN_STORE_RANK_BLOCK_SIZE] = payload_count;
+        }
+        payload_count += token_has_payload(store->types.data[i]);
+    }
+}
+
+struct TokenStoreBlocks {
+    AllocatedArrayBlock<uint32_t> offsets;
+    AllocatedArrayBlock<uint32_t> matching_parens;
+    AllocatedArrayBlock<uint32_t> statement_ends;
+    AllocatedArrayBlock<TokenType> types;
+    AllocatedArrayBlock<TokenPayload> payloads;
+};
+
+/**
+ * Allocates blocks large enough for tokenizing an input of the given length.
+ * The payload block is allocated last, so that it can be shrunk once the final
+ * payload count is known. Only the used parts of the other blocks are ever written.
+ */
+static auto allocate_token_store_blocks(ArenaAllocator *allocator, size_t input_length) -> TokenStoreBlocks {
+    // +1 for the END token
+    size_t const max_token_count = input_length + 1;
+    // Tokens that carry a payload are always separated by at least one byte
+    size_t const max_payload_count = input_length / 2 + 1;
+    TokenStoreBlocks blocks;
+    blocks.offsets = allocate_array<uint32_t>(allocator, max_token_count);
+    blocks.matching_parens = allocate_array<uint32_t>(allocator, max_token_count);
+    blocks.statement_ends = allocate_array<uint32_t>(allocator, max_token_count);
+    blocks.types = allocate_array<TokenType>(allocator, max_token_count);
+    blocks.payloads = allocate_array<TokenPayload>(allocator, max_payload_count);
+    return blocks;
+}
+
+/**
+ * A range of lines that is tokenized by a single thread.
+ */
+struct TokenChunk {
+    size_t begin;
+    size_t end;
+    TokenStoreBlocks blocks;
+    size_t token_count;
+    size_t payload_count;
+    /**
+     * The index of the chunk's first token and payload in the stitched store.
+     */
+    size_t token_base;
+    size_t payload_base;
+};
+
+/**
+ * Splits the input into chunks that begin at line starts.
+ * @return The number of chunks.
+ */
+static auto split_into_chunks(String *input, Array<TokenChunk> chunks) -> size_t {
+    size_t chunk_count = 0;
+    size_t begin = 0;
+    for (size_t i = 0; i < chunks.length && begin < input->length; i++) {
+        size_t end = input->length;
+        if (i + 1 < chunks.length) {
+            size_t target = input->length / chunks.length * (i + 1);
+            if (target > begin) {
+                size_t newline = scan_until_class(input, target, CHAR_CLASS_NEWLINE);
+                end = newline < input->length ? newline + 1 : input->length;
+            }
+            else {
+                continue;
             }
         }
-        else if (c == static_cast<char>(TokenType::BRACE_CLOSE)) {
-            append_token_of_type(TokenType::BRACE_CLOSE);
-        }
-        else if (c == static_cast<char>(TokenType::BRACE_OPEN)) {
-            append_token_of_type(TokenType::BRACE_OPEN);
-            current_position.col += 1;
-        }
-        else if (c == static_cast<char>(TokenType::PARENTHESIS_CLOSE)) {
-            append_token_of_type(TokenType::PARENTHESIS_CLOSE);
-            current_position.col += 1;
-        }
-        else if (c == static_cast<char>(TokenType::PARENTHESIS_OPEN)) {
-            append_token_of_type(TokenType::PARENTHESIS_OPEN);
-            current_position.col += 1;
-        }
-        else if (c == ':') {
-            char next_char = next_char_or_null_char(input, i);
-            switch (next_char) {
-                case ':':
-                    i++;
-                    append_token_of_type(TokenType::CONST_DEF);
-                    current_position.col += 2;
-                    break;
-                case '=':
-                    i++;
-                    append_token_of_type(TokenType::VAR_DEF);
-                    current_position.col += 2;
-                    break;
-                default:
-                    append_token_of_type(TokenType::TYPE_SEPARATOR);
-                    current_position.col += 1;
-                    break;
+        chunks[chunk_count++] = TokenChunk {
+            .begin = begin,
+            .end = end,
+        };
+        begin = end;
+    }
+    return chunk_count;
+}
+
+/**
+ * Tokenizes large inputs by lexing chunks of lines in parallel, each into its own
+ * arena blocks. The chunks are then stitched into the store in order, and indentation
+ * levels are resolved once the width of the first indentation is known.
+ */
+static auto tokenize_in_chunks(
+    String *input,
+    SymbolTable *symbols,
+    ArenaAllocator *allocator,
+    size_t max_chunk_count
+) -> TokenStore {
+    size_t const max_rank_count = (input->length + 1) / TOKEN_STORE_RANK_BLOCK_SIZE + 1;
+    auto ranks_block = allocate_array<uint32_t>(allocator, max_rank_count);
+    auto store_blocks = allocate_token_store_blocks(allocator, input->length);
+    // The payload block has to be the last allocation in order to shrink it, so
+    // the chunk blocks are scratch allocations, which are released once stitched
+    auto scratch = ScratchScope(allocator);
+
+    auto chunks_block = allocate_array<TokenChunk>(scratch.allocator, max_chunk_count);
+    Array<TokenChunk> chunks = Array<TokenChunk>(chunks_block.data, chunks_block.length);
+    chunks.length = split_into_chunks(input, chunks);
+    for (auto &chunk : chunks) {
+        chunk.blocks = allocate_token_store_blocks(scratch.allocator, chunk.end - chunk.begin);
+    }
+
+    // Lex the chunks in parallel
+    parallel_for(chunks.length, [&](size_t chunk_index) {
+        TokenChunk *chunk = &chunks[chunk_index];
+        // Restrict the input to the chunk but keep the offsets absolute. Each chunk
+        // validates its own lines, so the lexer is set up without lexer_from_input().
+        String chunk_input = String::from_data_and_length(input->data, chunk->end);
+        expect_valid_utf8(&chunk_input, chunk->begin);
+        Lexer lexer = {
+            .input = chunk_input,
+            .offset = chunk->begin,
+            .first_indentation_space_count = 0,
+            .raw_indentation = true,
+            .symbols = symbols,
+        };
+        chunk->token_count = lex_into(
+            &lexer,
+            chunk->blocks.types.data,
+            chunk->blocks.offsets.data,
+            chunk->blocks.payloads.data,
+            chunk->blocks.matching_parens.data,
+            chunk->blocks.statement_ends.data,
+            &chunk->payload_count
+        );
+        // Only the last chunk keeps its END token
+        if (chunk_index + 1 < chunks.length) {
+            chunk->token_count--;
+        }
+    });
+
+    // Find the first indentation, which determines the width of a single level
+    size_t token_count = 0;
+    size_t payload_count = 0;
+    size_t first_indentation_space_count = 0;
+    for (auto &chunk : chunks) {
+        chunk.token_base = token_count;
+        chunk.payload_base = payload_count;
+        token_count += chunk.token_count;
+        payload_count += chunk.payload_count;
+        if (first_indentation_space_count != 0) {
+            continue;
+        }
+        size_t chunk_payload_index = 0;
+        for (size_t i = 0; i < chunk.token_count; i++) {
+            TokenType type = chunk.blocks.types.data[i];
+            if (type == TokenType::INDENT) {
+                first_indentation_space_count =
+                    chunk.blocks.payloads.data[chunk_payload_index].indent_level;
+                break;
             }
+            chunk_payload_index += token_has_payload(type);
         }
-        else if(c == '"') {
-            // Expect a string literal
-            auto begin = i + 1;
-            while (i + 1 < input->length) {
-                i++;
-                if (char_at(input, i) == '"') {
-                    break;
-                }
+    }
+
+    // Stitch the chunks in parallel, resolving the indentation levels on the way
+    parallel_for(chunks.length, [&](size_t chunk_index) {
+        TokenChunk *chunk = &chunks[chunk_index];
+        memcpy(
+            store_blocks.types.data + chunk->token_base,
+            chunk->blocks.types.data,
+            chunk->token_count * sizeof(TokenType)
+        );
+        memcpy(
+            store_blocks.offsets.data + chunk->token_base,
+            chunk->blocks.offsets.data,
+            chunk->token_count * sizeof(uint32_t)
+        );
+        // Chunks begin at line starts, so no statement spans chunks
+        // and only the indices in the tables have to be rebased
+        uint32_t const token_base = static_cast<uint32_t>(chunk->token_base);
+        uint32_t *matching_parens = store_blocks.matching_parens.data + chunk->token_base;
+        uint32_t *statement_ends = store_blocks.statement_ends.data + chunk->token_base;
+        for (size_t i = 0; i < chunk->token_count; i++) {
+            uint32_t matching_paren = chunk->blocks.matching_parens.data[i];
+            matching_parens[i] = matching_paren != TOKEN_INDEX_NONE
+                ? matching_paren + token_base
+                : TOKEN_INDEX_NONE;
+            statement_ends[i] = chunk->blocks.statement_ends.data[i] + token_base;
+        }
+
+        TokenPayload *payloads = store_blocks.payloads.data + chunk->payload_base;
+        memcpy(payloads, chunk->blocks.payloads.data, chunk->payload_count * sizeof(TokenPayload));
+
+        size_t width = first_indentation_space_count;
+        size_t payload_index = 0;
+        for (size_t i = 0; i < chunk->token_count; i++) {
+            TokenType type = chunk->blocks.types.data[i];
+            if (type == TokenType::INDENT) {
+                payloads[payload_index].indent_level =
+                    indentation_level(&width, payloads[payload_index].indent_level);
             }
-            auto string_len = i - begin;
-            append_token({
-                .type = TokenType::STRING_LITERAL,
-                .string_literal = {
-                    .content = String::from_data_and_length(
-                        input->data + begin,
-                        string_len
-                    )
-                },
-            });
-            current_position.col += (string_len + 2); // +2 for the quotes
-        }
-        else if (c == static_cast<char>(TokenType::ADD)) {
-            append_token_of_type(TokenType::ADD);
-            current_position.col += 1;
-        }
-    }
-
-    append_token_of_type(TokenType::END);
-
-    // The final token count is known now, shrink the allocation
-    tokens_block = shrink_last_allocation(allocator, &tokens_block, current_token_index);
-    result.length = tokens_block.length;
-    print("Tokens block allocation size: % (% tokens)\n", allocation_size(&tokens_block), tokens_block.length);
-    return result;
+            payload_index += token_has_payload(type);
+        }
+    });
+
+    // Shrink the payload block to the final payload count
+    store_blocks.payloads = shrink_last_allocation(allocator, &store_blocks.payloads, payload_count);
+
+    TokenStore store = {
+        .source = *input,
+        .symbols = symbols,
+        .types = Array<TokenType>(store_blocks.types.data, token_count),
+        .offsets = Array<uint32_t>(store_blocks.offsets.data, token_count),
+        .payloads = to_array(&store_blocks.payloads),
+        .payload_ranks = Array<uint32_t>(
+            ranks_block.data,
+            (token_count + TOKEN_STORE_RANK_BLOCK_SIZE - 1) / TOKEN_STORE_RANK_BLOCK_SIZE
+        ),
+        .matching_parens = Array<uint32_t>(store_blocks.matching_parens.data, token_count),
+        .statement_ends = Array<uint32_t>(store_blocks.statement_ends.data, token_count),
+    };
+    compute_payload_ranks(&store);
+    print("Token store: % tokens, % payloads, % chunks\n", token_count, payload_count, chunks.length);
+    return store;
+}
+
+/**
+ * Tokenizes the input string into a token store.
+ *
+ * Large inputs are tokenized in parallel chunks, which are stitched in order.
+ *
+ * The tokens are stored in an ArenaAllocator for efficient memory management.
+ */
+auto tokenize(String *input, SymbolTable *symbols, ArenaAllocator *allocator) -> TokenStore {
+    size_t max_chunk_count = input->length / TOKENIZATION_MIN_CHUNK_SIZE;
+    if (max_chunk_count > 1 && worker_thread_count() > 1) {
+        if (max_chunk_count > worker_thread_count()) {
+            max_chunk_count = worker_thread_count();
+        }
+        return tokenize_in_chunks(input, symbols, allocator, max_chunk_count);
+    }
+
+    size_t const max_rank_count = (input->length + 1) / TOKEN_STORE_RANK_BLOCK_SIZE + 1;
+    auto ranks_block = allocate_array<uint32_t>(allocator, max_rank_count);
+    auto blocks = allocate_token_store_blocks(allocator, input->length);
+
+    auto lexer = lexer_from_input(input, symbols);
+    size_t payload_count = 0;
+    size_t token_count = lex_into(
+        &lexer,
+        blocks.types.data,
+        blocks.offsets.data,
+        blocks.payloads.data,
+        blocks.matching_parens.data,
+        blocks.statement_ends.data,
+        &payload_count
+    );
+
+    // The final payload count is known now, shrink the allocation
+    blocks.payloads = shrink_last_allocation(allocator, &blocks.payloads, payload_count);
+
+    TokenStore store = {
+        .source = *input,
+        .symbols = symbols,
+        .types = Array<TokenType>(blocks.types.data, token_count),
+        .offsets = Array<uint32_t>(blocks.offsets.data, token_count),
+        .payloads = to_array(&blocks.payloads),
+        .payload_ranks = Array<uint32_t>(
+            ranks_block.data,
+            (token_count + TOKEN_STORE_RANK_BLOCK_SIZE - 1) / TOKEN_STORE_RANK_BLOCK_SIZE
+        ),
+        .matching_parens = Array<uint32_t>(blocks.matching_parens.data, token_count),
+        .statement_ends = Array<uint32_t>(blocks.statement_ends.data, token_count),
+    };
+    compute_payload_ranks(&store);
+    print("Token store: % tokens, % payloads\n", token_count, payload_count);
+    return store;
 }
@@ -1,13 +1,17 @@
-#include <bloom/defer.h>
 #include <bloom/log.h>
 #include <bloom/print.h>
 #include <bloom/transpilation.h>
 
+/**
+ * Allocates an empty dynamic string at the end of the arena, which grows as it's pushed to.
+ * Nothing else may be allocated from the arena while the string grows.
+ */
 static auto allocate_dynamic_str(ArenaAllocator *allocator) -> DynamicString {
     return {
         .data = reinterpret_cast<char*>(allocator->data + allocator->offset),
         .length = 0,
         .max_length = allocator->length - allocator->offset,
+        .allocator = allocator,
     };
 }
 
@@ -16,125 +20,332 @@ static auto allocate_dynamic_str(ArenaAllocator *allocator) -> DynamicString {
  */
 static auto allocate_null_terminated_str_from_str(ArenaAllocator *allocator, String *str) -> char* {
     // +1 for null-terminator
-    size_t required_size = (str->length + 1) * sizeof(char);
-    assert(allocator->offset + required_size <= allocator->length &&
-        "Failed to allocate C string from ArenaAllocator");
-    char *c_str = reinterpret_cast<char*>(allocator->data + allocator->offset);
-    allocator->offset += required_size;
+    char *c_str = allocate_array<char>(allocator, str->length + 1).data;
     memcpy(c_str, str->data, str->length * sizeof(char));
     // Null-terminate the string
     c_str[str->length] = '\0';
     return c_str;
 }
 
+/**
+ * Pushes the content of a string literal as the content of a C string literal.
+ * @return Length increase after pushing the value.
+ */
+static auto push_c_string_content(DynamicString *str, String *content, bool has_escapes) -> size_t {
+    // Without escape sequences, the content can't contain anything that C would interpret
+    if (!has_escapes) {
+        return push_str(str, content);
+    }
+    size_t pushed = 0;
+    for (size_t i = 0; i < content->length; i++) {
+        char c = content->data[i];
+        if (c != '\\') {
+            pushed += push_str(str, c);
+            continue;
+        }
+        // Decode the escape sequence and escape the byte again the way C expects it
+        int value = string_escape_value(content->data[++i]);
+        assert(value >= 0 && "Escape sequences should have been validated by the lexer");
+        switch (value) {
+            case '"':  pushed += push_str(str, "\\\""); break;
+            case '\\': pushed += push_str(str, "\\\\"); break;
+            case '\n': pushed += push_str(str, "\\n"); break;
+            case '\r': pushed += push_str(str, "\\r"); break;
+            case '\t': pushed += push_str(str, "\\t"); break;
+            // An octal escape with all 3 digits can't run into the digits after it
+            case '\0': pushed += push_str(str, "\\000"); break;
+            default:   pushed += push_str(str, static_cast<char>(value)); break;
+        }
+    }
+    return pushed;
+}
+
+/**
+ * The passes that the C code is generated from.
+ */
+struct CTranspiler {
+    AST *ast;
+    NameResolution *resolution;
+    TypeCheck *type_check;
+    CallGraph *call_graph;
+    ProcFolding *folding;
+};
+
+static auto push_c_expression(DynamicString *str, CTranspiler *transpiler, SegmentedSlice<ExpressionOp> ops, uint32_t op) -> size_t;
+
+/**
+ * Pushes the subexpression that ends at the given op as an operand,
+ * parenthesized if it's an operator so that C keeps its precedence.
+ * @return Length increase after pushing the value.
+ */
+static auto push_c_operand(DynamicString *str, CTranspiler *transpiler, SegmentedSlice<ExpressionOp> ops, uint32_t op) -> size_t {
+    auto kind = ops[op].kind;
+    if (!is_binary_operator(kind) && kind != ExpressionOpKind::NEGATE) {
+        return push_c_expression(str, transpiler, ops, op);
+    }
+    size_t pushed = push_str(str, '(');
+    pushed += push_c_expression(str, transpiler, ops, op);
+    pushed += push_str(str, ')');
+    return pushed;
+}
+
+/**
+ * Pushes the given number of call arguments, the last of which ends at the given op.
+ * @return Length increase after pushing the value.
+ */
+static auto push_c_call_arguments(
+    DynamicString *str,
+    CTranspiler *transpiler,
+    SegmentedSlice<ExpressionOp> ops,
+    uint32_t last_argument,
+    uint32_t argument_count
+) -> size_t {
+    if (argument_count == 0) {
+        return 0;
+    }
+    size_t pushed = 0;
+    if (argument_count > 1) {
+        pushed += push_c_call_arguments(
+            str, transpiler, ops,
+            expression_previous_operand(ops, last_argument),
+            argument_count - 1
+        );
+        pushed += push_str(str, ", ");
+    }
+    pushed += push_c_expression(str, transpiler, ops, last_argument);
+    return pushed;
+}
+
+/**
+ * Pushes the subexpression that ends at the given op as a C expression.
+ * @return Length increase after pushing the value.
+ */
+static auto push_c_expression(DynamicString *str, CTranspiler *transpiler, SegmentedSlice<ExpressionOp> ops, uint32_t op) -> size_t {
+    auto &expression_op = ops[op];
+    switch (expression_op.kind) {
+        case ExpressionOpKind::IDENTIFIER: {
+            auto name_span = expression_op.span;
+            // A folded procedure isn't emitted, so it's called through the procedure it's folded into
+            auto binding = resolution_binding(transpiler->resolution, ops.first_index + op);
+            if (binding.kind == BindingKind::PROC) {
+                auto *call_graph = transpiler->call_graph;
+                uint32_t representative = transpiler->folding->representatives[call_graph_proc(call_graph, binding.index)];
+                name_span = ast_proc_def(transpiler->ast, call_graph->procs[representative])->name;
+            }
+            auto name = ast_string(transpiler->ast, name_span);
+            return push_str(str, &name);
+        }
+        case ExpressionOpKind::INTEGER_LITERAL: {
+            char buffer[32] = {0};
+            int written = snprintf(buffer, sizeof(buffer), "%ju", static_cast<uintmax_t>(expression_op.integer_value));
+            assert(written > 0 && "Failed to convert integer literal to string");
+            (void)written;
+            size_t pushed = push_str(str, buffer);
+            // C would otherwise warn that the literal is too large for a signed type
+            if (expression_op.is_unsigned) {
+                pushed += push_str(str, 'u');
+            }
+            return pushed;
+        }
+        case ExpressionOpKind::STRING_LITERAL: {
+            auto value = ast_string(transpiler->ast, expression_op.span);
+            size_t pushed = push_str(str, '"');
+            pushed += push_c_string_content(str, &value, expression_op.has_escapes);
+            pushed += push_str(str, '"');
+            return pushed;
+        }
+        case ExpressionOpKind::NEGATE: {
+            size_t pushed = push_str(str, '-');
+            pushed += push_c_operand(str, transpiler, ops, op - 1);
+            return pushed;
+        }
+        case ExpressionOpKind::CALL: {
+            // The callee ends right before the subexpression of the first argument
+            uint32_t callee = op - 1;
+            for (uint32_t i = 0; i < expression_op.argument_count; i++) {
+                callee = expression_previous_operand(ops, callee);
+            }
+            size_t pushed = push_c_operand(str, transpiler, ops, callee);
+            pushed += push_str(str, '(');
+            pushed += push_c_call_arguments(str, transpiler, ops, op - 1, expression_op.argument_count);
+            pushed += push_str(str, ')');
+            return pushed;
+        }
+        default: {
+            assert(is_binary_operator(expression_op.kind) && "Unsupported expression op in transpilation");
+            uint32_t right = op - 1;
+            uint32_t left = expression_previous_operand(ops, right);
+            size_t pushed = push_c_operand(str, transpiler, ops, left);
+            pushed += push_str(str, ' ');
+            auto operator_str = to_string(expression_op.kind);
+            pushed += push_str(str, &operator_str);
+            pushed += push_str(str, ' ');
+            pushed += push_c_operand(str, transpiler, ops, right);
+            return pushed;
+        }
+    }
+}
+
+/**
+ * Pushes the value of an EXPRESSION node as a C expression.
+ * @return Length increase after pushing the value.
+ */
+static auto push_c_expression_node(DynamicString *str, CTranspiler *transpiler, NodeId node) -> size_t {
+    auto *expression = ast_expression(transpiler->ast, node);
+    auto ops = ast_expression_ops(transpiler->ast, expression);
+    return push_c_expression(str, transpiler, ops, ops.length - 1);
+}
+
+/**
+ * Returns the name of the exact-width C type of a checked type.
+ */
+static auto c_type_name(TypeKind type) -> char const* {
+    char const *c_name = type_info(type).c_name;
+    assert(c_name != nullptr && "Only types of values are transpiled");
+    return c_name;
+}
+
+/**
+ * Returns whether the procedure is emitted, i.e. it's reachable from the roots of the
+ * call graph. The calls to a folded procedure are redirected, so it's only needed if it's a root.
+ */
+static auto is_emitted_proc(CTranspiler *transpiler, uint32_t proc) -> bool {
+    auto *call_graph = transpiler->call_graph;
+    return call_graph->is_reachable[proc] &&
+        (!is_folded(transpiler->folding, proc) || call_graph->is_root[proc]);
+}
+
+/**
+ * Pushes the return type, the name and the parameters of a procedure definition.
+ * @return Length increase after pushing the value.
+ */
+static auto push_c_proc_signature(DynamicString *str, CTranspiler *transpiler, ProcDefASTNode const *proc_def) -> size_t {
+    AST *ast = transpiler->ast;
+    TypeCheck *type_check = transpiler->type_check;
+    auto return_type = proc_def->return_type != TYPE_NONE
+        ? type_check->types[proc_def->return_type]
+        : TypeKind::VOID;
+    size_t pushed = push_str(str, c_type_name(return_type));
+    pushed += push_str(str, ' ');
+    auto proc_name = ast_string(ast, proc_def->name);
+    pushed += push_str(str, &proc_name);
+    pushed += push_str(str, '(');
+    for (size_t i = 0; i < proc_def->parameter_count; i++) {
+        auto *param = ast_proc_param(ast, proc_def, i);
+        auto param_name = ast_string(ast, param->name);
+        if (i != 0) {
+            pushed += push_str(str, ", ");
+        }
+        pushed += push_str(str, c_type_name(type_check->types[param->type]));
+        pushed += push_str(str, ' ');
+        pushed += push_str(str, &param_name);
+    }
+    pushed += push_str(str, ')');
+    return pushed;
+}
+
 auto transpile_to_c(
     String *target_file_path,
-    Array<ASTNode> *ast_nodes,
+    AST *ast,
+    NameResolution *resolution,
+    TypeCheck *type_check,
+    CallGraph *call_graph,
+    ProcFolding *folding,
     ArenaAllocator *allocator
 ) -> void {
-    auto marker = allocator_marker_from_current_offset(allocator);
-    defer(reclaim_to_marker(allocator, &marker));
-    
+    auto transpiler = CTranspiler {
+        .ast = ast,
+        .resolution = resolution,
+        .type_check = type_check,
+        .call_graph = call_graph,
+        .folding = folding,
+    };
+    // The output buffer and the path are released once the file is written
+    auto temporaries = ArenaScope(allocator);
+
     auto str_buffer = allocate_dynamic_str(allocator);
 
-    #define PUSH_STR(value) allocator->offset += push_str(&str_buffer, value)
+    #define PUSH_STR(value) (void)push_str(&str_buffer, value)
 
-    PUSH_STR("#include <stdio.h>\n\n");
+    PUSH_STR("#include <stdbool.h>\n#include <stdint.h>\n#include <stdio.h>\n\n");
 
-    for (auto &node : *ast_nodes) {
-        switch (node.type) {
-            case ASTNodeType::PROC_DEF: {
-                char const *return_type_name = nullptr;
-                if (node.proc_def.return_type != nullptr) {
-                    if (node.proc_def.return_type->name == "Int") {
-                        return_type_name = "int";
-                    }
-                }
-                else {
-                    return_type_name = "void";
+    // Procedures can be called before their definition, so every emitted procedure
+    // is declared before the first definition
+    size_t declared_count = 0;
+    for (uint32_t proc = 0; proc < call_graph->procs.length; proc++) {
+        if (!is_emitted_proc(&transpiler, proc)) {
+            continue;
+        }
+        (void)push_c_proc_signature(&str_buffer, &transpiler, ast_proc_def(ast, call_graph->procs[proc]));
+        PUSH_STR(";\n");
+        declared_count++;
+    }
+    if (declared_count != 0) {
+        PUSH_STR('\n');
+    }
+
+    for (uint32_t proc = 0; proc < call_graph->procs.length; proc++) {
+        if (!is_emitted_proc(&transpiler, proc)) {
+            continue;
+        }
+        bool is_folded_proc = is_folded(folding, proc);
+        NodeId node = call_graph->procs[proc];
+        auto &proc_def = *ast_proc_def(ast, node);
+        (void)push_c_proc_signature(&str_buffer, &transpiler, &proc_def);
+        PUSH_STR("{\n");
+        if (is_folded_proc) {
+            // A folded root stays callable by its name as a thin alias of the procedure it's folded into
+            auto representative_name = ast_string(ast, ast_proc_def(ast, call_graph->procs[folding->representatives[proc]])->name);
+            PUSH_STR('\t');
+            if (proc_def.return_type != TYPE_NONE) {
+                PUSH_STR("return ");
+            }
+            PUSH_STR(&representative_name);
+            PUSH_STR('(');
+            for (size_t i = 0; i < proc_def.parameter_count; i++) {
+                auto param_name = ast_string(ast, ast_proc_param(ast, &proc_def, i)->name);
+                if (i != 0) {
+                    PUSH_STR(", ");
                 }
-                assert(return_type_name != nullptr && "Unsupported return type in transpilation");
-                PUSH_STR(return_type_name);
-                PUSH_STR(' ');
-                PUSH_STR(&node.proc_def.name);
-                PUSH_STR('(');
-                auto *params = &node.proc_def.parameters;
-                for (size_t i = 0; i < params->length; i++) {
-                    auto *param = &params->data[i];
-                    if (i != 0) {
-                        PUSH_STR(", ");
+                PUSH_STR(&param_name);
+            }
+            PUSH_STR(");\n}\n\n");
+            continue;
+        }
+        ast_for_each_child(ast, node, [&](NodeId statement) {
+            switch (ast_kind(ast, statement)) {
+                case ASTNodeType::EXPRESSION: {
+                    PUSH_STR('\t');
+                    // The last statement of a procedure with a return type is its return value
+                    if (proc_def.return_type != TYPE_NONE &&
+                        ast_subtree_end(ast, statement) == ast_subtree_end(ast, node)) {
+                        PUSH_STR("return ");
                     }
-                    // For simplicity, assume all parameters are of type int
-                    PUSH_STR("int ");
-                    PUSH_STR(&param->name);
+                    (void)push_c_expression_node(&str_buffer, &transpiler, statement);
+                    PUSH_STR(";\n");
+                    break;
                 }
-                PUSH_STR(')');
-                PUSH_STR("{\n");
-                for (auto &statement : node.proc_def.body) {
-                    switch (statement.type) {
-                        case ASTNodeType::BINARY_ADD: {
-                            PUSH_STR('\t');
-                            PUSH_STR("return ");
-                            PUSH_STR(&statement.binary_operation.identifier_left);
-                            PUSH_STR(" + ");
-                            PUSH_STR(&statement.binary_operation.identifier_right);
-                            PUSH_STR(";\n");
-                            break;
-                        }
-                        case ASTNodeType::PROC_CALL: {
-                            // For simplicity, assume procedure calls return void
-                            PUSH_STR('\t');
-                            PUSH_STR(&statement.proc_call.caller_identifier);
-                            PUSH_STR('(');
-                            auto args_len = statement.proc_call.arguments.length;
-                            for (size_t i = 0; i < args_len; i++) {
-                                auto *arg = &statement.proc_call.arguments[i];
-                                if (arg->type == ASTNodeType::IDENTIFIER) {
-                                    PUSH_STR(&arg->identifier);
-                                    goto add_comma_inbetween;
-                                }
-                                else if (arg->type != ASTNodeType::STRING_LITERAL) {
-                                    assert(false && "Only identifier and string literal arguments are supported in transpilation");
-                                }
-                                PUSH_STR('"');
-                                PUSH_STR(&arg->string_literal.value);
-                                PUSH_STR('"');
-
-                                add_comma_inbetween:
-                                    if (i != args_len - 1) {
-                                        PUSH_STR(", ");
-                                    }
-                            }
-                            PUSH_STR(");\n");
-                            break;
-                        }
-                        case ASTNodeType::VARIABLE_DEFINITION: {
-                            PUSH_STR('\t');
-                            PUSH_STR("int ");
-                            PUSH_STR(&statement.variable_definition.name);
-                            PUSH_STR(" = ");
-                            char buffer[32] = {0};
-                            int written = snprintf(
-                                buffer,
-                                sizeof(buffer),
-                                "%ju",
-                                statement.variable_definition.value.value
-                            );
-                            assert(written > 0 && "Failed to convert integer literal to string");
-                            PUSH_STR(buffer);
-                            PUSH_STR(";\n");
-                            break;
-                        }
-                        default:
-                            break;
+                case ASTNodeType::VARIABLE_DEFINITION: {
+                    auto *variable_definition = ast_variable_definition(ast, statement);
+                    // The value is missing if it failed to parse
+                    if (variable_definition->value == NODE_NONE) {
+                        break;
                     }
+                    auto name = ast_string(ast, variable_definition->name);
+                    PUSH_STR('\t');
+                    PUSH_STR(c_type_name(variable_type(ast, type_check, variable_definition)));
+                    PUSH_STR(' ');
+                    PUSH_STR(&name);
+                    PUSH_STR(" = ");
+                    (void)push_c_expression_node(&str_buffer, &transpiler, variable_definition->value);
+                    PUSH_STR(";\n");
+                    break;
                 }
-                PUSH_STR("}\n\n");
-                break;
+                default:
+                    break;
             }
-            default:
-                break;
-        }
+        });
+        PUSH_STR("}\n\n");
     }
 
     #undef PUSH_STR
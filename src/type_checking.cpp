@@ -0,0 +1,592 @@
+#include <bloom/diagnostics.h>
+#include <bloom/print.h>
+#include <bloom/type_checking.h>
+
+/**
+ * The type that every builtin symbol names, indexed by the symbol.
+ * It's ERROR for the builtins that aren't type names.
+ */
+constexpr TypeKind BUILTIN_SYMBOL_TYPES[BUILTIN_SYMBOL_COUNT] = {
+    /* SYMBOL_INT */    INT_DEFAULT_TYPE,
+    /* SYMBOL_PRINTF */ TypeKind::ERROR,
+    /* SYMBOL_BOOL */   TypeKind::BOOL,
+    /* SYMBOL_I8 */     TypeKind::I8,
+    /* SYMBOL_I16 */    TypeKind::I16,
+    /* SYMBOL_I32 */    TypeKind::I32,
+    /* SYMBOL_I64 */    TypeKind::I64,
+    /* SYMBOL_U8 */     TypeKind::U8,
+    /* SYMBOL_U16 */    TypeKind::U16,
+    /* SYMBOL_U32 */    TypeKind::U32,
+    /* SYMBOL_U64 */    TypeKind::U64,
+};
+
+/**
+ * Returns the type that the name stands for, or ERROR if it isn't a type name.
+ */
+static inline auto type_of_name(SymbolId symbol) -> TypeKind {
+    return symbol < BUILTIN_SYMBOL_COUNT ? BUILTIN_SYMBOL_TYPES[symbol] : TypeKind::ERROR;
+}
+
+enum class TypeErrorCode {
+    ARGUMENT_COUNT,
+    EXPECTED_TYPE,
+    INTEGER_OVERFLOW,
+    INVALID_OPERAND,
+    MISMATCHED_TYPES,
+    MISSING_RETURN_VALUE,
+    NESTED_PROC,
+    NOT_CALLABLE,
+    NO_VALUE,
+    PROC_VALUE,
+    UNKNOWN_TYPE,
+};
+
+struct TypeError {
+    TypeErrorCode code;
+    /**
+     * The name or the operand that the error is reported at.
+     */
+    SourceSpan span;
+    TypeKind expected_type;
+    TypeKind actual_type;
+    ExpressionOpKind op_kind;
+    uint32_t expected_count;
+    uint32_t actual_count;
+};
+
+// Only the first errors are kept for reporting, the rest are just counted
+size_t constexpr MAX_TYPE_ERROR_COUNT = 16;
+
+struct TypeChecker {
+    AST *ast;
+    NameResolution *resolution;
+    Array<TypeKind> op_types;
+    Array<TypeKind> types;
+    /**
+     * The name of the innermost definition, where errors are reported if their
+     * expression doesn't contain any names, e.g. when it only has literals.
+     */
+    SourceSpan definition_name;
+    TypeError errors[MAX_TYPE_ERROR_COUNT];
+    size_t error_count;
+};
+
+/**
+ * The ops of an expression and their types, which are both indexed relative to the expression.
+ */
+struct TypedExpression {
+    SegmentedSlice<ExpressionOp> ops;
+    TypeKind *op_types;
+    uint32_t first_op;
+};
+
+static auto report_error(TypeChecker *checker, TypeError error) -> void {
+    if (checker->error_count < MAX_TYPE_ERROR_COUNT) {
+        checker->errors[checker->error_count] = error;
+    }
+    checker->error_count++;
+}
+
+/**
+ * Returns where an error about the subexpression that ends at the given op is reported,
+ * which is the first name or string in it, or else the closest one before it.
+ */
+static auto error_span(TypeChecker *checker, TypedExpression *expression, uint32_t op) -> SourceSpan {
+    auto has_span = [&](uint32_t index) {
+        auto kind = expression->ops[index].kind;
+        return kind == ExpressionOpKind::IDENTIFIER || kind == ExpressionOpKind::STRING_LITERAL;
+    };
+    uint32_t begin = op + 1 - expression->ops[op].size;
+    for (uint32_t index = begin; index <= op; index++) {
+        if (has_span(index)) {
+            return expression->ops[index].span;
+        }
+    }
+    for (uint32_t index = begin; index-- > 0;) {
+        if (has_span(index)) {
+            return expression->ops[index].span;
+        }
+    }
+    return checker->definition_name;
+}
+
+static auto report_op_error(
+    TypeChecker *checker,
+    TypedExpression *expression,
+    uint32_t op,
+    TypeErrorCode code,
+    TypeKind expected_type = TypeKind::ERROR,
+    TypeKind actual_type = TypeKind::ERROR
+) -> void {
+    report_error(checker, TypeError {
+        .code = code,
+        .span = error_span(checker, expression, op),
+        .expected_type = expected_type,
+        .actual_type = actual_type,
+        .op_kind = expression->ops[op].kind,
+        .expected_count = 0,
+        .actual_count = 0,
+    });
+}
+
+/**
+ * Checks that an integer literal, or a negated one, that ends at the given op fits in the integer type.
+ * The values of other integer literal expressions aren't known until the C compiler folds them.
+ */
+static auto check_literal_fits(TypeChecker *checker, TypedExpression *expression, uint32_t op, TypeKind type) -> void {
+    bool is_negative = expression->ops[op].kind == ExpressionOpKind::NEGATE;
+    uint32_t literal = is_negative ? op - 1 : op;
+    if (expression->ops[literal].kind != ExpressionOpKind::INTEGER_LITERAL) {
+        return;
+    }
+    uint64_t value = expression->ops[literal].integer_value;
+    auto &info = type_info(type);
+    uint32_t value_bits = info.size * 8 - (info.is_signed ? 1 : 0);
+    // Negative values reach one further than positive ones in two's complement
+    uint64_t max_value = value_bits == 64 ? UINT64_MAX : (uint64_t(1) << value_bits) - (is_negative ? 0 : 1);
+    bool fits = is_negative && !info.is_signed ? value == 0 : value <= max_value;
+    if (!fits) {
+        // Literal ops have no span, so the error is reported where the literal, or its minus sign, begins
+        auto offset = *segmented_array_at(checker->ast->expression_op_offsets, expression->first_op + op);
+        report_error(checker, TypeError {
+            .code = TypeErrorCode::INTEGER_OVERFLOW,
+            .span = SourceSpan { .offset = offset, .length = 0 },
+            .expected_type = type,
+            .actual_type = TypeKind::ERROR,
+            .op_kind = expression->ops[op].kind,
+            .expected_count = 0,
+            .actual_count = 0,
+        });
+    }
+}
+
+/**
+ * Returns the type of the subexpression that ends at the given op as a value.
+ * Using a procedure or an expression without a value as one is an error.
+ */
+static auto value_type(TypeChecker *checker, TypedExpression *expression, uint32_t op) -> TypeKind {
+    auto type = expression->op_types[op];
+    if (type == TypeKind::VOID) {
+        report_op_error(checker, expression, op, TypeErrorCode::NO_VALUE);
+        return TypeKind::ERROR;
+    }
+    if (type == TypeKind::PROC) {
+        report_op_error(checker, expression, op, TypeErrorCode::PROC_VALUE);
+        return TypeKind::ERROR;
+    }
+    return type;
+}
+
+/**
+ * Checks that the subexpression that ends at the given op can be used as a value of the given type.
+ */
+static auto coerce(TypeChecker *checker, TypedExpression *expression, uint32_t op, TypeKind expected_type) -> void {
+    auto type = value_type(checker, expression, op);
+    if (type == TypeKind::ERROR || expected_type == TypeKind::ERROR || type == expected_type) {
+        return;
+    }
+    if (type == TypeKind::INTEGER_LITERAL && is_integer_type(expected_type)) {
+        check_literal_fits(checker, expression, op, expected_type);
+        return;
+    }
+    report_op_error(checker, expression, op, TypeErrorCode::EXPECTED_TYPE, expected_type, type);
+}
+
+/**
+ * Returns the common type of the operands of a binary operator. An integer literal
+ * operand takes the type of the other operand.
+ */
+static auto unify_operands(TypeChecker *checker, TypedExpression *expression, uint32_t left, uint32_t right) -> TypeKind {
+    auto left_type = value_type(checker, expression, left);
+    auto right_type = value_type(checker, expression, right);
+    if (left_type == TypeKind::ERROR || right_type == TypeKind::ERROR) {
+        return TypeKind::ERROR;
+    }
+    if (left_type == right_type) {
+        return left_type;
+    }
+    if (left_type == TypeKind::INTEGER_LITERAL && is_integer_type(right_type)) {
+        check_literal_fits(checker, expression, left, right_type);
+        return right_type;
+    }
+    if (right_type == TypeKind::INTEGER_LITERAL && is_integer_type(left_type)) {
+        check_literal_fits(checker, expression, right, left_type);
+        return left_type;
+    }
+    report_error(checker, TypeError {
+        .code = TypeErrorCode::MISMATCHED_TYPES,
+        .span = error_span(checker, expression, right),
+        .expected_type = left_type,
+        .actual_type = right_type,
+        .op_kind = ExpressionOpKind::UNKNOWN,
+        .expected_count = 0,
+        .actual_count = 0,
+    });
+    return TypeKind::ERROR;
+}
+
+static auto binary_operation_type(TypeChecker *checker, TypedExpression *expression, uint32_t op) -> TypeKind {
+    uint32_t right = op - 1;
+    uint32_t left = expression_previous_operand(expression->ops, right);
+    auto type = unify_operands(checker, expression, left, right);
+    auto kind = expression->ops[op].kind;
+    bool is_integer = is_integer_type(type) || type == TypeKind::INTEGER_LITERAL;
+    bool is_equality = kind == ExpressionOpKind::EQUAL || kind == ExpressionOpKind::NOT_EQUAL;
+    bool is_comparison = is_equality || (kind >= ExpressionOpKind::LESS_THAN && kind <= ExpressionOpKind::GREATER_EQUAL);
+    if (type != TypeKind::ERROR && !is_integer && !(is_equality && type == TypeKind::BOOL)) {
+        report_op_error(checker, expression, op, TypeErrorCode::INVALID_OPERAND, TypeKind::ERROR, type);
+        type = TypeKind::ERROR;
+    }
+    return is_comparison ? TypeKind::BOOL : type;
+}
+
+static auto negation_type(TypeChecker *checker, TypedExpression *expression, uint32_t op) -> TypeKind {
+    auto type = value_type(checker, expression, op - 1);
+    bool is_signed = type == TypeKind::INTEGER_LITERAL || (is_integer_type(type) && type_info(type).is_signed);
+    if (type != TypeKind::ERROR && !is_signed) {
+        report_op_error(checker, expression, op, TypeErrorCode::INVALID_OPERAND, TypeKind::ERROR, type);
+        return TypeKind::ERROR;
+    }
+    return type;
+}
+
+static auto call_type(TypeChecker *checker, TypedExpression *expression, uint32_t op) -> TypeKind {
+    AST *ast = checker->ast;
+    uint32_t argument_count = expression->ops[op].argument_count;
+    uint32_t callee = op - 1;
+    for (uint32_t i = 0; i < argument_count; i++) {
+        callee = expression_previous_operand(expression->ops, callee);
+    }
+    auto callee_type = expression->op_types[callee];
+    if (callee_type == TypeKind::ERROR) {
+        return TypeKind::ERROR;
+    }
+    if (callee_type != TypeKind::PROC) {
+        report_op_error(checker, expression, callee, TypeErrorCode::NOT_CALLABLE, TypeKind::ERROR, callee_type);
+        return TypeKind::ERROR;
+    }
+
+    // Only procedure names have the procedure type
+    auto binding = resolution_binding(checker->resolution, expression->first_op + callee);
+    if (binding.kind == BindingKind::BUILTIN) {
+        assert(binding.index == SYMBOL_PRINTF && "Only printf is a callable builtin");
+        // The format string comes first, and the rest of the arguments can be anything with a value
+        uint32_t argument = op - 1;
+        for (uint32_t i = argument_count; i-- > 0;) {
+            if (i == 0) {
+                coerce(checker, expression, argument, TypeKind::STRING);
+            }
+            else {
+                (void)value_type(checker, expression, argument);
+            }
+            argument = expression_previous_operand(expression->ops, argument);
+        }
+        if (argument_count == 0) {
+            report_error(checker, TypeError {
+                .code = TypeErrorCode::ARGUMENT_COUNT,
+                .span = error_span(checker, expression, callee),
+                .expected_type = TypeKind::ERROR,
+                .actual_type = TypeKind::ERROR,
+                .op_kind = ExpressionOpKind::CALL,
+                .expected_count = 1,
+                .actual_count = 0,
+            });
+        }
+        return TypeKind::I32;
+    }
+
+    auto *proc_def = ast_proc_def(ast, binding.index);
+    auto return_type = proc_def->return_type != TYPE_NONE
+        ? checker->types[proc_def->return_type]
+        : TypeKind::VOID;
+    if (argument_count != proc_def->parameter_count) {
+        report_error(checker, TypeError {
+            .code = TypeErrorCode::ARGUMENT_COUNT,
+            .span = error_span(checker, expression, callee),
+            .expected_type = TypeKind::ERROR,
+            .actual_type = TypeKind::ERROR,
+            .op_kind = ExpressionOpKind::CALL,
+            .expected_count = proc_def->parameter_count,
+            .actual_count = argument_count,
+        });
+        return return_type;
+    }
+    // The arguments are walked backwards from the last one
+    uint32_t argument = op - 1;
+    for (uint32_t i = argument_count; i-- > 0;) {
+        auto *param = ast_proc_param(ast, proc_def, i);
+        coerce(checker, expression, argument, checker->types[param->type]);
+        argument = expression_previous_operand(expression->ops, argument);
+    }
+    return return_type;
+}
+
+static auto identifier_type(TypeChecker *checker, TypedExpression *expression, uint32_t op) -> TypeKind {
+    AST *ast = checker->ast;
+    auto binding = resolution_binding(checker->resolution, expression->first_op + op);
+    switch (binding.kind) {
+        case BindingKind::BUILTIN:
+        case BindingKind::PROC:
+            return TypeKind::PROC;
+        case BindingKind::PARAMETER:
+            return checker->types[segmented_array_at(ast->proc_params, binding.index)->type];
+        case BindingKind::VARIABLE: {
+            auto *variable_definition = ast_variable_definition(ast, binding.index);
+            if (variable_definition->value == NODE_NONE ||
+                ast_kind(ast, variable_definition->value) != ASTNodeType::EXPRESSION) {
+                return TypeKind::ERROR;
+            }
+            // The value comes before the uses of the variable, so its type is known already
+            auto *value = ast_expression(ast, variable_definition->value);
+            return checker->op_types[value->first_op + value->op_count - 1];
+        }
+        case BindingKind::NONE:
+            // Undefined names have been reported already
+            return TypeKind::ERROR;
+    }
+    return TypeKind::ERROR;
+}
+
+/**
+ * Infers the type of every op of an EXPRESSION node. The ops are in postfix order,
+ * so the operands of every op have been typed before it.
+ */
+static auto check_expression(TypeChecker *checker, NodeId node) -> TypedExpression {
+    auto *expression_node = ast_expression(checker->ast, node);
+    auto expression = TypedExpression {
+        .ops = ast_expression_ops(checker->ast, expression_node),
+        .op_types = checker->op_types.data + expression_node->first_op,
+        .first_op = expression_node->first_op,
+    };
+    for (uint32_t op = 0; op < expression.ops.length; op++) {
+        TypeKind type = TypeKind::ERROR;
+        switch (expression.ops[op].kind) {
+            case ExpressionOpKind::IDENTIFIER:
+                type = identifier_type(checker, &expression, op);
+                break;
+            case ExpressionOpKind::INTEGER_LITERAL:
+                type = TypeKind::INTEGER_LITERAL;
+                break;
+            case ExpressionOpKind::STRING_LITERAL:
+                type = TypeKind::STRING;
+                break;
+            case ExpressionOpKind::NEGATE:
+                type = negation_type(checker, &expression, op);
+                break;
+            case ExpressionOpKind::CALL:
+                type = call_type(checker, &expression, op);
+                break;
+            default:
+                assert(is_binary_operator(expression.ops[op].kind) && "Unsupported expression op in type checking");
+                type = binary_operation_type(checker, &expression, op);
+                break;
+        }
+        expression.op_types[op] = type;
+    }
+    return expression;
+}
+
+/**
+ * Gives an expression of integer literals, which nothing else determines the type of, the default type.
+ */
+static auto default_literal_type(TypeChecker *checker, TypedExpression *expression) -> void {
+    uint32_t root = expression->ops.length - 1;
+    if (expression->op_types[root] == TypeKind::INTEGER_LITERAL) {
+        check_literal_fits(checker, expression, root, INT_DEFAULT_TYPE);
+        expression->op_types[root] = INT_DEFAULT_TYPE;
+    }
+}
+
+static auto check_proc(TypeChecker *checker, NodeId node) -> void {
+    AST *ast = checker->ast;
+    auto *proc_def = ast_proc_def(ast, node);
+    auto return_type = proc_def->return_type != TYPE_NONE
+        ? checker->types[proc_def->return_type]
+        : TypeKind::VOID;
+    bool has_return_value = false;
+    ast_for_each_child(ast, node, [&](NodeId statement) {
+        checker->definition_name = proc_def->name;
+        switch (ast_kind(ast, statement)) {
+            case ASTNodeType::EXPRESSION: {
+                auto expression = check_expression(checker, statement);
+                uint32_t root = expression.ops.length - 1;
+                // The last statement of a procedure with a return type is its return value
+                if (return_type != TypeKind::VOID && ast_subtree_end(ast, statement) == ast_subtree_end(ast, node)) {
+                    coerce(checker, &expression, root, return_type);
+                    has_return_value = true;
+                    break;
+                }
+                if (expression.op_types[root] == TypeKind::PROC) {
+                    report_op_error(checker, &expression, root, TypeErrorCode::PROC_VALUE);
+                }
+                default_literal_type(checker, &expression);
+                break;
+            }
+            case ASTNodeType::VARIABLE_DEFINITION: {
+                auto *variable_definition = ast_variable_definition(ast, statement);
+                checker->definition_name = variable_definition->name;
+                if (variable_definition->value == NODE_NONE) {
+                    break;
+                }
+                if (ast_kind(ast, variable_definition->value) == ASTNodeType::PROC_DEF) {
+                    report_error(checker, TypeError {
+                        .code = TypeErrorCode::NESTED_PROC,
+                        .span = variable_definition->name,
+                        .expected_type = TypeKind::ERROR,
+                        .actual_type = TypeKind::ERROR,
+                        .op_kind = ExpressionOpKind::UNKNOWN,
+                        .expected_count = 0,
+                        .actual_count = 0,
+                    });
+                    break;
+                }
+                auto expression = check_expression(checker, variable_definition->value);
+                uint32_t root = expression.ops.length - 1;
+                if (value_type(checker, &expression, root) == TypeKind::ERROR) {
+                    // A variable that is used as a value keeps being an error
+                    expression.op_types[root] = TypeKind::ERROR;
+                }
+                default_literal_type(checker, &expression);
+                break;
+            }
+            default:
+                break;
+        }
+    });
+    if (return_type != TypeKind::VOID && return_type != TypeKind::ERROR && !has_return_value) {
+        report_error(checker, TypeError {
+            .code = TypeErrorCode::MISSING_RETURN_VALUE,
+            .span = proc_def->name,
+            .expected_type = return_type,
+            .actual_type = TypeKind::ERROR,
+            .op_kind = ExpressionOpKind::UNKNOWN,
+            .expected_count = 0,
+            .actual_count = 0,
+        });
+    }
+}
+
+static auto print_type_error(TypeChecker *checker, TypeError const *error) -> void {
+    switch (error->code) {
+        case TypeErrorCode::ARGUMENT_COUNT:
+            print("Expected % arguments, got %\n",
+                static_cast<size_t>(error->expected_count),
+                static_cast<size_t>(error->actual_count));
+            break;
+        case TypeErrorCode::EXPECTED_TYPE:
+            print("Expected % but got %\n",
+                type_info(error->expected_type).name,
+                type_info(error->actual_type).name);
+            break;
+        case TypeErrorCode::INTEGER_OVERFLOW:
+            print("Integer literal doesn't fit in %\n", type_info(error->expected_type).name);
+            break;
+        case TypeErrorCode::INVALID_OPERAND:
+            print("Invalid operand of type % for %\n", type_info(error->actual_type).name, to_string(error->op_kind));
+            break;
+        case TypeErrorCode::MISMATCHED_TYPES:
+            print("Mismatched types % and %\n",
+                type_info(error->expected_type).name,
+                type_info(error->actual_type).name);
+            break;
+        case TypeErrorCode::MISSING_RETURN_VALUE:
+            print("Missing return value of type %\n", type_info(error->expected_type).name);
+            break;
+        case TypeErrorCode::NESTED_PROC:
+            print(stdout, "Procedures can only be defined at the top level\n");
+            break;
+        case TypeErrorCode::NOT_CALLABLE:
+            print("Value of type % isn't callable\n", type_info(error->actual_type).name);
+            break;
+        case TypeErrorCode::NO_VALUE:
+            print(stdout, "Expression has no value\n");
+            break;
+        case TypeErrorCode::PROC_VALUE:
+            print(stdout, "Procedures can only be called\n");
+            break;
+        case TypeErrorCode::UNKNOWN_TYPE:
+            print("Unknown type %\n", ast_string(checker->ast, error->span));
+            break;
+    }
+}
+
+/**
+ * Prints the type errors with their positions and source excerpts.
+ */
+static auto print_type_errors(TypeChecker *checker, ArenaAllocator *allocator) -> void {
+    print("Type error count: %\n", checker->error_count);
+    if (checker->error_count == 0) {
+        return;
+    }
+    auto scratch = ScratchScope(allocator);
+    auto line_index = build_line_index(&checker->ast->source, scratch.allocator);
+    size_t reported_count = checker->error_count < MAX_TYPE_ERROR_COUNT
+        ? checker->error_count
+        : MAX_TYPE_ERROR_COUNT;
+    for (size_t i = 0; i < reported_count; i++) {
+        auto &error = checker->errors[i];
+        auto position = line_index_position(&line_index, error.span.offset);
+        print("\tType error at line %, column %: ", position.line, position.col);
+        print_type_error(checker, &error);
+        print_source_excerpt(stdout, &line_index, error.span.offset);
+    }
+}
+
+auto check_types(AST *ast, NameResolution *resolution, ArenaAllocator *allocator) -> TypeCheck {
+    size_t op_count = ast->expression_ops->length;
+    size_t type_count = ast->types->length;
+    auto op_types_block = allocate_array<TypeKind>(allocator, op_count);
+    auto types_block = allocate_array<TypeKind>(allocator, type_count);
+    auto checker = TypeChecker {
+        .ast = ast,
+        .resolution = resolution,
+        .op_types = Array<TypeKind>(op_types_block.data, op_count),
+        .types = Array<TypeKind>(types_block.data, type_count),
+        .definition_name = {},
+        .errors = {},
+        .error_count = 0,
+    };
+    for (auto &type : checker.op_types) {
+        type = TypeKind::ERROR;
+    }
+
+    uint32_t type_index = 0;
+    for (auto &type_node : to_slice(ast->types)) {
+        auto type = type_of_name(type_node.symbol);
+        if (type == TypeKind::ERROR) {
+            report_error(&checker, TypeError {
+                .code = TypeErrorCode::UNKNOWN_TYPE,
+                .span = type_node.name,
+                .expected_type = TypeKind::ERROR,
+                .actual_type = TypeKind::ERROR,
+                .op_kind = ExpressionOpKind::UNKNOWN,
+                .expected_count = 0,
+                .actual_count = 0,
+            });
+        }
+        checker.types[type_index++] = type;
+    }
+
+    ast_for_each_root(ast, [&](NodeId root) {
+        switch (ast_kind(ast, root)) {
+            case ASTNodeType::EXPRESSION: {
+                checker.definition_name = {};
+                auto expression = check_expression(&checker, root);
+                default_literal_type(&checker, &expression);
+                break;
+            }
+            case ASTNodeType::PROC_DEF:
+                check_proc(&checker, root);
+                break;
+            default:
+                break;
+        }
+    });
+
+    print_type_errors(&checker, allocator);
+    return TypeCheck {
+        .op_types = checker.op_types,
+        .types = checker.types,
+        .error_count = checker.error_count,
+    };
+}